@@ -16,18 +16,93 @@ struct HiSeqXAdapters_;
 typedef Tag<HiSeqXAdapters_> HiSeqXAdapters;
 
 
+// ==========================================================================
+// struct AdapterSequences
+// ==========================================================================
+
+// Adapter sequences of a tag as compile-time strings. truSeqs() lists the TruSeq adapters separated by spaces.
+
 template<typename TTag>
-inline Dna5String
-getUniversal(TTag)
+struct AdapterSequences;
+
+template<>
+struct AdapterSequences<HiSeqAdapters>
 {
-    return "ATCGGAAGAGCGTCGTGTAGGGAAAGAGTGTAGATCTCGGTGGTCGCCGTATCATT";
-}
+    static constexpr char const * universal()
+    {
+        return "ATCGGAAGAGCGTCGTGTAGGGAAAGAGTGTAGATCTCGGTGGTCGCCGTATCATT";
+    }
+
+    static constexpr char const * truSeqs()
+    {
+        return "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "ATCACG"   "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "CGATGT"   "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "TTAGGC"   "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "TGACCA"   "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "ACAGTG"   "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "GCCAAT"   "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "CAGATC"   "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "ACTTGA"   "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "GATCAG"   "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "TAGCTT"   "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "GGCTAC"   "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "CTTGTA"   "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "AGTCAACA" "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "AGTTCCGT" "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "ATGTCAGA" "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "CCGTCCCG" "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "GTCCGCAC" "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "GTGAAACG" "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "GTGGCCTT" "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "GTTTCGGA" "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "CGTACGTA" "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "GAGTGGAT" "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "ACTGATAT" "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "ATTCCTTT" "ATCTCGTATGCCGTCTTCTGCTTG";
+    }
+};
+
+template<>
+struct AdapterSequences<HiSeqXAdapters>
+{
+    static constexpr char const * universal()
+    {
+        return "ATCGGAAGAGCGTCGTGTAGGGAAAGAGTGTGCCTCTATGTGTAGATCTCGGTGGTCGCCGTATCATT";
+    }
 
+    static constexpr char const * truSeqs()
+    {
+        return "AATGATACGGCGACCACCGAGATCTACAC" "TATAGCCT" "ACACTCTTTCCCTACACGACGCTCTTCCGATCT" " "
+               "AATGATACGGCGACCACCGAGATCTACAC" "ATAGAGGC" "ACACTCTTTCCCTACACGACGCTCTTCCGATCT" " "
+               "AATGATACGGCGACCACCGAGATCTACAC" "CCTATCCT" "ACACTCTTTCCCTACACGACGCTCTTCCGATCT" " "
+               "AATGATACGGCGACCACCGAGATCTACAC" "GGCTCTGA" "ACACTCTTTCCCTACACGACGCTCTTCCGATCT" " "
+               "AATGATACGGCGACCACCGAGATCTACAC" "AGGCGAAG" "ACACTCTTTCCCTACACGACGCTCTTCCGATCT" " "
+               "AATGATACGGCGACCACCGAGATCTACAC" "TAATCTTA" "ACACTCTTTCCCTACACGACGCTCTTCCGATCT" " "
+               "AATGATACGGCGACCACCGAGATCTACAC" "CAGGACGT" "ACACTCTTTCCCTACACGACGCTCTTCCGATCT" " "
+               "AATGATACGGCGACCACCGAGATCTACAC" "GTACTGAC" "ACACTCTTTCCCTACACGACGCTCTTCCGATCT" " "
+
+               "GATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "ATTACTCG" "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "GATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "TCCGGAGA" "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "GATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "CGCTCATT" "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "GATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "GAGATTCC" "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "GATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "ATTCAGAA" "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "GATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "GAATTCGT" "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "GATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "CTGAAGCT" "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "GATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "TAATGCGC" "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "GATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "CGGCTATG" "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "GATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "TCCGCGAA" "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "GATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "TCTCGCGC" "ATCTCGTATGCCGTCTTCTGCTTG" " "
+               "GATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "AGCGATAG" "ATCTCGTATGCCGTCTTCTGCTTG";
+    }
+};
+
+template<typename TTag>
 inline Dna5String
-getUniversal(HiSeqXAdapters)
+getUniversal(TTag)
 {
-    return "ATCGGAAGAGCGTCGTGTAGGGAAAGAGTGTGCCTCTATGTGTAGATCTCGGTGGTCGCCGTATCATT";
+    return AdapterSequences<TTag>::universal();
 }
+
 inline Dna5String
 getTruSeqPrefix(HiSeqAdapters)
 {
@@ -52,35 +127,6 @@ getTruSeqSuffix(HiSeqXAdapters)
     return "ACACTCTTTCCCTACACGACGCTCTTCCGATCT";
 }
 
-template<typename TTag>
-inline StringSet<Dna5String>
-reverseUniversalOneError(TTag tag)
-{
-    typedef Dna5String TSeq;
-    typedef Size<TSeq>::Type TSize;
-    typedef Dna TAlphabet;
-
-    // Append the error-free sequence to sequence set.
-    StringSet<TSeq> adaptSeqs;
-    appendValue(adaptSeqs, getUniversal(tag));
-
-    reverse(adaptSeqs[0]);
-
-    // Append all sequences with one mismatch to sequence set.
-    TSeq errSeq = adaptSeqs[0];
-    for (TSize i = 0; i < length(adaptSeqs[0]); ++i)
-    {
-        for (TSize c = 0; c < ValueSize<TAlphabet>::VALUE; ++c)
-        {
-            errSeq[i] = c;
-            appendValue(adaptSeqs, errSeq);
-        }
-        errSeq[i] = adaptSeqs[0][i];
-    }
-
-    return adaptSeqs;
-}
-
 template<typename TSequence>
 bool
 startsWithTruSeq(TSequence & seq, HiSeqXAdapters tag)
@@ -128,149 +174,210 @@ startsWithTruSeq(TSequence & seq, HiSeqAdapters tag)
     return 1;
 }
 
+enum AdapterGroup
+{
+    ADAPTER_TRUSEQ = 0,
+    ADAPTER_UNIVERSAL = 1
+};
+
+// --------------------------------------------------------------------------
+// Function _numAdapters()
+// --------------------------------------------------------------------------
 
-inline StringSet<Dna5String>
-truSeqs(NoAdapters &)
+constexpr unsigned
+_numAdapters(char const * seqs)
 {
-    // Nothing to be done.
-    return StringSet<Dna5String>();
+    unsigned n = (*seqs != '\0');
+    for (; *seqs != '\0'; ++seqs)
+        n += (*seqs == ' ');
+    return n;
 }
 
+// --------------------------------------------------------------------------
+// Function _numBases()
+// --------------------------------------------------------------------------
 
-inline StringSet<Dna5String>
-truSeqs(HiSeqAdapters)
+constexpr unsigned
+_numBases(char const * seqs)
 {
-    StringSet<Dna5String> adaptSeqs;
-
-    appendValue(adaptSeqs, "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "ATCACG"   "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "CGATGT"   "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "TTAGGC"   "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "TGACCA"   "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "ACAGTG"   "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "GCCAAT"   "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "CAGATC"   "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "ACTTGA"   "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "GATCAG"   "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "TAGCTT"   "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "GGCTAC"   "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "CTTGTA"   "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "AGTCAACA" "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "AGTTCCGT" "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "ATGTCAGA" "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "CCGTCCCG" "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "GTCCGCAC" "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "GTGAAACG" "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "GTGGCCTT" "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "GTTTCGGA" "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "CGTACGTA" "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "GAGTGGAT" "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "ACTGATAT" "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "ATTCCTTT" "ATCTCGTATGCCGTCTTCTGCTTG");
-
-    return adaptSeqs;
+    unsigned n = 0;
+    for (; *seqs != '\0'; ++seqs)
+        n += (*seqs != ' ');
+    return n;
 }
 
-inline StringSet<Dna5String>
-truSeqs(HiSeqXAdapters)
+// --------------------------------------------------------------------------
+// Function _adapterBase()
+// --------------------------------------------------------------------------
+
+// Returns the rank of an adapter base in Dna5 (4 for N).
+constexpr unsigned
+_adapterBase(char c)
 {
-    StringSet<Dna5String> adaptSeqs;
-    appendValue(adaptSeqs, "AATGATACGGCGACCACCGAGATCTACAC" "TATAGCCT" "ACACTCTTTCCCTACACGACGCTCTTCCGATCT");
-    appendValue(adaptSeqs, "AATGATACGGCGACCACCGAGATCTACAC" "ATAGAGGC" "ACACTCTTTCCCTACACGACGCTCTTCCGATCT");
-    appendValue(adaptSeqs, "AATGATACGGCGACCACCGAGATCTACAC" "CCTATCCT" "ACACTCTTTCCCTACACGACGCTCTTCCGATCT");
-    appendValue(adaptSeqs, "AATGATACGGCGACCACCGAGATCTACAC" "GGCTCTGA" "ACACTCTTTCCCTACACGACGCTCTTCCGATCT");
-    appendValue(adaptSeqs, "AATGATACGGCGACCACCGAGATCTACAC" "AGGCGAAG" "ACACTCTTTCCCTACACGACGCTCTTCCGATCT");
-    appendValue(adaptSeqs, "AATGATACGGCGACCACCGAGATCTACAC" "TAATCTTA" "ACACTCTTTCCCTACACGACGCTCTTCCGATCT");
-    appendValue(adaptSeqs, "AATGATACGGCGACCACCGAGATCTACAC" "CAGGACGT" "ACACTCTTTCCCTACACGACGCTCTTCCGATCT");
-    appendValue(adaptSeqs, "AATGATACGGCGACCACCGAGATCTACAC" "GTACTGAC" "ACACTCTTTCCCTACACGACGCTCTTCCGATCT");
-
-    appendValue(adaptSeqs, "GATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "ATTACTCG" "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "GATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "TCCGGAGA" "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "GATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "CGCTCATT" "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "GATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "GAGATTCC" "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "GATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "ATTCAGAA" "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "GATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "GAATTCGT" "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "GATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "CTGAAGCT" "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "GATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "TAATGCGC" "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "GATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "CGGCTATG" "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "GATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "TCCGCGAA" "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "GATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "TCTCGCGC" "ATCTCGTATGCCGTCTTCTGCTTG");
-    appendValue(adaptSeqs, "GATCGGAAGAGCACACGTCTGAACTCCAGTCAC" "AGCGATAG" "ATCTCGTATGCCGTCTTCTGCTTG");
-
-    return adaptSeqs;
+    return (c == 'A') ? 0 : (c == 'C') ? 1 : (c == 'G') ? 2 : (c == 'T') ? 3 : 4;
 }
 
-template<typename TAdapterTag>
-inline StringSet<Dna5String>
-reverseTruSeqsOneError(TAdapterTag tag)
-{
-    typedef Dna5String TSeq;
-    typedef Size<TSeq>::Type TSize;
-    typedef Dna TAlphabet;
+// ==========================================================================
+// struct AdapterTable
+// ==========================================================================
 
-    StringSet<TSeq> adaptSeqs = truSeqs(tag);
+// Bit-parallel matcher for the TruSeq and universal adapters of a tag, computed at compile time from
+// AdapterSequences. The adapters are concatenated in one bit vector with one bit per adapter position. A read is
+// scanned backwards from its end; after t characters, bit i of the state is set if the t read characters match the
+// t adapter characters starting at i with at most one mismatch, i.e. if the adapter prefix ending t characters
+// after bit i is still a candidate for the read's suffix. The scan stops as soon as no candidate is left, which
+// for reads without adapter happens after a few characters.
 
-    // Append all sequences with one mismatch to sequence set.
-    TSize len = length(adaptSeqs);
-    for (TSize s = 0; s < len; ++s)
+template<typename TTag>
+struct AdapterTable
+{
+    typedef unsigned long long TWord;
+    typedef AdapterSequences<TTag> TSequences;
+
+    static constexpr unsigned NUM_TRUSEQS = _numAdapters(TSequences::truSeqs());
+    static constexpr unsigned NUM_ADAPTERS = NUM_TRUSEQS + 1;
+    static constexpr unsigned NUM_BITS = _numBases(TSequences::truSeqs()) + _numBases(TSequences::universal());
+    static constexpr unsigned NUM_WORDS = (NUM_BITS + 63) / 64;
+
+    TWord masks[4][NUM_WORDS];              // bits of adapter positions with nucleotide A, C, G, T
+    TWord positions[NUM_WORDS];             // bits of all adapter positions
+    TWord starts[2][NUM_WORDS];             // first bits of the TruSeq adapters and of the universal adapter
+    char const * adapters[NUM_ADAPTERS];    // TruSeq adapters followed by the universal adapter
+    unsigned lengths[NUM_ADAPTERS];
+    unsigned maxLength;                     // length of the longest adapter
+
+    constexpr AdapterTable() :
+        masks(), positions(), starts(), adapters(), lengths(), maxLength(0)
     {
-        reverse(adaptSeqs[s]);
-        TSeq errSeq = adaptSeqs[s];
-        for (TSize i = 0; i < length(adaptSeqs[s]); ++i)
+        unsigned bit = 0;
+        unsigned a = 0;
+        char const * seqs = TSequences::truSeqs();
+        for (char const * c = seqs; ; ++c)
         {
-            for (TSize c = 0; c < ValueSize<TAlphabet>::VALUE; ++c)
+            if (*c == ' ' || *c == '\0')
             {
-                errSeq[i] = c;
-                appendValue(adaptSeqs, errSeq);
+                appendAdapter(a, bit, seqs, c - seqs, ADAPTER_TRUSEQ);
+                if (*c == '\0')
+                    break;
+                seqs = c + 1;
             }
-            errSeq[i] = adaptSeqs[s][i];
         }
+        char const * universal = TSequences::universal();
+        appendAdapter(a, bit, universal, _numBases(universal), ADAPTER_UNIVERSAL);
     }
 
-    return adaptSeqs;
+    constexpr void
+    appendAdapter(unsigned & a, unsigned & bit, char const * seq, unsigned len, AdapterGroup group)
+    {
+        adapters[a] = seq;
+        lengths[a] = len;
+        starts[group][bit / 64] |= TWord(1) << (bit % 64);
+        for (unsigned i = 0; i < len; ++i, ++bit)
+        {
+            positions[bit / 64] |= TWord(1) << (bit % 64);
+            if (_adapterBase(seq[i]) < 4)
+                masks[_adapterBase(seq[i])][bit / 64] |= TWord(1) << (bit % 64);
+        }
+        maxLength = (len > maxLength) ? len : maxLength;
+        ++a;
+    }
+};
+
+// --------------------------------------------------------------------------
+// Function _containsWithOneError()
+// --------------------------------------------------------------------------
+
+// Returns true if seq occurs in the adapter with at most one mismatch.
+template<typename TSequence>
+inline bool
+_containsWithOneError(char const * adapter, unsigned adapterLen, TSequence const & seq)
+{
+    unsigned n = length(seq);
+    for (unsigned pos = 0; pos + n <= adapterLen; ++pos)
+    {
+        unsigned errors = 0;
+        for (unsigned i = 0; i < n && errors < 2; ++i)
+            if (ordValue(Dna5(seq[i])) != _adapterBase(adapter[pos + i]) || ordValue(Dna5(seq[i])) > 3)
+                ++errors;
+        if (errors < 2)
+            return true;
+    }
+    return false;
 }
 
-// Returns the length of the matching prefix.
-template<typename TIndexSeq, typename TSpec, typename TSequence>
-inline typename Size<TSequence>::Type
-prefixMatchLength(Index<TIndexSeq, TSpec> & suffixIndex, TSequence const & seq)
+// ==========================================================================
+// Function matchAdapters()
+// ==========================================================================
+
+// Computes for both adapter groups the length of the longest suffix of seq that matches an adapter prefix with at
+// most one mismatch. Sets full[g] if all of seq occurs in an adapter of group g with at most one mismatch.
+// The sequence has to be in the orientation in which it was sequenced. Ns in seq are mismatches.
+template<typename TSequence, typename TTag>
+inline void
+matchAdapters(unsigned (& adaptLen)[2], bool (& full)[2], TSequence const & seq, TTag)
 {
-    typedef typename Size<TSequence>::Type TSize;
-    typedef Index<TIndexSeq, TSpec> TIndex;
+    typedef AdapterTable<TTag> TTable;
+    typedef typename TTable::TWord TWord;
 
+    static constexpr TTable table = TTable();
 
-    typename Iterator<TIndex, TopDown<> >::Type it(suffixIndex);
+    adaptLen[0] = adaptLen[1] = 0;
+    full[0] = full[1] = false;
 
-    TSize len = 0;   // length of matching prefix
+    // Every adapter position is a candidate before the first character.
+    TWord exact[TTable::NUM_WORDS];
+    TWord oneError[TTable::NUM_WORDS];
+    for (unsigned w = 0; w < TTable::NUM_WORDS; ++w)
+        exact[w] = oneError[w] = table.positions[w];
 
-    while (goDown(it, seq[repLength(it)]))
+    unsigned seqLen = length(seq);
+    for (unsigned t = 0; t < seqLen; ++t)
     {
-        // if end of seq reached
-        if (repLength(it) >= length(seq))
+        unsigned c = ordValue(Dna5(seq[seqLen - 1 - t]));
+
+        TWord completed[2] = {0, 0};
+        TWord alive = 0;
+        for (unsigned w = 0; w < TTable::NUM_WORDS; ++w)
         {
-            // if all of seq matches the beginning of some suffix
-            if (infix(representative(it), parentRepLength(it) + 1, length(seq)) ==
-                    infix(seq, parentRepLength(it) + 1, length(seq)))
-            {
-                len = length(seq);
-            }
-            break;
+            TWord mask = (c < 4) ? table.masks[c][w] : 0;
+            oneError[w] = (oneError[w] & mask) | exact[w];
+            exact[w] &= mask;
+
+            // Candidates at the first adapter position match a whole adapter prefix.
+            completed[ADAPTER_TRUSEQ] |= oneError[w] & table.starts[ADAPTER_TRUSEQ][w];
+            completed[ADAPTER_UNIVERSAL] |= oneError[w] & table.starts[ADAPTER_UNIVERSAL][w];
+            alive |= oneError[w];
         }
+        for (unsigned g = 0; g < 2; ++g)
+            if (completed[g] != 0)
+                adaptLen[g] = t + 1;
 
-        // if mismatch in remaining characters along this branch
-        if (infix(representative(it), parentRepLength(it) + 1, repLength(it)) !=
-                infix(seq, parentRepLength(it) + 1, repLength(it)))
+        // Move the candidates one position towards the adapter starts. Bits at the adapter starts are done.
+        TWord carryExact = 0, carryOneError = 0;
+        for (unsigned w = TTable::NUM_WORDS; w-- > 0; )
         {
-            break;
+            TWord done = ~(table.starts[ADAPTER_TRUSEQ][w] | table.starts[ADAPTER_UNIVERSAL][w]);
+            TWord e = exact[w] & done;
+            TWord o = oneError[w] & done;
+            exact[w] = (e >> 1) | carryExact;
+            oneError[w] = (o >> 1) | carryOneError;
+            carryExact = e << 63;
+            carryOneError = o << 63;
         }
 
-        // if current prefix is a complete suffix
-        if (isRightTerminal(it))
+        if (alive == 0)
+            break;
+    }
+
+    if (seqLen <= table.maxLength)
+    {
+        for (unsigned a = 0; a < TTable::NUM_ADAPTERS; ++a)
         {
-            len = repLength(it);
+            unsigned g = (a < TTable::NUM_TRUSEQS) ? ADAPTER_TRUSEQ : ADAPTER_UNIVERSAL;
+            if (!full[g] && seqLen <= table.lengths[a])
+                full[g] = _containsWithOneError(table.adapters[a], table.lengths[a], seq);
         }
     }
-
-    return len;
 }
 
 template<typename TSize>
@@ -335,146 +442,91 @@ cigarSuffix(String<CigarElement<> > const & cigar, TSize len)
     return suffixCigar;
 }
 
-template<typename TSequence, typename TTag>
-int
-removeAdapter(BamAlignmentRecord & record,
-        Index<StringSet<TSequence> > & indexUniversal,
-        Index<StringSet<TSequence> > & indexTruSeqs,
-        unsigned minAdapterLength,
-        TTag tag)
+// --------------------------------------------------------------------------
+// Function _trimAdapter()
+// --------------------------------------------------------------------------
+
+// Removes an adapter of the given length from the end of the read as it was sequenced.
+// Returns 2 if the read consists of adapter only, 1 if the adapter was removed, and 0 if it is too short.
+inline int
+_trimAdapter(BamAlignmentRecord & record, unsigned adaptLen, bool full, unsigned minAdapterLength)
 {
-    typedef typename Size<TSequence>::Type TSize;
-    typedef ModifiedString<const TSequence, ModReverse> TRevSequence;
-    //  typedef ModifiedString<const TSequence, ModComplementDna5> TComplSequence;
-    //  typedef ModifiedString<const TComplSequence, ModReverse> TRevComplSequence; // TODO: This modifier seems to be buggy!
+    unsigned seqLen = length(record.seq);
 
-    TSize seqLen = length(record.seq);
+    if (full)
+    {
+        // Read starts with adapter.
+        //std::cerr << "Removing full read        " << record.seq << std::endl;
+        return 2;
+    }
+    if (adaptLen < minAdapterLength)
+        return 0;
 
     if (hasFlagRC(record))
     {
-        TSequence complSeq = record.seq;
-        reverseComplement(complSeq);
-
-        // Check for adapter at begin of read.
-        if (hasFlagFirst(record))
-        {
-            // Compute alignment score to TruSeq (excluding barcode)
-            if (startsWithTruSeq(complSeq, tag) == 0)
-                return 2;
-        }
-        else
-        {
-            // Compute alignment score to reverse complement of Universal
-            TSequence universal = getUniversal(tag);
-            unsigned seqLen = _min(length(universal), length(complSeq));
-            int score = globalAlignmentScore(prefix(universal, seqLen), prefix(complSeq, seqLen), Score<int>(1,0,0), -2, 2);
-            if (score > (int)length(universal) - 5)
-                return 2;
-        }
+        //std::cerr << "Removing first " << adaptLen << " bases from " << record.seq << std::endl;
+        replace(record.seq, 0, adaptLen, "");
+        replace(record.qual, 0, adaptLen, "");
+        record.cigar = cigarSuffix(record.cigar, adaptLen);
+    }
+    else
+    {
+        //std::cerr << "Removing last " << adaptLen << " bases from  " << record.seq << std::endl;
+        replace(record.seq, seqLen-adaptLen, seqLen, "");
+        replace(record.qual, seqLen-adaptLen, seqLen, "");
+        record.cigar = cigarPrefix(record.cigar, adaptLen);
+    }
+    return 1;
+}
 
-        // Search prefix of complemented read in *TruSeq* index.
-        reverse(complSeq);
-        //TComplSequence complSeq(record.seq);
-        TSize adaptLen = prefixMatchLength(indexTruSeqs, complSeq);
+// ==========================================================================
+// Function removeAdapter()
+// ==========================================================================
 
-        if (adaptLen == seqLen)
-        {
-            // Read starts with adapter.
-            //std::cerr << "Removing full read        " << record.seq << std::endl;
-            return 2;
-        }
-        else if (adaptLen >= minAdapterLength)
-        {
-            //std::cerr << "Removing first " << adaptLen << " bases from " << record.seq << std::endl;
-            replace(record.seq, 0, adaptLen, "");
-            replace(record.qual, 0, adaptLen, "");
-            record.cigar = cigarSuffix(record.cigar, adaptLen);
-            return 1;
-        }
+// Returns 2 if the read should be dropped, 1 if an adapter was removed, and 0 otherwise.
+template<typename TTag>
+int
+removeAdapter(BamAlignmentRecord & record,
+        unsigned minAdapterLength,
+        TTag tag)
+{
+    typedef Dna5String TSequence;
 
-        // Search prefix of complemented read in *Universal* index.
-        adaptLen = prefixMatchLength(indexUniversal, complSeq);
+    // The read as it was sequenced.
+    TSequence seq = record.seq;
+    if (hasFlagRC(record))
+        reverseComplement(seq);
 
-        if (adaptLen == seqLen)
-        {
-            // Read starts with adapter.
-            //std::cerr << "Removing full read        " << record.seq << std::endl;
+    // Check for adapter at begin of read.
+    if (hasFlagFirst(record))
+    {
+        // Compute alignment score to TruSeq (excluding barcode)
+        if (startsWithTruSeq(seq, tag) == 0)
             return 2;
-        }
-        else if (adaptLen >= minAdapterLength)
-        {
-            //std::cerr << "Removing first " << adaptLen << " bases from " << record.seq << std::endl;
-            replace(record.seq, 0, adaptLen, "");
-            replace(record.qual, 0, adaptLen, "");
-            record.cigar = cigarSuffix(record.cigar, adaptLen);
-            return 1;
-        }
     }
     else
     {
-        // Check for adapter at begin of read.
-        if (hasFlagFirst(record))
-        {
-            // Compute alignemnt score to TruSeq (excluding barcode)
-            if (startsWithTruSeq(record.seq, tag) == 0)
-                return 2;
-        }
-        else
-        {
-            // Compute alignment score to reverse complement of Universal
-            TSequence universal = getUniversal(tag);
-            unsigned seqLen = _min(length(universal), length(record.seq));
-            int score = globalAlignmentScore(prefix(universal, seqLen), prefix(record.seq, seqLen), Score<int>(1,0,0), -2, 2);
-            if (score > (int)seqLen - 5)
-                return 2;
-        }
-
-        // Search prefix of reversed read in *TruSeq* index.
-        TRevSequence revSeq(record.seq);
-        TSize adaptLen = prefixMatchLength(indexTruSeqs, revSeq);
-
-        if (adaptLen == seqLen)
-        {
-            // Read starts with adapter.
-            //std::cerr << "Removing full read        " << record.seq << std::endl;
-            return 2;
-        }
-        else if (adaptLen >= minAdapterLength)
-        {
-            //std::cerr << "Removing last " << adaptLen << " bases from  " << record.seq << std::endl;
-            replace(record.seq, seqLen-adaptLen, seqLen, "");
-            replace(record.qual, seqLen-adaptLen, seqLen, "");
-            record.cigar = cigarPrefix(record.cigar, adaptLen);
-            return 1;
-        }
-
-        // Search prefix of read in *Universal* index.
-        adaptLen = prefixMatchLength(indexUniversal, revSeq);
-
-        if (adaptLen == seqLen)
-        {
-            // Read starts with adapter.
-            //std::cerr << "Removing full read        " << record.seq << std::endl;
+        // Compute alignment score to reverse complement of Universal
+        static const TSequence universal = getUniversal(tag);
+        unsigned prefixLen = _min(length(universal), length(seq));
+        int score = globalAlignmentScore(prefix(universal, prefixLen), prefix(seq, prefixLen), Score<int>(1,0,0), -2, 2);
+        if (score > (hasFlagRC(record) ? (int)length(universal) : (int)prefixLen) - 5)
             return 2;
-        }
-        else if (adaptLen >= minAdapterLength)
-        {
-            //std::cerr << "Removing last " << adaptLen << " bases from  " << record.seq << std::endl;
-            replace(record.seq, seqLen-adaptLen, seqLen, "");
-            replace(record.qual, seqLen-adaptLen, seqLen, "");
-            record.cigar = cigarPrefix(record.cigar, adaptLen);
-            return 1;
-        }
     }
 
-    return 0;
+    // Search the end of the read for *TruSeq* and *Universal* adapters in one scan.
+    unsigned adaptLen[2];
+    bool full[2];
+    matchAdapters(adaptLen, full, seq, tag);
+
+    int res = _trimAdapter(record, adaptLen[ADAPTER_TRUSEQ], full[ADAPTER_TRUSEQ], minAdapterLength);
+    if (res != 0)
+        return res;
+    return _trimAdapter(record, adaptLen[ADAPTER_UNIVERSAL], full[ADAPTER_UNIVERSAL], minAdapterLength);
 }
 
-template<typename TSequence>
-int
+inline int
 removeAdapter(BamAlignmentRecord &,
-        Index<StringSet<TSequence> > &,
-        Index<StringSet<TSequence> > &,
         unsigned,
         NoAdapters)
 {
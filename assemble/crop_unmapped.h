@@ -1,14 +1,36 @@
 #ifndef NOVINS_CROP_UNMAPPED_H_
 #define NOVINS_CROP_UNMAPPED_H_
 
+#include <cstdio>
+#include <unistd.h>
+#include <ext/stdio_filebuf.h>
+#include <fstream>
+#include <functional>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
 #include <seqan/seq_io.h>
 #include <seqan/bam_io.h>
 
+#include "../popins_utils.h"
+#include "../bam_sort.h"
 #include "adapter_removal.h"
+#include "read_pairing.h"
 
 
 using namespace seqan;
 
+// Maximum number of high-quality records buffered in case their mate turns out to have a low mapping quality.
+#ifndef CROP_MAX_BUFFERED_MATES
+#define CROP_MAX_BUFFERED_MATES 2000000
+#endif
+
 
 // --------------------------------------------------------------------------
 // Function hasLowMappingQuality()
@@ -163,113 +185,113 @@ setMateUnmapped(BamAlignmentRecord & record)
 }
 
 // --------------------------------------------------------------------------
-// Function appendFastqRecord()
+// Function complementIupac()
 // --------------------------------------------------------------------------
 
-// Append a read to map of fastq records.
-bool
-appendFastqRecord(SeqFileOut & firstStream,
-        SeqFileOut & secondStream,
-        std::map<CharString, Pair<CharString> > & firstReads,
-        std::map<CharString, Pair<CharString> > & secondReads,
-        BamAlignmentRecord const & record)
+inline char
+complementIupac(char c)
 {
-    CharString seq = record.seq;
-    CharString qual = record.qual;
-
-    if (hasFlagRC(record))
-    {
-        reverseComplement(seq);
-        reverse(qual);
-    }
-
-    if (hasFlagFirst(record))
-    {
-        if (secondReads.count(record.qName) != 0)
-        {
-            Pair<CharString> second = secondReads[record.qName];
-            writeRecord(firstStream, record.qName, record.seq, record.qual);
-            writeRecord(secondStream, record.qName, second.i1, second.i2);
-            secondReads.erase(record.qName);
-            return 1;
-        }
-        else
-        {
-            firstReads[record.qName] = Pair<CharString>(seq, qual);
-            return 0;
-        }
-    }
-    else // hasFlagLast(record)
+    switch (c)
     {
-        if (firstReads.count(record.qName) != 0)
-        {
-            Pair<CharString> first = firstReads[record.qName];
-            writeRecord(firstStream, record.qName, first.i1, first.i2);
-            writeRecord(secondStream, record.qName, record.seq, record.qual);
-            firstReads.erase(record.qName);
-            return 1;
-        }
-        else
-        {
-            secondReads[record.qName] = Pair<CharString>(seq, qual);
-            return 0;
-        }
+        case 'A': return 'T';
+        case 'C': return 'G';
+        case 'G': return 'C';
+        case 'T': return 'A';
+        case 'R': return 'Y';
+        case 'Y': return 'R';
+        case 'K': return 'M';
+        case 'M': return 'K';
+        case 'B': return 'V';
+        case 'V': return 'B';
+        case 'D': return 'H';
+        case 'H': return 'D';
+        default: return c;      // N, S, W, =
     }
 }
 
 // --------------------------------------------------------------------------
-// Function writeFastq()
+// Function appendFastqRecord()
 // --------------------------------------------------------------------------
 
+// Append a read to the reads waiting for their other read end, or write both read ends if the other one
+// is waiting, also quality trimmed to trimmedOut if given. Returns 1 if the read was paired, 0 if it is waiting,
+// and -1 on error.
 int
-writeFastq(SeqFileOut & fastqFirst,
-        SeqFileOut & fastqSecond,
-        SeqFileOut & fastqSingle,
-        std::map<CharString, Pair<CharString> > const & firstReads,
-        std::map<CharString, Pair<CharString> > const & secondReads)
+appendFastqRecord(SeqFileOut & firstStream,
+        SeqFileOut & secondStream,
+        ReadPairer & pairer,
+        BamAlignmentRecord const & record,
+        TrimmedFastqOut<SeqFileOut> * trimmedOut = NULL)
 {
-    typedef std::map<CharString, Pair<CharString> > TFastqMap;
-
-    // Initialize iterators over reads in fastq maps.
-    TFastqMap::const_iterator firstIt = firstReads.begin();
-    TFastqMap::const_iterator firstEnd = firstReads.end();
-    TFastqMap::const_iterator secondIt = secondReads.begin();
-    TFastqMap::const_iterator secondEnd = secondReads.end();
+    typedef Size<CharString>::Type TSize;
 
-    // Iterate over reads and output to fastq files (paired.1 and paired.2, or single).
-    while (firstIt != firstEnd && secondIt != secondEnd)
+    // Build the line of the read in the pairer's buffer, reverse complemented if aligned to the reverse strand.
+    std::string & line = pairer.line;
+    line.assign(begin(record.qName, Standard()), end(record.qName, Standard()));
+    line += hasFlagFirst(record) ? "\t1\t" : "\t2\t";
+    if (hasFlagRC(record))
     {
-        if (firstIt->first < secondIt->first)
-        {
-            writeRecord(fastqSingle, firstIt->first, firstIt->second.i1, firstIt->second.i2);
-            ++firstIt;
-        }
-        else if (firstIt->first == secondIt->first)
-        {
-            writeRecord(fastqFirst, firstIt->first, firstIt->second.i1, firstIt->second.i2);
-            writeRecord(fastqSecond, secondIt->first, secondIt->second.i1, secondIt->second.i2);
-            ++firstIt; ++secondIt;
-        }
-        else // firstIt->first > secondIt->first
-        {
-            writeRecord(fastqSingle, secondIt->first, secondIt->second.i1, secondIt->second.i2);
-            ++secondIt;
-        }
+        for (TSize i = length(record.seq); i > 0; --i)
+            line += complementIupac((char)record.seq[i - 1]);
+        line += '\t';
+        for (TSize i = length(record.qual); i > 0; --i)
+            line += record.qual[i - 1];
+    }
+    else
+    {
+        for (TSize i = 0; i < length(record.seq); ++i)
+            line += (char)record.seq[i];
+        line += '\t';
+        line.append(begin(record.qual, Standard()), end(record.qual, Standard()));
     }
+    line += '\n';
 
-    // Iterate over remaining reads and output to single.fastq.
-    while (firstIt != firstEnd)
+    char const * mateLine = NULL;
+    int res = addRead(mateLine, pairer, line);
+    if (res != 1)
+        return res;
+
+    bool isFirst, mateFirst;
+    _readLine(pairer.name, isFirst, pairer.seq, pairer.qual, line.c_str());
+    _readLine(pairer.name, mateFirst, pairer.mateSeq, pairer.mateQual, mateLine);
+    if (isFirst)
     {
-        writeRecord(fastqSingle, firstIt->first, firstIt->second.i1, firstIt->second.i2);
-        ++firstIt;
+        writeRecord(firstStream, pairer.name, pairer.seq, pairer.qual);
+        writeRecord(secondStream, pairer.name, pairer.mateSeq, pairer.mateQual);
+        if (trimmedOut != NULL)
+            writeTrimmedPair(*trimmedOut, pairer.name, pairer.seq, pairer.qual, pairer.mateSeq, pairer.mateQual);
     }
-    while (secondIt != secondEnd)
+    else
     {
-        writeRecord(fastqSingle, secondIt->first, secondIt->second.i1, secondIt->second.i2);
-        ++secondIt;
+        writeRecord(firstStream, pairer.name, pairer.mateSeq, pairer.mateQual);
+        writeRecord(secondStream, pairer.name, pairer.seq, pairer.qual);
+        if (trimmedOut != NULL)
+            writeTrimmedPair(*trimmedOut, pairer.name, pairer.mateSeq, pairer.mateQual, pairer.seq, pairer.qual);
     }
+    return 1;
+}
 
-    return 0;
+// ==========================================================================
+// struct MatesOut
+// ==========================================================================
+
+// The mates bam file, which is sorted by read name while cropping. It is shared by all cropping threads.
+
+struct MatesOut
+{
+    BamSorter sorter;
+    std::mutex mutex;
+};
+
+// --------------------------------------------------------------------------
+// Function writeMate()
+// --------------------------------------------------------------------------
+
+inline bool
+writeMate(MatesOut & matesOut, BamAlignmentRecord const & record)
+{
+    std::lock_guard<std::mutex> lock(matesOut.mutex);
+    return appendRecord(matesOut.sorter, record);
 }
 
 // --------------------------------------------------------------------------
@@ -278,7 +300,7 @@ writeFastq(SeqFileOut & fastqFirst,
 
 template<typename TPos>
 int
-findOtherReads(BamFileOut & matesStream,
+findOtherReads(MatesOut & matesOut,
         std::map<Pair<TPos>, Pair<CharString, bool> > & otherReads,
         CharString const & mappingBam)
 {
@@ -336,7 +358,8 @@ findOtherReads(BamFileOut & matesStream,
             if (otherReads.count(Pair<TPos>(record.rNextId, record.pNext)) == 0)
             {
                 setMateUnmapped(record);
-                writeRecord(matesStream, record);
+                if (writeMate(matesOut, record) != 0)
+                    return -1;
             }
             ++numFound;
         }
@@ -345,10 +368,493 @@ findOtherReads(BamFileOut & matesStream,
     return numFound;
 }
 
+// ==========================================================================
+// struct MateBuffer
+// ==========================================================================
+
+// Mates of low-quality mapping reads are collected during the single pass over the coordinate-sorted input:
+//   wanted      names of mates that are still ahead in the input, keyed by the mate's position
+//   candidates  high-quality records whose discordant mate is still ahead, keyed by the mate's position
+// Both are dropped as soon as the input has passed their key. Mates that cannot be resolved from the buffers
+// (the candidate buffer was full or the mate was filtered from it) are written to a spill file and retrieved
+// through the BAM index after the pass.
+
+struct MateBuffer
+{
+    typedef std::unordered_map<__uint64, std::vector<CharString> > TWanted;
+    typedef std::unordered_map<__uint64, std::vector<BamAlignmentRecord> > TCandidates;
+    typedef std::priority_queue<__uint64, std::vector<__uint64>, std::greater<__uint64> > TExpiry;
+
+    TWanted wanted;
+    TCandidates candidates;
+    TExpiry wantedExpiry;
+    TExpiry candidatesExpiry;
+
+    size_t numCandidates;
+    size_t maxCandidates;
+    bool sameReference;         // only mates on the same reference sequence can be found in the buffers
+
+    CharString spillFile;
+    std::fstream spillStream;
+    size_t numSpilled;
+    size_t numFound;
+
+    MateBuffer(CharString const & matesBam, size_t maxBuffered, bool sameRef) :
+        numCandidates(0), maxCandidates(maxBuffered), sameReference(sameRef), spillFile(matesBam),
+        numSpilled(0), numFound(0)
+    {
+        spillFile += ".spill";
+    }
+};
+
+// --------------------------------------------------------------------------
+// Function positionKey()
+// --------------------------------------------------------------------------
+
+// Orders positions like a coordinate-sorted BAM file, including the unplaced reads (rID -1) at the end.
+inline __uint64
+positionKey(__int32 rID, __int32 pos)
+{
+    return ((__uint64)(__uint32)rID << 32) | (__uint32)pos;
+}
+
+// --------------------------------------------------------------------------
+// Function spillMate()
+// --------------------------------------------------------------------------
+
+inline bool
+spillMate(MateBuffer & buffer, __uint64 key, CharString const & qName)
+{
+    if (!buffer.spillStream.is_open())
+    {
+        buffer.spillStream.open(toCString(buffer.spillFile), std::ios::out);
+        if (!buffer.spillStream.is_open())
+        {
+            std::cerr << "ERROR: Could not open spill file " << buffer.spillFile << " for writing." << std::endl;
+            return 1;
+        }
+    }
+    buffer.spillStream << (__int32)(key >> 32) << "\t" << (__int32)(key & 0xffffffff) << "\t" << qName << "\n";
+    ++buffer.numSpilled;
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+// Function expireMates()
+// --------------------------------------------------------------------------
+
+// Spills the wanted mates and drops the candidates for all positions before key.
+inline bool
+expireMates(MateBuffer & buffer, __uint64 key)
+{
+    while (!buffer.wantedExpiry.empty() && buffer.wantedExpiry.top() < key)
+    {
+        MateBuffer::TWanted::iterator it = buffer.wanted.find(buffer.wantedExpiry.top());
+        buffer.wantedExpiry.pop();
+        if (it == buffer.wanted.end())
+            continue;
+        for (unsigned i = 0; i < it->second.size(); ++i)
+            if (spillMate(buffer, it->first, it->second[i]) != 0)
+                return 1;
+        buffer.wanted.erase(it);
+    }
+
+    while (!buffer.candidatesExpiry.empty() && buffer.candidatesExpiry.top() < key)
+    {
+        MateBuffer::TCandidates::iterator it = buffer.candidates.find(buffer.candidatesExpiry.top());
+        buffer.candidatesExpiry.pop();
+        if (it == buffer.candidates.end())
+            continue;
+        buffer.numCandidates -= it->second.size();
+        buffer.candidates.erase(it);
+    }
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+// Function takeWantedMate()
+// --------------------------------------------------------------------------
+
+// Returns true and removes the entry if the record is the mate of a low-quality mapping read seen before.
+inline bool
+takeWantedMate(MateBuffer & buffer, BamAlignmentRecord const & record)
+{
+    MateBuffer::TWanted::iterator it = buffer.wanted.find(positionKey(record.rID, record.beginPos));
+    if (it == buffer.wanted.end())
+        return false;
+
+    std::vector<CharString> & names = it->second;
+    for (unsigned i = 0; i < names.size(); ++i)
+    {
+        if (names[i] != record.qName)
+            continue;
+        names[i] = names.back();
+        names.pop_back();
+        if (names.empty())
+            buffer.wanted.erase(it);
+        return true;
+    }
+    return false;
+}
+
+// --------------------------------------------------------------------------
+// Function addMateCandidate()
+// --------------------------------------------------------------------------
+
+// Keeps a high-quality record if its mate may still turn out to be a low-quality mapping read, i.e. if the
+// mate is ahead in the input and the pair is not mapped concordantly (see hasLowMappingQuality()).
+inline void
+addMateCandidate(MateBuffer & buffer, BamAlignmentRecord const & record, int humanSeqs)
+{
+    if (hasFlagNextUnmapped(record) || record.rNextId > humanSeqs)
+        return;
+    if (buffer.sameReference && record.rNextId != record.rID)
+        return;
+    if (record.rID == record.rNextId && abs(record.beginPos - record.pNext) < 1000 &&
+            hasFlagRC(record) != hasFlagNextRC(record))
+        return;
+
+    __uint64 mateKey = positionKey(record.rNextId, record.pNext);
+    if (mateKey < positionKey(record.rID, record.beginPos) || buffer.numCandidates >= buffer.maxCandidates)
+        return;
+
+    std::vector<BamAlignmentRecord> & records = buffer.candidates[mateKey];
+    if (records.empty())
+        buffer.candidatesExpiry.push(mateKey);
+    records.push_back(record);
+    ++buffer.numCandidates;
+}
+
+// --------------------------------------------------------------------------
+// Function requestMate()
+// --------------------------------------------------------------------------
+
+// Outputs the mate of a low-quality mapping read if it was buffered as a candidate, or remembers it as wanted
+// if it is still ahead in the input. Spills it otherwise.
+inline bool
+requestMate(MatesOut & matesOut, MateBuffer & buffer, BamAlignmentRecord const & record)
+{
+    __uint64 ownKey = positionKey(record.rID, record.beginPos);
+    __uint64 mateKey = positionKey(record.rNextId, record.pNext);
+
+    if (mateKey <= ownKey)
+    {
+        MateBuffer::TCandidates::iterator it = buffer.candidates.find(ownKey);
+        if (it != buffer.candidates.end())
+        {
+            std::vector<BamAlignmentRecord> & records = it->second;
+            for (unsigned i = 0; i < records.size(); ++i)
+            {
+                if (records[i].qName != record.qName || records[i].pNext != record.beginPos)
+                    continue;
+                setMateUnmapped(records[i]);
+                if (writeMate(matesOut, records[i]) != 0)
+                    return 1;
+                ++buffer.numFound;
+                records[i] = records.back();
+                records.pop_back();
+                --buffer.numCandidates;
+                if (records.empty())
+                    buffer.candidates.erase(it);
+                return 0;
+            }
+        }
+        if (mateKey < ownKey)
+            return spillMate(buffer, mateKey, record.qName);
+    }
+
+    std::vector<CharString> & names = buffer.wanted[mateKey];
+    if (names.empty())
+        buffer.wantedExpiry.push(mateKey);
+    names.push_back(record.qName);
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+// Function readSpilledMates()
+// --------------------------------------------------------------------------
+
+template<typename TPos>
+bool
+readSpilledMates(std::map<Pair<TPos>, Pair<CharString, bool> > & otherReads, MateBuffer & buffer)
+{
+    buffer.spillStream.close();
+
+    std::fstream stream(toCString(buffer.spillFile), std::ios::in);
+    if (!stream.is_open())
+    {
+        std::cerr << "ERROR: Could not open spill file " << buffer.spillFile << std::endl;
+        return 1;
+    }
+
+    TPos rID, pos;
+    std::string qName;
+    while (stream >> rID >> pos >> qName)
+        otherReads[Pair<TPos>(rID, pos)] = Pair<CharString, bool>(qName, false);
+
+    stream.close();
+    remove(toCString(buffer.spillFile));
+    return 0;
+}
+
+// ==========================================================================
+// struct SharedFastqOut
+// ==========================================================================
+
+// Interleaved fastq output of the read pairs written to a file descriptor, e.g. a pipe read by bwa mem -p. It is
+// shared by all cropping threads, which write a read pair at a time.
+
+struct SharedFastqOut
+{
+    __gnu_cxx::stdio_filebuf<char> buffer;
+    std::ostream ostream;
+    SeqFileOut stream;
+    std::mutex mutex;
+
+    SharedFastqOut(int fd) :
+        buffer(fd, std::ios::out), ostream(&buffer)
+    {
+        open(stream, ostream, Fastq());
+    }
+};
+
+// --------------------------------------------------------------------------
+// Function close()
+// --------------------------------------------------------------------------
+
+// Flushes the output and closes the file descriptor, which signals the end of the reads to the reader.
+inline void
+close(SharedFastqOut & out)
+{
+    close(out.stream);
+    out.ostream.flush();
+    out.buffer.close();
+}
+
+// ==========================================================================
+// struct CropOutput
+// ==========================================================================
+
+// Output of one cropping thread: the paired fastq files, optionally the quality trimmed fastq files, the reads
+// still waiting for their other read end, the shared mates bam file and the buffer for the mates of low-quality
+// mapping reads.
+
+struct CropOutput
+{
+    SeqFileOut fastqFirstStream;
+    SeqFileOut fastqSecondStream;
+    SharedFastqOut * pairedOut;     // replaces the paired fastq files if set
+    std::unique_ptr<TrimmedFastqOut<SeqFileOut> > trimmedOut;
+    ReadPairer pairer;
+
+    MatesOut * matesOut;
+    MateBuffer mateBuffer;
+
+    unsigned long alignedBaseCount;
+
+    // The mates bam file name is only used to name the spill file of the mate buffer.
+    CropOutput(Triple<CharString> const & fastqFiles,
+               CharString const & matesBam,
+               MatesOut & sharedMatesOut,
+               size_t memoryBudget,
+               bool sameRef,
+               SharedFastqOut * sharedOut = NULL,
+               Triple<CharString> const * trimmedFiles = NULL) :
+        pairedOut(sharedOut),
+        pairer(fastqFiles.i1, memoryBudget),
+        matesOut(&sharedMatesOut),
+        mateBuffer(matesBam, CROP_MAX_BUFFERED_MATES, sameRef),
+        alignedBaseCount(0)
+    {
+        if (pairedOut == NULL)
+        {
+            open(fastqFirstStream, toCString(fastqFiles.i1));
+            open(fastqSecondStream, toCString(fastqFiles.i2));
+        }
+        if (trimmedFiles != NULL)
+            trimmedOut.reset(new TrimmedFastqOut<SeqFileOut>(*trimmedFiles));
+    }
+};
+
+// --------------------------------------------------------------------------
+// Function appendFastqRecord()
+// --------------------------------------------------------------------------
+
+inline int
+appendFastqRecord(CropOutput & out, BamAlignmentRecord const & record)
+{
+    if (out.pairedOut == NULL)
+        return appendFastqRecord(out.fastqFirstStream, out.fastqSecondStream, out.pairer, record, out.trimmedOut.get());
+
+    std::lock_guard<std::mutex> lock(out.pairedOut->mutex);
+    return appendFastqRecord(out.pairedOut->stream, out.pairedOut->stream, out.pairer, record, out.trimmedOut.get());
+}
+
+// --------------------------------------------------------------------------
+// Function threadFile()
+// --------------------------------------------------------------------------
+
+// Inserts the thread number before the file extension, e.g. paired.1.fastq -> paired.1.t3.fastq, so that the
+// file format is still recognized by its extension.
+inline CharString
+threadFile(CharString const & filename, unsigned t)
+{
+    std::string name = toCString(filename);
+    size_t dot = name.rfind('.');
+    std::ostringstream threadName;
+    threadName << name.substr(0, dot) << ".t" << t << (dot == std::string::npos ? "" : name.substr(dot));
+    return threadName.str();
+}
+
+// --------------------------------------------------------------------------
+// Function cropRecord()
+// --------------------------------------------------------------------------
+
+// Sorts a record of the input bam file into the fastq files, the mates bam file or the mate buffer.
+template<typename TAdapterTag>
+inline bool
+cropRecord(CropOutput & out,
+        BamAlignmentRecord & record,
+        BamAlignmentRecord & mate,
+        int humanSeqs,
+        TAdapterTag tag)
+{
+    // Check for flags that indicate 'uninteresting' bam records.
+    if (hasFlagDuplicate(record) or hasFlagSecondary(record) or
+            hasFlagQCNoPass(record) or hasFlagSupplementary(record)) return 0;
+
+    // Release buffered mates the input has passed and check whether this record is a wanted mate.
+    if (expireMates(out.mateBuffer, positionKey(record.rID, record.beginPos)) != 0)
+        return 1;
+    bool isWantedMate = takeWantedMate(out.mateBuffer, record);
+    if (isWantedMate)
+        mate = record;
+
+    if (!hasFlagUnmapped(record))
+        out.alignedBaseCount += length(record.seq);
+
+    // Check the read's unmapped flag.
+    if (hasFlagUnmapped(record))
+    {
+        if (removeLowQuality(record, 20) != 1 && removeAdapter(record, 30, tag) != 2 &&
+                appendFastqRecord(out, record) == -1)
+            return 1;
+    }
+
+    // Check for low mapping quality.
+    else if (hasLowMappingQuality(record, humanSeqs))
+    {
+        if (removeLowQuality(record, 20) != 1 && removeAdapter(record, 30, tag) != 2)
+        {
+            int paired = appendFastqRecord(out, record);
+            if (paired == -1)
+                return 1;
+            if (paired == 0 && !hasFlagNextUnmapped(record) && requestMate(*out.matesOut, out.mateBuffer, record) != 0)
+                return 1;
+        }
+    }
+
+    // Check the mate's unmapped flag.
+    else if (hasFlagNextUnmapped(record))
+    {
+        if (writeMate(*out.matesOut, record) != 0)
+            return 1;
+    }
+
+    // Keep the record in case its mate turns out to have a low mapping quality.
+    else
+    {
+        addMateCandidate(out.mateBuffer, record, humanSeqs);
+    }
+
+    // Output the mate of a low-quality mapping read as it is in the input file.
+    if (isWantedMate)
+    {
+        setMateUnmapped(mate);
+        if (writeMate(*out.matesOut, mate) != 0)
+            return 1;
+        ++out.mateBuffer.numFound;
+    }
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+// Function cropReferences()
+// --------------------------------------------------------------------------
+
+// Crops the reads of whole reference sequences taken from a shared counter, followed by the unplaced reads
+// (rID -1). Each thread reads the input through its own file handle and bam index, so that the bgzf blocks
+// are inflated in parallel.
+template<typename TAdapterTag>
+bool
+cropReferences(CropOutput & out,
+        BamFileIn & inStream,
+        BamIndex<Bai> & bamIndex,
+        std::vector<__int32> const & references,
+        std::atomic<unsigned> & nextReference,
+        int humanSeqs,
+        TAdapterTag tag)
+{
+    BamAlignmentRecord record, mate;
+    for (unsigned i = nextReference++; i < references.size(); i = nextReference++)
+    {
+        __int32 rID = references[i];
+
+        bool hasAlignments = false;
+        if (rID == BamAlignmentRecord::INVALID_REFID)
+            jumpToOrphans(inStream, hasAlignments, bamIndex);
+        else
+            jumpToRegion(inStream, hasAlignments, rID, 0, maxValue<__int32>(), bamIndex);
+        if (!hasAlignments)
+            continue;
+
+        while (!atEnd(inStream))
+        {
+            readRecord(record, inStream);
+            if (record.rID != rID)
+                break;
+            if (cropRecord(out, record, mate, humanSeqs, tag) != 0)
+                return 1;
+        }
+
+        // Mates on other reference sequences are retrieved via the bam index after all threads are done.
+        if (expireMates(out.mateBuffer, maxValue<__uint64>()) != 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+// Function appendFile()
+// --------------------------------------------------------------------------
+
+inline bool
+appendFile(std::ofstream & dst, CharString const & filename)
+{
+    std::ifstream src(toCString(filename), std::ios::binary);
+    if (!src.is_open())
+    {
+        std::cerr << "ERROR: Could not open " << filename << std::endl;
+        return 1;
+    }
+    if (src.peek() != std::ifstream::traits_type::eof())
+        dst << src.rdbuf();
+    src.close();
+    remove(toCString(filename));
+    return 0;
+}
+
 // ==========================================================================
 // Function crop_unmapped()
 // ==========================================================================
 
+// Crops unmapped reads and reads with low mapping quality from the bam file. The mapped mates of the cropped reads
+// are written to matesBam sorted by read name. If pairedOut is given, the read pairs are written to it interleaved
+// instead of to the paired fastq files; fastqFiles.i1 is then only used to name temporary files. If trimmedFiles
+// is given, the reads are also written quality trimmed to these files.
 template<typename TAdapterTag>
 int
 crop_unmapped(double & avgCov,
@@ -356,21 +862,19 @@ crop_unmapped(double & avgCov,
         CharString & matesBam,
         CharString const & mappingBam,
         int humanSeqs,
-        TAdapterTag tag)
+        unsigned threads,
+        unsigned long memory,
+        TAdapterTag tag,
+        SharedFastqOut * pairedOut = NULL,
+        Triple<CharString> const * trimmedFiles = NULL)
 {
     typedef __int32 TPos;
-    typedef std::map<CharString, Pair<CharString> > TFastqMap; // Reads to go into fastq files.
-    typedef std::map<Pair<TPos>, Pair<CharString, bool> > TOtherMap; // Reads to crop in a second pass of the input file.
-    typedef StringSet<Dna5String> TStringSet;
+    typedef std::map<Pair<TPos>, Pair<CharString, bool> > TOtherMap; // Spilled mates to crop via the bam index.
 
-    // Open the input and output bam files.
+    // Open the input bam file.
     BamFileIn inStream(toCString(mappingBam));
-    BamFileOut matesStream(context(inStream), toCString(matesBam));
-
-    // Copy the header.
     BamHeader header;
     readHeader(header, inStream);
-    writeHeader(matesStream, header);
 
     unsigned long genomeLength = 0;
     for (unsigned i = 0; i < length(header); ++i)
@@ -388,82 +892,221 @@ crop_unmapped(double & avgCov,
         }
     }
 
-    // Create maps for fastq records (first read in pair and second read in pair) and bam records without mate.
-    TFastqMap firstReads, secondReads;
-    TOtherMap otherReads;
-
-    // Open the output fastq files.    
-    SeqFileOut fastqFirstStream(toCString(fastqFiles.i1));
-    SeqFileOut fastqSecondStream(toCString(fastqFiles.i2));
-    SeqFileOut fastqSingleStream(toCString(fastqFiles.i3));
-
-    // Retrieve the adapter sequences with up to one error and create indices.
-    TStringSet universal = reverseUniversalOneError(tag);
-    TStringSet truSeqs = reverseTruSeqsOneError(tag);
-    Index<TStringSet> indexUniversal(universal);
-    Index<TStringSet> indexTruSeqs(truSeqs);
-
-    // Iterate over the input file.
-    BamAlignmentRecord record;
-    unsigned long alignedBaseCount = 0;
-    while (!atEnd(inStream))
+    // Scanning reference sequences in parallel requires the bam index.
+    CharString baiFile = mappingBam;
+    baiFile += ".bai";
+    BamIndex<Bai> bamIndex;
+    if (threads > 1 && !open(bamIndex, toCString(baiFile)))
     {
-        // Read the next read from input file.
-        readRecord(record, inStream);
-
-        // Check for flags that indicate 'uninteresting' bam records.
-        if (hasFlagDuplicate(record) or hasFlagSecondary(record) or
-                hasFlagQCNoPass(record) or hasFlagSupplementary(record)) continue;
+        std::ostringstream msg;
+        msg << "Could not read BAI index file " << baiFile << ", cropping on a single thread.";
+        printStatus(msg);
+        threads = 1;
+    }
 
-        if (!hasFlagUnmapped(record))
-            alignedBaseCount += length(record.seq);
+    // The mates are collected in a name-sorted buffer that spills to disk above the memory budget of all threads.
+    MatesOut matesOut;
+    initSorter(matesOut.sorter, matesBam, header, BAM_SORT_NAME, threads, memory * threads);
 
-        // Check the read's unmapped flag.
-        if (hasFlagUnmapped(record))
+    // Create the outputs of the cropping threads. A single thread writes to the output files directly.
+    std::vector<std::unique_ptr<BamFileIn> > inStreams;
+    std::vector<std::unique_ptr<CropOutput> > outputs;
+    if (threads == 1)
+    {
+        outputs.push_back(std::unique_ptr<CropOutput>(new CropOutput(fastqFiles, matesBam, matesOut, memory, false,
+                pairedOut, trimmedFiles)));
+    }
+    else
+    {
+        for (unsigned t = 0; t < threads; ++t)
         {
-            if (removeLowQuality(record, 20) != 1 && removeAdapter(record, indexUniversal, indexTruSeqs, 30, tag) != 2)
-                appendFastqRecord(fastqFirstStream, fastqSecondStream, firstReads, secondReads, record);
+            inStreams.push_back(std::unique_ptr<BamFileIn>(new BamFileIn(toCString(mappingBam))));
+            BamHeader threadHeader;
+            readHeader(threadHeader, *inStreams[t]);
+
+            Triple<CharString> threadFastqFiles(threadFile(fastqFiles.i1, t), threadFile(fastqFiles.i2, t), "");
+            Triple<CharString> threadTrimmedFiles;
+            if (trimmedFiles != NULL)
+                threadTrimmedFiles = Triple<CharString>(threadFile(trimmedFiles->i1, t), threadFile(trimmedFiles->i2, t),
+                        threadFile(trimmedFiles->i3, t));
+            outputs.push_back(std::unique_ptr<CropOutput>(new CropOutput(threadFastqFiles, threadFile(matesBam, t),
+                    matesOut, memory, true, pairedOut, trimmedFiles != NULL ? &threadTrimmedFiles : NULL)));
         }
+    }
 
-        // Check for low mapping quality.
-        else if (hasLowMappingQuality(record, humanSeqs))
+    if (threads == 1)
+    {
+        // Iterate over the input file.
+        BamAlignmentRecord record, mate;
+        while (!atEnd(inStream))
         {
-            if (removeLowQuality(record, 20) != 1 && removeAdapter(record, indexUniversal, indexTruSeqs, 30, tag) != 2)
-            {
-                if (appendFastqRecord(fastqFirstStream, fastqSecondStream, firstReads, secondReads, record) == 0)
-                    otherReads[Pair<TPos>(record.rNextId, record.pNext)] = Pair<CharString, bool>(record.qName, hasFlagFirst(record));
-            }
+            readRecord(record, inStream);
+            if (cropRecord(*outputs[0], record, mate, humanSeqs, tag) != 0)
+                return 1;
         }
 
-        // Check the mate's unmapped flag.
-        else if (hasFlagNextUnmapped(record))
+        // Mates that were wanted but not found in the input are retrieved via the bam index.
+        if (expireMates(outputs[0]->mateBuffer, maxValue<__uint64>()) != 0)
+            return 1;
+    }
+    else
+    {
+        // Scan the longest reference sequences first for a better load balance, the unplaced reads last.
+        String<__int32> const & refLengths = contigLengths(context(inStream));
+        std::vector<__int32> references;
+        for (unsigned i = 0; i < length(refLengths); ++i)
+            references.push_back(i);
+        std::stable_sort(references.begin(), references.end(),
+                [&](__int32 a, __int32 b) { return refLengths[a] > refLengths[b]; });
+        references.push_back(BamAlignmentRecord::INVALID_REFID);
+
+        std::atomic<unsigned> nextReference(0);
+        std::vector<int> results(threads, 0);
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t)
+            workers.push_back(std::thread([&, t]() {
+                BamIndex<Bai> threadIndex;
+                if (!open(threadIndex, toCString(baiFile)))
+                {
+                    results[t] = 1;
+                    return;
+                }
+                results[t] = cropReferences(*outputs[t], *inStreams[t], threadIndex, references, nextReference, humanSeqs, tag);
+            }));
+        for (unsigned t = 0; t < threads; ++t)
+            workers[t].join();
+
+        for (unsigned t = 0; t < threads; ++t)
         {
-            writeRecord(matesStream, record);
+            if (results[t] != 0)
+            {
+                std::cerr << "ERROR while cropping unmapped reads from " << mappingBam << std::endl;
+                return 1;
+            }
         }
     }
     close(inStream);
 
+    // Combine the counts and the reads still waiting for their other read end of all threads.
+    CropOutput & first = *outputs[0];
+    unsigned long alignedBaseCount = 0;
+    size_t numFound = 0, numSpilled = 0, numRuns = 0;
+    std::vector<ReadPairer *> pairers;
+    for (unsigned t = 0; t < outputs.size(); ++t)
+    {
+        alignedBaseCount += outputs[t]->alignedBaseCount;
+        numFound += outputs[t]->mateBuffer.numFound;
+        numSpilled += outputs[t]->mateBuffer.numSpilled;
+        numRuns += outputs[t]->pairer.runs.size();
+        pairers.push_back(&outputs[t]->pairer);
+    }
+
     avgCov = (double)alignedBaseCount / (double)genomeLength;
 
     std::ostringstream msg;
-    msg << "Map of low quality mates has " << otherReads.size() << " records.";
+    msg << "Found " << numFound << " mates of low quality mapping reads in a single pass, "
+        << numSpilled << " mates spilled for a second pass.";
     printStatus(msg);
 
+    size_t peakArenaSize = 0;
+    for (unsigned t = 0; t < pairers.size(); ++t)
+        peakArenaSize += pairers[t]->arena.peakSize;
+    msg.str("");
+    msg << "Peak size of read arenas for unpaired reads: " << (peakArenaSize >> 20) << " MB.";
+    printStatus(msg);
+
+    if (numRuns != 0)
+    {
+        msg.str("");
+        msg << "Merging " << numRuns << " temporary runs of reads waiting for their other read end.";
+        printStatus(msg);
+    }
+
     // Write the remaining fastq records.
-    if (writeFastq(fastqFirstStream, fastqSecondStream, fastqSingleStream, firstReads, secondReads) != 0) return 1;
-    firstReads.clear();
-    secondReads.clear();
+    SeqFileOut fastqSingleStream(toCString(fastqFiles.i3));
+    if (pairedOut != NULL)
+    {
+        if (writeWaitingReads(pairedOut->stream, pairedOut->stream, fastqSingleStream, pairers) != 0) return 1;
+
+        // The reader of the read pairs may go on with the single reads.
+        close(fastqSingleStream);
+        close(*pairedOut);
+    }
+    else if (writeWaitingReads(first.fastqFirstStream, first.fastqSecondStream, fastqSingleStream, pairers,
+            first.trimmedOut.get()) != 0)
+    {
+        return 1;
+    }
+
+    // Concatenate the paired fastq files of the threads.
+    if (threads > 1)
+    {
+        std::ofstream fastqFirst, fastqSecond, trimmedFirst, trimmedSecond, trimmedSingle;
+        if (pairedOut == NULL)
+        {
+            fastqFirst.open(toCString(fastqFiles.i1), std::ios::binary);
+            fastqSecond.open(toCString(fastqFiles.i2), std::ios::binary);
+        }
+        if (trimmedFiles != NULL)
+        {
+            trimmedFirst.open(toCString(trimmedFiles->i1), std::ios::binary);
+            trimmedSecond.open(toCString(trimmedFiles->i2), std::ios::binary);
+            trimmedSingle.open(toCString(trimmedFiles->i3), std::ios::binary);
+        }
+        for (unsigned t = 0; t < threads; ++t)
+        {
+            if (pairedOut == NULL)
+            {
+                close(outputs[t]->fastqFirstStream);
+                close(outputs[t]->fastqSecondStream);
+                if (appendFile(fastqFirst, threadFile(fastqFiles.i1, t)) != 0 ||
+                        appendFile(fastqSecond, threadFile(fastqFiles.i2, t)) != 0)
+                    return 1;
+            }
+            if (trimmedFiles != NULL)
+            {
+                close(outputs[t]->trimmedOut->firstStream);
+                close(outputs[t]->trimmedOut->secondStream);
+                close(outputs[t]->trimmedOut->singleStream);
+                if (appendFile(trimmedFirst, threadFile(trimmedFiles->i1, t)) != 0 ||
+                        appendFile(trimmedSecond, threadFile(trimmedFiles->i2, t)) != 0 ||
+                        appendFile(trimmedSingle, threadFile(trimmedFiles->i3, t)) != 0)
+                    return 1;
+            }
+        }
+    }
 
     msg.str("");
-    msg << "Unmapped reads written to " << fastqFiles.i1 << ", " << fastqFiles.i2 << ", " << fastqFiles.i3;
+    if (pairedOut != NULL)
+        msg << "Unmapped read pairs streamed to remapping, single reads written to " << fastqFiles.i3;
+    else
+        msg << "Unmapped reads written to " << fastqFiles.i1 << ", " << fastqFiles.i2 << ", " << fastqFiles.i3;
     printStatus(msg);
 
-    // Find the other read end of the low quality mapping reads and write them to the output bam file. 
-    int found = findOtherReads(matesStream, otherReads, mappingBam);
-    if (found == -1) return 1;
+    if (trimmedFiles != NULL)
+    {
+        msg.str("");
+        msg << "Quality trimmed reads written to " << trimmedFiles->i1 << ", " << trimmedFiles->i2 << ", " << trimmedFiles->i3;
+        printStatus(msg);
+    }
+
+    // Find the spilled mates of low quality mapping reads in a second pass over the input file.
+    int found = 0;
+    if (numSpilled != 0)
+    {
+        TOtherMap otherReads;
+        for (unsigned t = 0; t < outputs.size(); ++t)
+            if (outputs[t]->mateBuffer.numSpilled != 0 && readSpilledMates(otherReads, outputs[t]->mateBuffer) != 0)
+                return 1;
+        found = findOtherReads(matesOut, otherReads, mappingBam);
+        if (found == -1) return 1;
+    }
+
+    if (finishSorting(matesOut.sorter) != 0)
+        return 1;
 
     msg.str("");
-    msg << "Mapped mates of unmapped reads written to " << matesBam << " , " << found << " found in second pass.";
+    msg << "Mapped mates of unmapped reads written to " << matesBam << " sorted by read name, " << found << " found in second pass.";
     printStatus(msg);
 
     return 0;
@@ -476,10 +1119,178 @@ crop_unmapped(Triple<CharString> & fastqFiles,
         CharString & matesBam,
         CharString const & mappingBam,
         int humanSeqs,
-        TAdapterTag tag)
+        unsigned threads,
+        unsigned long memory,
+        TAdapterTag tag,
+        SharedFastqOut * pairedOut = NULL,
+        Triple<CharString> const * trimmedFiles = NULL)
 {
     double cov;
-    return crop_unmapped(cov, fastqFiles, matesBam, mappingBam, humanSeqs, tag);
+    return crop_unmapped(cov, fastqFiles, matesBam, mappingBam, humanSeqs, threads, memory, tag, pairedOut, trimmedFiles);
+}
+
+// --------------------------------------------------------------------------
+// Function cropReadGroup()
+// --------------------------------------------------------------------------
+
+// Sorts the primary records of one read or read pair from name-grouped input, e.g. bwa output, into the fastq
+// files and the mates bam file. Both read ends are at hand, so the mate of a low quality mapping read is output
+// directly instead of going through the mate buffer.
+inline bool
+cropReadGroup(CropOutput & out, std::vector<BamAlignmentRecord> & group, int humanSeqs)
+{
+    std::vector<bool> cropped(group.size(), false);
+    std::vector<bool> wantsMate(group.size(), false);
+
+    for (unsigned i = 0; i < group.size(); ++i)
+    {
+        BamAlignmentRecord & record = group[i];
+
+        if (hasFlagUnmapped(record) || hasLowMappingQuality(record, humanSeqs))
+        {
+            cropped[i] = true;
+            if (removeLowQuality(record, 20) == 1)
+                continue;
+            if (appendFastqRecord(out, record) == -1)
+                return 1;
+            wantsMate[i] = !hasFlagUnmapped(record) && !hasFlagNextUnmapped(record);
+        }
+        else if (hasFlagNextUnmapped(record))
+        {
+            if (writeMate(*out.matesOut, record) != 0)
+                return 1;
+        }
+    }
+
+    // Output the mate of a low quality mapping read as it is in the input.
+    if (group.size() != 2)
+        return 0;
+    for (unsigned i = 0; i < 2; ++i)
+    {
+        if (!wantsMate[i] || cropped[1 - i])
+            continue;
+        setMateUnmapped(group[1 - i]);
+        if (writeMate(*out.matesOut, group[1 - i]) != 0)
+            return 1;
+        ++out.mateBuffer.numFound;
+    }
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+// Function cropSamStream()
+// --------------------------------------------------------------------------
+
+// Crops the records of a sam stream in which the records of a read pair follow each other.
+inline bool
+cropSamStream(Triple<CharString> & fastqFiles,
+        CharString & matesBam,
+        std::istream & samStream,
+        int humanSeqs,
+        unsigned long memory,
+        Triple<CharString> const * trimmedFiles)
+{
+    BamFileIn inStream;
+    if (!open(inStream, samStream, Sam()))
+        return 1;
+    BamHeader header;
+    readHeader(header, inStream);
+
+    MatesOut matesOut;
+    initSorter(matesOut.sorter, matesBam, header, BAM_SORT_NAME, 1, memory);
+    CropOutput out(fastqFiles, matesBam, matesOut, memory, false, NULL, trimmedFiles);
+
+    // Collect the primary records of each read name and crop them together.
+    std::vector<BamAlignmentRecord> group;
+    BamAlignmentRecord record;
+    while (!atEnd(inStream))
+    {
+        readRecord(record, inStream);
+        if (hasFlagDuplicate(record) or hasFlagSecondary(record) or
+                hasFlagQCNoPass(record) or hasFlagSupplementary(record))
+            continue;
+
+        if (!group.empty() && group[0].qName != record.qName)
+        {
+            if (cropReadGroup(out, group, humanSeqs) != 0)
+                return 1;
+            group.clear();
+        }
+        group.push_back(record);
+    }
+    if (!group.empty() && cropReadGroup(out, group, humanSeqs) != 0)
+        return 1;
+
+    // Write the remaining fastq records.
+    SeqFileOut fastqSingleStream(toCString(fastqFiles.i3));
+    std::vector<ReadPairer *> pairers(1, &out.pairer);
+    if (writeWaitingReads(out.fastqFirstStream, out.fastqSecondStream, fastqSingleStream, pairers, out.trimmedOut.get()) != 0)
+        return 1;
+
+    std::ostringstream msg;
+    msg << "Unmapped reads written to " << fastqFiles.i1 << ", " << fastqFiles.i2 << ", " << fastqFiles.i3;
+    printStatus(msg);
+
+    if (trimmedFiles != NULL)
+    {
+        msg.str("");
+        msg << "Quality trimmed reads written to " << trimmedFiles->i1 << ", " << trimmedFiles->i2 << ", " << trimmedFiles->i3;
+        printStatus(msg);
+    }
+
+    if (finishSorting(matesOut.sorter) != 0)
+        return 1;
+
+    msg.str("");
+    msg << "Mapped mates of unmapped reads written to " << matesBam << " sorted by read name, " << out.mateBuffer.numFound
+        << " of them mates of low quality mapping reads.";
+    printStatus(msg);
+
+    return 0;
+}
+
+// ==========================================================================
+// Function crop_remapped()
+// ==========================================================================
+
+// Crops unmapped reads and reads with low mapping quality from the sam output of a command, e.g. bwa mem, in
+// which the records of a read pair follow each other, and writes the mates to matesBam sorted by read name. The
+// sam output is read through a pipe and never written to disk. If the command reads its input from a pipe
+// inherited as inputFd, the read end is closed here once the command runs, so that the writer notices when the
+// command exits. If trimmedFiles is given, the reads are also written quality trimmed to these files.
+inline int
+crop_remapped(Triple<CharString> & fastqFiles,
+        CharString & matesBam,
+        std::string const & command,
+        int humanSeqs,
+        unsigned long memory,
+        int inputFd = -1,
+        Triple<CharString> const * trimmedFiles = NULL)
+{
+    FILE * pipe = popen(command.c_str(), "r");
+    if (inputFd != -1)
+        ::close(inputFd);
+    if (pipe == NULL)
+    {
+        std::cerr << "ERROR: Could not run " << command << std::endl;
+        return 1;
+    }
+
+    bool failed;
+    {
+        __gnu_cxx::stdio_filebuf<char> pipeBuffer(pipe, std::ios::in);
+        std::istream samStream(&pipeBuffer);
+        failed = cropSamStream(fastqFiles, matesBam, samStream, humanSeqs, memory, trimmedFiles);
+    }
+
+    if (pclose(pipe) != 0 || failed)
+    {
+        std::cerr << "ERROR while cropping unmapped reads from the output of " << command << std::endl;
+        return 1;
+    }
+
+    return 0;
 }
 
 #endif // #ifndef NOVINS_CROP_UNMAPPED_H_
@@ -0,0 +1,1216 @@
+#ifndef POPINS_NATIVE_ASSEMBLY_H_
+#define POPINS_NATIVE_ASSEMBLY_H_
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <seqan/seq_io.h>
+
+using namespace seqan;
+
+// Number of reads whose k-mers are collected by all threads before they are inserted into the k-mer table.
+#ifndef ASSEMBLY_BATCH_SIZE
+#define ASSEMBLY_BATCH_SIZE (1 << 14)
+#endif
+
+// Number of shards of the k-mer table, a power of two.
+#ifndef ASSEMBLY_NUM_SHARDS
+#define ASSEMBLY_NUM_SHARDS 256
+#endif
+
+// ============================================================================
+// struct NativeAssemblyOptions
+// ============================================================================
+
+// Parameters of the native assembler, chosen like velvetg's -cov_cutoff 2 -max_coverage 100 and its default
+// minimum contig length of 2k.
+
+struct NativeAssemblyOptions
+{
+    unsigned kmerLength;
+    unsigned threads;
+    unsigned minCount;          // minimum count of a k-mer in the reads
+    double maxCoverage;         // maximum average k-mer count of a unitig
+    unsigned minLinks;          // minimum number of read pairs joining two contigs
+    unsigned minContigLength;   // 0 for 2k
+
+    NativeAssemblyOptions() :
+        kmerLength(47), threads(1), minCount(2), maxCoverage(100.0), minLinks(3), minContigLength(0)
+    {}
+};
+
+// ============================================================================
+// struct AssemblyReads
+// ============================================================================
+
+// The reads to assemble: seqs[2i] and seqs[2i+1] for 2i < numPaired are the two ends of a read pair, all other
+// reads are single end reads.
+
+struct AssemblyReads
+{
+    std::vector<std::string> seqs;
+    size_t numPaired;
+
+    AssemblyReads() : numPaired(0)
+    {}
+};
+
+// ============================================================================
+// K-mers
+// ============================================================================
+
+// K-mers of up to 63 bases packed two bits per base, the first base in the most significant bits.
+typedef unsigned __int128 TKmer;
+
+// --------------------------------------------------------------------------
+// Function _baseCode()
+// --------------------------------------------------------------------------
+
+// Returns the two-bit code of a base, or 4 for any other character.
+inline unsigned
+_baseCode(char c)
+{
+    switch (c)
+    {
+        case 'A': case 'a': return 0;
+        case 'C': case 'c': return 1;
+        case 'G': case 'g': return 2;
+        case 'T': case 't': return 3;
+        default: return 4;
+    }
+}
+
+// --------------------------------------------------------------------------
+// Function _reverseComplement64()
+// --------------------------------------------------------------------------
+
+inline __uint64
+_reverseComplement64(__uint64 x)
+{
+    x = ~x;
+    x = ((x >> 2) & 0x3333333333333333ull) | ((x & 0x3333333333333333ull) << 2);
+    x = ((x >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((x & 0x0F0F0F0F0F0F0F0Full) << 4);
+    return __builtin_bswap64(x);
+}
+
+// --------------------------------------------------------------------------
+// Function reverseComplement()
+// --------------------------------------------------------------------------
+
+inline TKmer
+reverseComplement(TKmer x, unsigned k)
+{
+    TKmer rc = ((TKmer)_reverseComplement64((__uint64)x) << 64) | _reverseComplement64((__uint64)(x >> 64));
+    return rc >> (128 - 2 * k);
+}
+
+// --------------------------------------------------------------------------
+// Function _kmerHash()
+// --------------------------------------------------------------------------
+
+inline __uint64
+_kmerHash(TKmer x)
+{
+    __uint64 h = (__uint64)x * 0x9E3779B97F4A7C15ull ^ (__uint64)(x >> 64) * 0xC2B2AE3D27D4EB4Full;
+    h ^= h >> 31;
+    h *= 0x94D049BB133111EBull;
+    h ^= h >> 29;
+    return h;
+}
+
+// ============================================================================
+// struct KmerTable
+// ============================================================================
+
+// Canonical k-mers and their counts in open-addressing hash tables with linear probing. The table is split into
+// shards by the top bits of the hash, so that threads can insert into different shards without locking. Once
+// the k-mers of the reads are counted, the table is compacted to the solid k-mers, which then store the unitig
+// they belong to.
+
+enum KmerFlags
+{
+    KMER_DELETED = 1,
+    KMER_VISITED = 2
+};
+
+struct KmerShard
+{
+    std::vector<TKmer> kmers;
+    std::vector<unsigned> counts;       // 0 marks an empty slot
+    std::vector<unsigned char> flags;
+    std::vector<unsigned char> edges;   // successors (low bits) and predecessors (high bits) by base
+    std::vector<unsigned> unitigs;
+    std::vector<unsigned> offsets;      // offset of the k-mer in its unitig << 1 | 1 if reverse complemented
+    size_t size;
+
+    KmerShard() : size(0)
+    {}
+};
+
+struct KmerTable
+{
+    unsigned k;
+    TKmer mask;
+    std::vector<KmerShard> shards;
+
+    KmerTable(unsigned k_) :
+        k(k_), mask(((TKmer)1 << (2 * k_)) - 1), shards(ASSEMBLY_NUM_SHARDS)
+    {}
+};
+
+// Position of a k-mer in the table.
+struct KmerSlot
+{
+    unsigned shard;
+    size_t slot;
+
+    KmerSlot() : shard(0), slot(0)
+    {}
+};
+
+// --------------------------------------------------------------------------
+// Function canonical()
+// --------------------------------------------------------------------------
+
+inline TKmer
+canonical(KmerTable const & table, TKmer x)
+{
+    return std::min(x, reverseComplement(x, table.k));
+}
+
+// --------------------------------------------------------------------------
+// Function _shardOf()
+// --------------------------------------------------------------------------
+
+inline unsigned
+_shardOf(__uint64 hash)
+{
+    return (unsigned)(hash >> 56) & (ASSEMBLY_NUM_SHARDS - 1);
+}
+
+// --------------------------------------------------------------------------
+// Function _resizeShard()
+// --------------------------------------------------------------------------
+
+inline void
+_resizeShard(KmerShard & shard, size_t capacity)
+{
+    std::vector<TKmer> kmers(capacity);
+    std::vector<unsigned> counts(capacity, 0);
+    size_t mask = capacity - 1;
+
+    for (size_t i = 0; i < shard.counts.size(); ++i)
+    {
+        if (shard.counts[i] == 0)
+            continue;
+        size_t j = _kmerHash(shard.kmers[i]) & mask;
+        while (counts[j] != 0)
+            j = (j + 1) & mask;
+        kmers[j] = shard.kmers[i];
+        counts[j] = shard.counts[i];
+    }
+
+    shard.kmers.swap(kmers);
+    shard.counts.swap(counts);
+}
+
+// --------------------------------------------------------------------------
+// Function _insertKmer()
+// --------------------------------------------------------------------------
+
+inline void
+_insertKmer(KmerShard & shard, TKmer kmer, __uint64 hash, unsigned weight)
+{
+    if (10 * (shard.size + 1) > 7 * shard.counts.size())
+        _resizeShard(shard, std::max((size_t)1024, 2 * shard.counts.size()));
+
+    size_t mask = shard.counts.size() - 1;
+    size_t i = hash & mask;
+    while (shard.counts[i] != 0)
+    {
+        if (shard.kmers[i] == kmer)
+        {
+            shard.counts[i] += weight;
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+    shard.kmers[i] = kmer;
+    shard.counts[i] = weight;
+    ++shard.size;
+}
+
+// --------------------------------------------------------------------------
+// Function findKmer()
+// --------------------------------------------------------------------------
+
+// Finds a canonical k-mer in the table. Returns false if it is not in the table or deleted.
+inline bool
+findKmer(KmerSlot & pos, KmerTable const & table, TKmer kmer)
+{
+    __uint64 hash = _kmerHash(kmer);
+    pos.shard = _shardOf(hash);
+    KmerShard const & shard = table.shards[pos.shard];
+    if (shard.counts.empty())
+        return false;
+
+    size_t mask = shard.counts.size() - 1;
+    for (size_t i = hash & mask; shard.counts[i] != 0; i = (i + 1) & mask)
+    {
+        if (shard.kmers[i] == kmer)
+        {
+            pos.slot = i;
+            return shard.flags.empty() || (shard.flags[i] & KMER_DELETED) == 0;
+        }
+    }
+    return false;
+}
+
+// --------------------------------------------------------------------------
+// Function forEachKmer()
+// --------------------------------------------------------------------------
+
+// Calls f(kmer, position) for the k-mers of a sequence in order, skipping k-mers with non-ACGT characters. The
+// k-mers are given in the orientation of the sequence.
+template<typename TFunctor>
+inline void
+forEachKmer(std::string const & seq, unsigned k, TFunctor f)
+{
+    TKmer mask = ((TKmer)1 << (2 * k)) - 1;
+    TKmer kmer = 0;
+    unsigned valid = 0;
+    for (size_t i = 0; i < seq.size(); ++i)
+    {
+        unsigned c = _baseCode(seq[i]);
+        if (c == 4)
+        {
+            valid = 0;
+            continue;
+        }
+        kmer = ((kmer << 2) | c) & mask;
+        if (++valid >= k)
+            f(kmer, i + 1 - k);
+    }
+}
+
+// ==========================================================================
+// Function countKmers()
+// ==========================================================================
+
+// Counts the canonical k-mers of the reads, each occurrence weight times. The reads are processed in batches: all
+// threads collect the k-mers of a batch into one buffer per shard, then each thread inserts the buffered k-mers of
+// its own shards.
+inline void
+countKmers(KmerTable & table, AssemblyReads const & reads, unsigned threads, unsigned weight = 1)
+{
+    typedef std::vector<std::pair<TKmer, __uint64> > TBuffer;
+
+    std::vector<std::vector<TBuffer> > buffers(threads, std::vector<TBuffer>(ASSEMBLY_NUM_SHARDS));
+    for (size_t batchBegin = 0; batchBegin < reads.seqs.size(); batchBegin += ASSEMBLY_BATCH_SIZE)
+    {
+        size_t batchEnd = std::min(reads.seqs.size(), batchBegin + ASSEMBLY_BATCH_SIZE);
+
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t)
+            workers.push_back(std::thread([&, t]() {
+                for (size_t r = batchBegin + t; r < batchEnd; r += threads)
+                    forEachKmer(reads.seqs[r], table.k, [&](TKmer kmer, size_t) {
+                        TKmer c = canonical(table, kmer);
+                        __uint64 hash = _kmerHash(c);
+                        buffers[t][_shardOf(hash)].push_back(std::make_pair(c, hash));
+                    });
+            }));
+        for (unsigned t = 0; t < threads; ++t)
+            workers[t].join();
+
+        workers.clear();
+        for (unsigned t = 0; t < threads; ++t)
+            workers.push_back(std::thread([&, t]() {
+                for (unsigned s = t; s < ASSEMBLY_NUM_SHARDS; s += threads)
+                {
+                    for (unsigned p = 0; p < threads; ++p)
+                    {
+                        for (size_t i = 0; i < buffers[p][s].size(); ++i)
+                            _insertKmer(table.shards[s], buffers[p][s][i].first, buffers[p][s][i].second, weight);
+                        buffers[p][s].clear();
+                    }
+                }
+            }));
+        for (unsigned t = 0; t < threads; ++t)
+            workers[t].join();
+    }
+}
+
+// --------------------------------------------------------------------------
+// Function removeRareKmers()
+// --------------------------------------------------------------------------
+
+// Compacts the table to the k-mers that occur at least minCount times, most of the others are sequencing errors.
+inline size_t
+removeRareKmers(KmerTable & table, unsigned minCount)
+{
+    size_t numSolid = 0;
+    for (unsigned s = 0; s < ASSEMBLY_NUM_SHARDS; ++s)
+    {
+        KmerShard & shard = table.shards[s];
+        size_t solid = 0;
+        for (size_t i = 0; i < shard.counts.size(); ++i)
+        {
+            if (shard.counts[i] < minCount)
+                shard.counts[i] = 0;
+            else
+                ++solid;
+        }
+
+        // A lower load factor for the many lookups of k-mers that are not in the graph.
+        size_t capacity = 1024;
+        while (2 * solid > capacity)
+            capacity *= 2;
+        _resizeShard(shard, capacity);
+        shard.size = solid;
+        shard.flags.assign(capacity, 0);
+        shard.edges.assign(capacity, 0);
+        shard.unitigs.assign(capacity, 0);
+        shard.offsets.assign(capacity, 0);
+        numSolid += solid;
+    }
+    return numSolid;
+}
+
+// ============================================================================
+// De Bruijn graph
+// ============================================================================
+
+// The de Bruijn graph is implicit in the table: a k-mer x has an edge to the k-mer y if y without its last base
+// is x without its first base. The k-mers are given in either orientation.
+
+// --------------------------------------------------------------------------
+// Function _successors()
+// --------------------------------------------------------------------------
+
+inline unsigned
+_successors(TKmer (& next)[4], KmerTable const & table, TKmer x)
+{
+    unsigned n = 0;
+    KmerSlot pos;
+    for (unsigned c = 0; c < 4; ++c)
+    {
+        TKmer y = ((x << 2) | c) & table.mask;
+        if (findKmer(pos, table, canonical(table, y)))
+            next[n++] = y;
+    }
+    return n;
+}
+
+// --------------------------------------------------------------------------
+// Function _predecessors()
+// --------------------------------------------------------------------------
+
+inline unsigned
+_predecessors(TKmer (& prev)[4], KmerTable const & table, TKmer x)
+{
+    unsigned n = 0;
+    KmerSlot pos;
+    for (unsigned c = 0; c < 4; ++c)
+    {
+        TKmer y = (x >> 2) | ((TKmer)c << (2 * (table.k - 1)));
+        if (findKmer(pos, table, canonical(table, y)))
+            prev[n++] = y;
+    }
+    return n;
+}
+
+// --------------------------------------------------------------------------
+// Function computeEdges()
+// --------------------------------------------------------------------------
+
+// Stores the successors and predecessors of each k-mer in its canonical orientation. Each thread handles its own
+// shards, looking up the neighbors in all shards. The edges are kept up to date when k-mers are deleted.
+inline void
+computeEdges(KmerTable & table, unsigned threads)
+{
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t)
+        workers.push_back(std::thread([&, t]() {
+            TKmer neighbors[4];
+            for (unsigned s = t; s < ASSEMBLY_NUM_SHARDS; s += threads)
+            {
+                KmerShard & shard = table.shards[s];
+                for (size_t i = 0; i < shard.counts.size(); ++i)
+                {
+                    if (shard.counts[i] == 0 || (shard.flags[i] & KMER_DELETED) != 0)
+                        continue;
+                    unsigned char edges = 0;
+                    unsigned n = _successors(neighbors, table, shard.kmers[i]);
+                    for (unsigned j = 0; j < n; ++j)
+                        edges |= 1 << (unsigned)(neighbors[j] & 3);
+                    n = _predecessors(neighbors, table, shard.kmers[i]);
+                    for (unsigned j = 0; j < n; ++j)
+                        edges |= 16 << (unsigned)(neighbors[j] >> (2 * (table.k - 1)));
+                    shard.edges[i] = edges;
+                }
+            }
+        }));
+    for (unsigned t = 0; t < threads; ++t)
+        workers[t].join();
+}
+
+// --------------------------------------------------------------------------
+// Functions _outEdges() and _inEdges()
+// --------------------------------------------------------------------------
+
+// Returns the bases by which the k-mer at pos can be extended to the right (out) or the left (in), in the
+// orientation of the canonical k-mer or of its reverse complement if reverse is set.
+inline unsigned
+_outEdges(KmerTable const & table, KmerSlot const & pos, bool reverse)
+{
+    static unsigned char const complemented[16] = {0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15};
+    unsigned char edges = table.shards[pos.shard].edges[pos.slot];
+    return reverse ? complemented[edges >> 4] : edges & 15;
+}
+
+inline unsigned
+_inEdges(KmerTable const & table, KmerSlot const & pos, bool reverse)
+{
+    return _outEdges(table, pos, !reverse);
+}
+
+// --------------------------------------------------------------------------
+// Function _extendRight()
+// --------------------------------------------------------------------------
+
+// Extends a unitig to the right of the k-mer x as long as the path does not branch, appending the bases to seq
+// and marking the k-mers as visited.
+inline void
+_extendRight(std::string & seq, KmerTable & table, TKmer x)
+{
+    static char const bases[] = "ACGT";
+    KmerSlot pos, next;
+    TKmer c = canonical(table, x);
+    findKmer(pos, table, c);
+    while (true)
+    {
+        unsigned out = _outEdges(table, pos, c != x);
+        if (__builtin_popcount(out) != 1)
+            break;
+        unsigned base = __builtin_ctz(out);
+        TKmer y = ((x << 2) | base) & table.mask;
+        TKmer cy = canonical(table, y);
+        findKmer(next, table, cy);
+        if (__builtin_popcount(_inEdges(table, next, cy != y)) != 1)
+            break;
+
+        unsigned char & flags = table.shards[next.shard].flags[next.slot];
+        if (flags & KMER_VISITED)
+            break;      // cycle
+        flags |= KMER_VISITED;
+        seq += bases[base];
+        x = y;
+        c = cy;
+        pos = next;
+    }
+}
+
+// ============================================================================
+// struct Unitig
+// ============================================================================
+
+struct Unitig
+{
+    std::string seq;
+    double coverage;        // average count of the k-mers
+};
+
+// --------------------------------------------------------------------------
+// Function _reverseComplement()
+// --------------------------------------------------------------------------
+
+inline std::string
+_reverseComplement(std::string const & seq)
+{
+    std::string rc(seq.rbegin(), seq.rend());
+    for (size_t i = 0; i < rc.size(); ++i)
+    {
+        switch (rc[i])
+        {
+            case 'A': rc[i] = 'T'; break;
+            case 'C': rc[i] = 'G'; break;
+            case 'G': rc[i] = 'C'; break;
+            case 'T': rc[i] = 'A'; break;
+            default: rc[i] = 'N';
+        }
+    }
+    return rc;
+}
+
+// ==========================================================================
+// Function buildUnitigs()
+// ==========================================================================
+
+// Builds the maximal non-branching paths of the graph and stores the unitig of each k-mer in the table.
+inline void
+buildUnitigs(std::vector<Unitig> & unitigs, KmerTable & table)
+{
+    static char const bases[] = "ACGT";
+    unsigned k = table.k;
+
+    unitigs.clear();
+    for (unsigned s = 0; s < ASSEMBLY_NUM_SHARDS; ++s)
+    {
+        KmerShard & shard = table.shards[s];
+        for (size_t i = 0; i < shard.counts.size(); ++i)
+            shard.flags[i] &= ~KMER_VISITED;
+    }
+
+    for (unsigned s = 0; s < ASSEMBLY_NUM_SHARDS; ++s)
+    {
+        KmerShard & shard = table.shards[s];
+        for (size_t i = 0; i < shard.counts.size(); ++i)
+        {
+            if (shard.counts[i] == 0 || (shard.flags[i] & (KMER_DELETED | KMER_VISITED)) != 0)
+                continue;
+            shard.flags[i] |= KMER_VISITED;
+
+            TKmer seed = shard.kmers[i];
+            std::string seedSeq(k, 'A');
+            for (unsigned j = 0; j < k; ++j)
+                seedSeq[j] = bases[(unsigned)(seed >> (2 * (k - 1 - j))) & 3];
+
+            // Extend to the right, then to the right of the reverse complement.
+            std::string right;
+            _extendRight(right, table, seed);
+            std::string left;
+            _extendRight(left, table, reverseComplement(seed, k));
+
+            Unitig unitig;
+            unitig.seq = _reverseComplement(left) + seedSeq + right;
+            unitigs.push_back(unitig);
+        }
+    }
+
+    // Store the unitig and offset of each k-mer and the coverage of each unitig.
+    for (unsigned u = 0; u < unitigs.size(); ++u)
+    {
+        unsigned long countSum = 0;
+        unsigned numKmers = 0;
+        forEachKmer(unitigs[u].seq, k, [&](TKmer kmer, size_t offset) {
+            TKmer c = canonical(table, kmer);
+            KmerSlot pos;
+            findKmer(pos, table, c);
+            KmerShard & shard = table.shards[pos.shard];
+            shard.unitigs[pos.slot] = u;
+            shard.offsets[pos.slot] = (offset << 1) | (c != kmer ? 1 : 0);
+            countSum += shard.counts[pos.slot];
+            ++numKmers;
+        });
+        unitigs[u].coverage = (double)countSum / numKmers;
+    }
+}
+
+// --------------------------------------------------------------------------
+// Function _firstKmer()
+// --------------------------------------------------------------------------
+
+// Returns the first k-mer of a unitig, or of its reverse complement if reverse is set.
+inline TKmer
+_firstKmer(Unitig const & unitig, unsigned k, bool reverse)
+{
+    TKmer kmer = 0;
+    for (unsigned j = 0; j < k; ++j)
+    {
+        if (reverse)
+            kmer = (kmer << 2) | (3 - _baseCode(unitig.seq[unitig.seq.size() - 1 - j]));
+        else
+            kmer = (kmer << 2) | _baseCode(unitig.seq[j]);
+    }
+    return kmer;
+}
+
+// --------------------------------------------------------------------------
+// Function _unitigStartingWith()
+// --------------------------------------------------------------------------
+
+// Returns the unitig of the k-mer x and sets reverse if x is the first k-mer of its reverse complement.
+inline unsigned
+_unitigStartingWith(bool & reverse, KmerTable const & table, TKmer x)
+{
+    TKmer c = canonical(table, x);
+    KmerSlot pos;
+    findKmer(pos, table, c);
+    KmerShard const & shard = table.shards[pos.shard];
+    reverse = ((shard.offsets[pos.slot] & 1) != 0) != (c != x);
+    return shard.unitigs[pos.slot];
+}
+
+// --------------------------------------------------------------------------
+// Function _deleteUnitig()
+// --------------------------------------------------------------------------
+
+// Removes the edge between the canonical k-mer c and its neighbor y, given in the orientation of c.
+inline void
+_removeEdge(KmerTable & table, TKmer c, TKmer y, bool isSuccessor)
+{
+    TKmer cy = canonical(table, y);
+    KmerSlot pos;
+    if (!findKmer(pos, table, cy))
+        return;
+
+    // c is a predecessor of y with its first base, or a successor of y with its last base.
+    unsigned base = isSuccessor ? (unsigned)(c >> (2 * (table.k - 1))) : (unsigned)(c & 3);
+    bool predecessor = isSuccessor;
+    if (cy != y)
+    {
+        base = 3 - base;
+        predecessor = !predecessor;
+    }
+    table.shards[pos.shard].edges[pos.slot] &= ~(predecessor ? 16 << base : 1 << base);
+}
+
+inline void
+_deleteUnitig(KmerTable & table, Unitig const & unitig)
+{
+    forEachKmer(unitig.seq, table.k, [&](TKmer kmer, size_t) {
+        TKmer c = canonical(table, kmer);
+        KmerSlot pos;
+        if (!findKmer(pos, table, c))
+            return;
+        table.shards[pos.shard].flags[pos.slot] |= KMER_DELETED;
+
+        unsigned edges = table.shards[pos.shard].edges[pos.slot];
+        for (unsigned b = 0; b < 4; ++b)
+        {
+            if (edges & (1 << b))
+                _removeEdge(table, c, ((c << 2) | b) & table.mask, true);
+            if (edges & (16 << b))
+                _removeEdge(table, c, (c >> 2) | ((TKmer)b << (2 * (table.k - 1))), false);
+        }
+    });
+}
+
+// ==========================================================================
+// Function removeTips()
+// ==========================================================================
+
+// Removes unitigs shorter than 2k that end in a dead end on one side and branch off another path on the other
+// side, and unitigs whose coverage exceeds maxCoverage. Returns the number of removed unitigs.
+inline unsigned
+removeTips(KmerTable & table, std::vector<Unitig> const & unitigs, double maxCoverage)
+{
+    unsigned k = table.k;
+    unsigned removed = 0;
+    TKmer next[4], prev[4], other[4];
+
+    for (unsigned u = 0; u < unitigs.size(); ++u)
+    {
+        if (unitigs[u].coverage > maxCoverage)
+        {
+            _deleteUnitig(table, unitigs[u]);
+            ++removed;
+            continue;
+        }
+        if (unitigs[u].seq.size() >= 2 * k)
+            continue;
+
+        for (unsigned reverse = 0; reverse < 2; ++reverse)
+        {
+            // The dead end is at the end, the branching path before the first k-mer.
+            TKmer first = _firstKmer(unitigs[u], k, reverse);
+            TKmer last = reverseComplement(_firstKmer(unitigs[u], k, !reverse), k);
+            if (_successors(next, table, last) != 0)
+                continue;
+
+            unsigned numPrev = _predecessors(prev, table, first);
+            bool branches = false;
+            for (unsigned p = 0; p < numPrev && !branches; ++p)
+                branches = _successors(other, table, prev[p]) > 1;
+            if (!branches)
+                continue;
+
+            _deleteUnitig(table, unitigs[u]);
+            ++removed;
+            break;
+        }
+    }
+    return removed;
+}
+
+// ==========================================================================
+// Function removeBubbles()
+// ==========================================================================
+
+// Removes the branch with the lower coverage of simple bubbles: two unitigs of similar length that start after
+// the same k-mer and end before the same k-mer, e.g. caused by sequencing errors or heterozygous variants.
+// Returns the number of removed unitigs.
+inline unsigned
+removeBubbles(KmerTable & table, std::vector<Unitig> const & unitigs)
+{
+    unsigned k = table.k;
+    unsigned removed = 0;
+    std::vector<bool> deleted(unitigs.size(), false);
+    TKmer next[4], branchNext[4];
+
+    for (unsigned u = 0; u < unitigs.size(); ++u)
+    {
+        for (unsigned reverse = 0; reverse < 2; ++reverse)
+        {
+            if (deleted[u])
+                break;
+
+            // The last k-mer of u in this orientation.
+            TKmer last = reverseComplement(_firstKmer(unitigs[u], k, !reverse), k);
+            if (_successors(next, table, last) != 2)
+                continue;
+
+            unsigned branch[2];
+            TKmer end[2];
+            bool valid = true;
+            for (unsigned b = 0; b < 2 && valid; ++b)
+            {
+                bool branchReverse;
+                branch[b] = _unitigStartingWith(branchReverse, table, next[b]);
+                TKmer branchLast = reverseComplement(_firstKmer(unitigs[branch[b]], k, !branchReverse), k);
+                valid = !deleted[branch[b]] && branch[b] != u &&
+                        _successors(branchNext, table, branchLast) == 1;
+                if (valid)
+                    end[b] = branchNext[0];
+            }
+            if (!valid || branch[0] == branch[1] || end[0] != end[1])
+                continue;
+
+            size_t len0 = unitigs[branch[0]].seq.size(), len1 = unitigs[branch[1]].seq.size();
+            size_t diff = (len0 > len1) ? len0 - len1 : len1 - len0;
+            if (diff > std::max((size_t)3, std::max(len0, len1) / 10))
+                continue;
+
+            unsigned weaker = (unitigs[branch[0]].coverage < unitigs[branch[1]].coverage) ? branch[0] : branch[1];
+            _deleteUnitig(table, unitigs[weaker]);
+            deleted[weaker] = true;
+            ++removed;
+        }
+    }
+    return removed;
+}
+
+// ============================================================================
+// Scaffolding
+// ============================================================================
+
+// A read end placed on a unitig: the fragment continues beyond the given end of the unitig (0 for its beginning,
+// 1 for its end), dist bases from the first base of the read.
+struct ReadPlacement
+{
+    unsigned unitig;
+    unsigned end;
+    int dist;
+    int offset;     // offset of the first base of the read in the unitig
+
+    ReadPlacement() : unitig(0), end(0), dist(0), offset(0)
+    {}
+};
+
+// --------------------------------------------------------------------------
+// Function placeRead()
+// --------------------------------------------------------------------------
+
+// Places a read by its first k-mer that is in the graph. Returns false if none is.
+inline bool
+placeRead(ReadPlacement & placement, KmerTable const & table, std::vector<Unitig> const & unitigs, std::string const & read)
+{
+    unsigned k = table.k;
+    bool found = false;
+    forEachKmer(read, k, [&](TKmer kmer, size_t i) {
+        if (found)
+            return;
+        TKmer c = canonical(table, kmer);
+        KmerSlot pos;
+        if (!findKmer(pos, table, c))
+            return;
+        KmerShard const & shard = table.shards[pos.shard];
+        found = true;
+
+        placement.unitig = shard.unitigs[pos.slot];
+        int unitigOffset = shard.offsets[pos.slot] >> 1;
+        bool sameStrand = ((shard.offsets[pos.slot] & 1) != 0) == (c != kmer);
+        int len = unitigs[placement.unitig].seq.size();
+        if (sameStrand)
+        {
+            placement.offset = unitigOffset - (int)i;
+            placement.end = 1;
+            placement.dist = len - placement.offset;
+        }
+        else
+        {
+            placement.offset = unitigOffset + k - 1 + i;
+            placement.end = 0;
+            placement.dist = placement.offset + 1;
+        }
+    });
+    return found;
+}
+
+// --------------------------------------------------------------------------
+// Function _median()
+// --------------------------------------------------------------------------
+
+inline int
+_median(std::vector<int> & values)
+{
+    if (values.empty())
+        return 0;
+    std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+    return values[values.size() / 2];
+}
+
+// ==========================================================================
+// Function scaffoldUnitigs()
+// ==========================================================================
+
+// Joins unitigs into contigs using the read pairs. The insert size is estimated from the read pairs within one
+// unitig. Two unitig ends are joined if at least minLinks read pairs link them and neither is linked to another
+// unitig end by minLinks read pairs. The gap between them is filled with Ns of the median estimated gap length,
+// at least 10.
+inline void
+scaffoldUnitigs(std::vector<std::string> & contigs,
+        KmerTable const & table,
+        std::vector<Unitig> const & unitigs,
+        AssemblyReads const & reads,
+        NativeAssemblyOptions const & options)
+{
+    typedef std::pair<unsigned, unsigned> TEnd;                     // unitig, end
+    typedef std::map<std::pair<TEnd, TEnd>, std::vector<int> > TLinks;
+
+    // Place the read pairs on the unitigs, collect the links between unitig ends and the insert sizes.
+    unsigned threads = options.threads;
+    std::vector<TLinks> threadLinks(threads);
+    std::vector<std::vector<int> > threadInserts(threads);
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t)
+        workers.push_back(std::thread([&, t]() {
+            ReadPlacement first, second;
+            for (size_t p = 2 * t; p + 1 < reads.numPaired; p += 2 * threads)
+            {
+                if (!placeRead(first, table, unitigs, reads.seqs[p]) || !placeRead(second, table, unitigs, reads.seqs[p + 1]))
+                    continue;
+                if (first.unitig == second.unitig)
+                {
+                    if (first.end == 1 && second.end == 0 && second.offset >= first.offset)
+                        threadInserts[t].push_back(second.offset - first.offset + 1);
+                    else if (first.end == 0 && second.end == 1 && first.offset >= second.offset)
+                        threadInserts[t].push_back(first.offset - second.offset + 1);
+                    continue;
+                }
+                TEnd a(first.unitig, first.end), b(second.unitig, second.end);
+                std::pair<TEnd, TEnd> link = (a < b) ? std::make_pair(a, b) : std::make_pair(b, a);
+                threadLinks[t][link].push_back(first.dist + second.dist);
+            }
+        }));
+    for (unsigned t = 0; t < threads; ++t)
+        workers[t].join();
+
+    TLinks links;
+    std::vector<int> inserts;
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        for (TLinks::iterator it = threadLinks[t].begin(); it != threadLinks[t].end(); ++it)
+            links[it->first].insert(links[it->first].end(), it->second.begin(), it->second.end());
+        inserts.insert(inserts.end(), threadInserts[t].begin(), threadInserts[t].end());
+    }
+    int insertSize = _median(inserts);
+
+    // Keep the links of unitig ends that are linked to exactly one other unitig end.
+    std::map<TEnd, unsigned> numLinks;
+    for (TLinks::iterator it = links.begin(); it != links.end(); ++it)
+    {
+        if (it->second.size() < options.minLinks)
+            continue;
+        ++numLinks[it->first.first];
+        ++numLinks[it->first.second];
+    }
+    std::map<TEnd, std::pair<TEnd, int> > partner;     // other end and gap length
+    for (TLinks::iterator it = links.begin(); it != links.end(); ++it)
+    {
+        TEnd a = it->first.first, b = it->first.second;
+        if (it->second.size() < options.minLinks || numLinks[a] != 1 || numLinks[b] != 1)
+            continue;
+        int gap = std::max(10, insertSize - _median(it->second));
+        partner[a] = std::make_pair(b, gap);
+        partner[b] = std::make_pair(a, gap);
+    }
+
+    // Walk the chains of joined unitigs. A unitig is entered through one end and left through the other.
+    std::vector<bool> used(unitigs.size(), false);
+    for (unsigned start = 0; start < unitigs.size(); ++start)
+    {
+        if (used[start])
+            continue;
+
+        // Go back to the first unitig of the chain, or once around if the chain is circular.
+        unsigned u = start, enterEnd = 0;
+        while (true)
+        {
+            std::map<TEnd, std::pair<TEnd, int> >::iterator it = partner.find(TEnd(u, enterEnd));
+            if (it == partner.end() || it->second.first.first == start)
+                break;
+            u = it->second.first.first;
+            enterEnd = 1 - it->second.first.second;
+        }
+
+        // Concatenate the unitigs of the chain.
+        std::string contig;
+        while (true)
+        {
+            used[u] = true;
+            contig += (enterEnd == 0) ? unitigs[u].seq : _reverseComplement(unitigs[u].seq);
+            std::map<TEnd, std::pair<TEnd, int> >::iterator it = partner.find(TEnd(u, 1 - enterEnd));
+            if (it == partner.end() || used[it->second.first.first])
+                break;
+            contig += std::string(it->second.second, 'N');
+            u = it->second.first.first;
+            enterEnd = it->second.first.second;
+        }
+        contigs.push_back(contig);
+    }
+}
+
+// ==========================================================================
+// Function assembleReads()
+// ==========================================================================
+
+// Assembles the reads with a de Bruijn graph of k-mers and returns the contigs of at least the minimum length. The
+// k-mers of previous contigs, e.g. of an assembly with a smaller k, are added to the graph as solid k-mers.
+inline void
+assembleReads(std::vector<std::string> & contigs,
+        AssemblyReads const & reads,
+        NativeAssemblyOptions const & options,
+        std::vector<std::string> const * previousContigs = NULL)
+{
+    KmerTable table(options.kmerLength);
+    countKmers(table, reads, options.threads);
+    if (previousContigs != NULL && !previousContigs->empty())
+    {
+        AssemblyReads contigReads;
+        contigReads.seqs = *previousContigs;
+        countKmers(table, contigReads, options.threads, options.minCount);
+    }
+    size_t numSolid = removeRareKmers(table, options.minCount);
+    computeEdges(table, options.threads);
+
+    std::ostringstream msg;
+    msg << "Built the de Bruijn graph of " << numSolid << " k-mers (k=" << options.kmerLength << ").";
+    printStatus(msg);
+
+    // Remove tips and bubbles until the graph does not change any more.
+    std::vector<Unitig> unitigs;
+    unsigned numTips = 0, numBubbles = 0;
+    for (unsigned round = 0; round < 8; ++round)
+    {
+        buildUnitigs(unitigs, table);
+        unsigned tips = removeTips(table, unitigs, options.maxCoverage);
+        if (tips != 0)
+            buildUnitigs(unitigs, table);
+        unsigned bubbles = removeBubbles(table, unitigs);
+        numTips += tips;
+        numBubbles += bubbles;
+        if (tips == 0 && bubbles == 0)
+            break;
+    }
+    buildUnitigs(unitigs, table);
+
+    msg.str("");
+    msg << "Removed " << numTips << " tips and " << numBubbles << " bubbles, " << unitigs.size() << " unitigs remain.";
+    printStatus(msg);
+
+    std::vector<std::string> scaffolds;
+    scaffoldUnitigs(scaffolds, table, unitigs, reads, options);
+
+    size_t minLength = (options.minContigLength != 0) ? options.minContigLength : 2 * options.kmerLength;
+    for (unsigned i = 0; i < scaffolds.size(); ++i)
+        if (scaffolds[i].size() >= minLength)
+            contigs.push_back(scaffolds[i]);
+}
+
+// ==========================================================================
+// Function deduplicateContigs()
+// ==========================================================================
+
+// Removes the contigs that are contained in a longer contig on either strand and returns their number. Seeds at
+// every step-th position of the kept contigs are indexed, so that a contained contig hits the index with one of
+// the seeds at its first step positions.
+inline size_t
+deduplicateContigs(std::vector<std::string> & contigs)
+{
+    typedef std::unordered_multimap<__uint64, std::pair<size_t, size_t> > TSeedIndex;
+
+    unsigned const seedLength = 25;
+    unsigned const step = 16;
+
+    std::stable_sort(contigs.begin(), contigs.end(),
+            [](std::string const & a, std::string const & b) { return a.size() > b.size(); });
+
+    std::vector<std::string> kept;
+    TSeedIndex seeds;
+
+    auto contained = [&](std::string const & seq) {
+        bool found = false;
+        forEachKmer(seq.substr(0, step + seedLength - 1), seedLength, [&](TKmer seed, size_t pos) {
+            std::pair<TSeedIndex::iterator, TSeedIndex::iterator> range = seeds.equal_range((__uint64)seed);
+            for (TSeedIndex::iterator it = range.first; !found && it != range.second; ++it)
+            {
+                std::string const & other = kept[it->second.first];
+                if (it->second.second < pos)
+                    continue;
+                size_t begin = it->second.second - pos;
+                found = begin + seq.size() <= other.size() && other.compare(begin, seq.size(), seq) == 0;
+            }
+        });
+        return found;
+    };
+
+    for (size_t i = 0; i < contigs.size(); ++i)
+    {
+        if (contained(contigs[i]) || contained(_reverseComplement(contigs[i])))
+            continue;
+
+        size_t id = kept.size();
+        forEachKmer(contigs[i], seedLength, [&](TKmer seed, size_t pos) {
+            if (pos % step == 0)
+                seeds.insert(std::make_pair((__uint64)seed, std::make_pair(id, pos)));
+        });
+        kept.push_back(contigs[i]);
+    }
+
+    size_t numRemoved = contigs.size() - kept.size();
+    contigs.swap(kept);
+    return numRemoved;
+}
+
+// ==========================================================================
+// Function assembleReadsMultiK()
+// ==========================================================================
+
+// Assembles the reads iteratively with increasing k-mer lengths. The reads are loaded once and the contigs of each
+// k are added to the graph of the next k, which bridges repeats with the larger k and keeps the regions of low
+// coverage assembled with the smaller k. The contigs of all k are merged and deduplicated.
+inline void
+assembleReadsMultiK(std::vector<std::string> & contigs,
+        AssemblyReads const & reads,
+        std::vector<unsigned> const & kmerLengths,
+        NativeAssemblyOptions options)
+{
+    std::vector<std::string> previousContigs;
+    for (unsigned i = 0; i < kmerLengths.size(); ++i)
+    {
+        options.kmerLength = kmerLengths[i];
+
+        std::vector<std::string> kContigs;
+        assembleReads(kContigs, reads, options, &previousContigs);
+        contigs.insert(contigs.end(), kContigs.begin(), kContigs.end());
+        previousContigs.swap(kContigs);
+    }
+
+    if (kmerLengths.size() > 1)
+    {
+        size_t numRemoved = deduplicateContigs(contigs);
+
+        std::ostringstream msg;
+        msg << "Removed " << numRemoved << " duplicate contigs of the assemblies with different k-mer lengths.";
+        printStatus(msg);
+    }
+}
+
+// ==========================================================================
+// Function loadAssemblyReads()
+// ==========================================================================
+
+// Loads the read pairs and the single end reads of fastq files.
+inline bool
+loadAssemblyReads(AssemblyReads & reads, Triple<CharString> const & fastqFiles)
+{
+    SeqFileIn firstStream, secondStream, singleStream;
+    if (!open(firstStream, toCString(fastqFiles.i1)) || !open(secondStream, toCString(fastqFiles.i2)) ||
+            !open(singleStream, toCString(fastqFiles.i3)))
+    {
+        std::cerr << "ERROR: Could not open " << fastqFiles.i1 << ", " << fastqFiles.i2 << " and " << fastqFiles.i3 << std::endl;
+        return 1;
+    }
+
+    std::string name, seq, qual;
+    while (!atEnd(firstStream) && !atEnd(secondStream))
+    {
+        readRecord(name, seq, qual, firstStream);
+        reads.seqs.push_back(seq);
+        readRecord(name, seq, qual, secondStream);
+        reads.seqs.push_back(seq);
+    }
+    if (!atEnd(firstStream) || !atEnd(secondStream))
+    {
+        std::cerr << "ERROR: Different number of reads in " << fastqFiles.i1 << " and " << fastqFiles.i2 << std::endl;
+        return 1;
+    }
+    reads.numPaired = reads.seqs.size();
+
+    while (!atEnd(singleStream))
+    {
+        readRecord(name, seq, qual, singleStream);
+        reads.seqs.push_back(seq);
+    }
+
+    return 0;
+}
+
+// ==========================================================================
+// Function readContigs()
+// ==========================================================================
+
+inline bool
+readContigs(std::vector<std::string> & contigs, CharString const & contigFile)
+{
+    SeqFileIn stream;
+    if (!open(stream, toCString(contigFile)))
+    {
+        std::cerr << "ERROR: Could not open " << contigFile << std::endl;
+        return 1;
+    }
+
+    std::string name, seq;
+    while (!atEnd(stream))
+    {
+        readRecord(name, seq, stream);
+        contigs.push_back(seq);
+    }
+
+    return 0;
+}
+
+// ==========================================================================
+// Function writeContigs()
+// ==========================================================================
+
+// Writes the contigs with velvet-like names, e.g. NODE_1_length_500.
+inline bool
+writeContigs(std::vector<std::string> const & contigs, CharString const & contigFile)
+{
+    SeqFileOut stream;
+    if (!open(stream, toCString(contigFile)))
+    {
+        std::cerr << "ERROR: Could not open " << contigFile << " for writing." << std::endl;
+        return 1;
+    }
+
+    for (unsigned i = 0; i < contigs.size(); ++i)
+    {
+        std::ostringstream name;
+        name << "NODE_" << (i + 1) << "_length_" << contigs[i].size();
+        writeRecord(stream, name.str(), contigs[i]);
+    }
+
+    return 0;
+}
+
+#endif  // #ifndef POPINS_NATIVE_ASSEMBLY_H_
@@ -1,12 +1,20 @@
 #include <sstream>
 #include <cerrno>
+#include <csignal>
+#include <memory>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <seqan/file.h>
 #include <seqan/sequence.h>
 
 #include "../popins_utils.h"
+#include "../bam_io.h"
+#include "../bam_sort.h"
 #include "../command_line_parsing.h"
 #include "crop_unmapped.h"
+#include "native_assembly.h"
 
 #ifndef POPINS_ASSEMBLE_H_
 #define POPINS_ASSEMBLE_H_
@@ -59,9 +67,12 @@ retrieveSampleID(CharString & sampleID, CharString & mappingBam)
 // Function remapping()
 // ==========================================================================
 
+// Remaps the cropped reads and crops the reads that remain unmapped to fastqFiles and, quality trimmed, to
+// filteredFiles.
 inline int
 remapping(Triple<CharString> & fastqFilesTemp,
         Triple<CharString> & fastqFiles,
+        Triple<CharString> const & filteredFiles,
         CharString const & referenceFile,
         CharString const & workingDir,
         unsigned humanSeqs,
@@ -72,111 +83,111 @@ remapping(Triple<CharString> & fastqFilesTemp,
     std::stringstream cmd;
 
     CharString f1 = prefix;
-    f1 += "remapped.sam";
-    CharString remappedSam = getFileName(workingDir, f1);
+    f1 += "remapped.bam";
+    CharString remappedBam = getFileName(workingDir, f1);
 
-    CharString f2 = prefix;
-    f2 += "remapped.bam";
-    CharString remappedBam = getFileName(workingDir, f2);
-
-    CharString f3 = prefix;
-    f3 += "remapped.bam.bai";
-    CharString remappedBai = getFileName(workingDir, f3);
-
-    CharString f4 = prefix;
-    f4 += "remapped_unsorted.bam";
-    CharString remappedUnsortedBam = getFileName(workingDir, f4);
-
-    std::ostringstream msg;
-    msg << "Remapping unmapped reads using " << BWA;
-    printStatus(msg);
-
-    // Run BWA on unmapped reads (pairs).
-    cmd.str("");
-    cmd << BWA << " mem -t " << threads << " " << referenceFile << " " << fastqFilesTemp.i1 << " " << fastqFilesTemp.i2 << " > " << remappedSam;
-    if (system(cmd.str().c_str()) != 0)
-    {
-        std::cerr << "ERROR while running bwa on " << fastqFilesTemp.i1 << " and " << fastqFilesTemp.i2 << std::endl;
+    unsigned long memoryBytes = 0;
+    if (parseMemory(memoryBytes, memory) != 0)
         return 1;
-    }
 
-    remove(toCString(fastqFilesTemp.i1));
-    remove(toCString(fastqFilesTemp.i2));
-
-    // Run BWA on unmapped reads (single end).
-    cmd.str("");
-    cmd << BWA << " mem -t " << threads << " " << referenceFile << " " << fastqFilesTemp.i3 << " | awk '$1 !~ /@/' >> " << remappedSam;
-    if (system(cmd.str().c_str()) != 0)
+    // The remapped reads are cropped to the fastq files while bwa is still reading the previous ones.
+    Triple<CharString> bwaFiles = fastqFilesTemp;
+    bwaFiles.i1 += ".bwa";
+    bwaFiles.i2 += ".bwa";
+    bwaFiles.i3 += ".bwa";
+    if (rename(toCString(fastqFilesTemp.i1), toCString(bwaFiles.i1)) != 0 ||
+            rename(toCString(fastqFilesTemp.i2), toCString(bwaFiles.i2)) != 0 ||
+            rename(toCString(fastqFilesTemp.i3), toCString(bwaFiles.i3)) != 0)
     {
-        std::cerr << "ERROR while running bwa on " << fastqFilesTemp.i3 << std::endl;
+        std::cerr << "ERROR: Could not rename " << fastqFilesTemp.i1 << ", " << fastqFilesTemp.i2 << " and "
+                  << fastqFilesTemp.i3 << " for remapping." << std::endl;
         return 1;
     }
 
-    remove(toCString(fastqFilesTemp.i3));
-
-    msg.str("");
-    msg << "Converting BWA output " << remappedSam << " to bam format.";
+    std::ostringstream msg;
+    msg << "Remapping unmapped reads using " << BWA << " and cropping unmapped reads from its output";
     printStatus(msg);
 
-    // Convert BWA output to bam.
+    // Run BWA on unmapped reads (pairs), followed by the single end reads without a second header.
     cmd.str("");
-    cmd << SAMTOOLS << " view -S -h -b " << remappedSam << " > " << remappedUnsortedBam;
-    if (system(cmd.str().c_str()) != 0)
-    {
-        std::cerr << "ERROR while converting BWA output " << remappedSam << " to bam." << std::endl;
+    cmd << "{ " << BWA << " mem -t " << threads << " " << referenceFile << " " << bwaFiles.i1 << " " << bwaFiles.i2
+        << " && " << BWA << " mem -t " << threads << " " << referenceFile << " " << bwaFiles.i3 << " | awk '$1 !~ /^@/'; }";
+
+    // Crop unmapped and create bam file of remapping, sorted by read name.
+    if (crop_remapped(fastqFiles, remappedBam, cmd.str(), humanSeqs, memoryBytes, -1, &filteredFiles) != 0)
         return 1;
-    }
-    remove(toCString(remappedSam));
 
-    msg.str("");
-    msg << "Sorting " << remappedUnsortedBam << " using " << SAMTOOLS;
-    printStatus(msg);
+    remove(toCString(bwaFiles.i1));
+    remove(toCString(bwaFiles.i2));
+    remove(toCString(bwaFiles.i3));
 
-    // Sort bam file.
-    cmd.str("");
-    cmd << SAMTOOLS << " sort -@ " << threads << " -m " << memory << " -o " << remappedBam << " " << remappedUnsortedBam;
-    if (system(cmd.str().c_str()) != 0)
-    {
-        std::cerr << "ERROR while sorting BWA output " << remappedUnsortedBam << std::endl;
+    return 0;
+}
+
+// ==========================================================================
+// Function streamingRemapping()
+// ==========================================================================
+
+// Crops the reads from the input bam file and remaps them in a single pass: the cropping threads write the read
+// pairs interleaved to a pipe that bwa mem -p reads, and the bwa output is cropped again as it arrives (see
+// crop_remapped()). Only the single end reads and the mates are written to disk before remapping.
+template<typename TAdapterTag>
+inline int
+streamingRemapping(double & avgCov,
+        Triple<CharString> & fastqFiles,
+        Triple<CharString> const & filteredFiles,
+        CharString & matesBam,
+        CharString const & mappingBam,
+        CharString const & referenceFile,
+        CharString const & workingDir,
+        unsigned humanSeqs,
+        unsigned threads,
+        CharString & memory,
+        CharString & prefix,
+        TAdapterTag tag)
+{
+    unsigned long memoryBytes = 0;
+    if (parseMemory(memoryBytes, memory) != 0)
         return 1;
-    }
 
-    msg.str("");
-    msg << "Indexing " << remappedBam << " using " << SAMTOOLS;
-    printStatus(msg);
+    CharString f1 = prefix;
+    f1 += "remapped.bam";
+    CharString remappedBam = getFileName(workingDir, f1);
 
-    // Index bam file.
-    cmd.str("");
-    cmd << SAMTOOLS << " index " << remappedBam;
-    if (system(cmd.str().c_str()) != 0)
+    // The paired file name is only used for temporary files of the reads waiting for their other read end.
+    CharString f3 = prefix;
+    f3 += "cropped.paired.fastq";
+    CharString f4 = prefix;
+    f4 += "cropped.single.fastq";
+    Triple<CharString> croppedFiles(getFileName(workingDir, f3), "", getFileName(workingDir, f4));
+
+    // Bwa reads the pipe as /dev/fd/<read end>; the write end is not inherited by bwa.
+    int fds[2];
+    if (pipe(fds) != 0 || fcntl(fds[1], F_SETFD, FD_CLOEXEC) != 0)
     {
-        std::cerr << "ERROR while indexing BWA output " << remappedBam << std::endl;
+        std::cerr << "ERROR: Could not create a pipe for remapping." << std::endl;
         return 1;
     }
 
-    msg.str("");
-    msg << "Cropping unmapped reads from " << remappedBam;
-    printStatus(msg);
+    // A failing bwa must not terminate the cropping threads while they write to the pipe.
+    signal(SIGPIPE, SIG_IGN);
 
-    // Crop unmapped and create bam file of remapping.
-    if (crop_unmapped(fastqFiles, remappedUnsortedBam, remappedBam, humanSeqs, NoAdapters()) != 0)
-        return 1;
-    remove(toCString(remappedBai));
+    int cropResult = 0;
+    std::thread cropper([&]() {
+        SharedFastqOut pairedOut(fds[1]);
+        cropResult = crop_unmapped(avgCov, croppedFiles, matesBam, mappingBam, humanSeqs, threads, memoryBytes, tag, &pairedOut);
+    });
 
-    msg.str("");
-    msg << "Sorting " << remappedUnsortedBam << " by read name using " << SAMTOOLS;
-    printStatus(msg);
+    // Run BWA on the interleaved read pairs, followed by the single end reads without a second header.
+    std::stringstream cmd;
+    cmd << "{ " << BWA << " mem -p -t " << threads << " " << referenceFile << " /dev/fd/" << fds[0]
+        << " && " << BWA << " mem -t " << threads << " " << referenceFile << " " << croppedFiles.i3 << " | awk '$1 !~ /^@/'; }";
+    int remapResult = crop_remapped(fastqFiles, remappedBam, cmd.str(), humanSeqs, memoryBytes, fds[0], &filteredFiles);
 
-    // Sort <WD>/remapped.bam by read name.
-    cmd.str("");
-    cmd << SAMTOOLS << " sort -n -@ " << threads << " -m " << memory << " -o " << remappedBam << " " << remappedUnsortedBam << " ";
-    if (system(cmd.str().c_str()) != 0)
-    {
-        std::cerr << "ERROR while sorting " << remappedUnsortedBam << std::endl;
+    cropper.join();
+    remove(toCString(croppedFiles.i3));
+    if (cropResult != 0 || remapResult != 0)
         return 1;
-    }
-
-    remove(toCString(remappedUnsortedBam));
 
     return 0;
 }
@@ -222,220 +233,303 @@ setMates(BamAlignmentRecord & record1, BamAlignmentRecord & record2)
 
 // ==========================================================================
 
-// Correct the reference ids of a BamAlignmentRecord for the concatenated header.
-template<typename TNameStore>
 inline void
-readRecordAndCorrectRIds(BamAlignmentRecord & record,
-        BamFileIn & stream,
-        NameStoreCache<TNameStore> & nameStoreCache)
+mergeHeaders(BamHeader & header,
+        FormattedFileContext<BamFileOut, Owner<> >::Type & context,
+        std::vector<std::unique_ptr<BamFileIn> > & streams)
 {
-    readRecord(record, stream);
-
-    if (record.rID != BamAlignmentRecord::INVALID_REFID)
-    {
-        CharString rName = contigNames(context(stream))[record.rID];
-        getIdByName(record.rID, nameStoreCache, rName);
-    }
-    if (record.rNextId != BamAlignmentRecord::INVALID_REFID)
+    // Read and append the headers. Remove duplicate entries.
+    readHeader(header, *streams[0]);
+    for (unsigned s = 1; s < streams.size(); ++s)
     {
-        CharString rNextName = contigNames(context(stream))[record.rNextId];
-        getIdByName(record.rNextId, nameStoreCache, rNextName);
+        BamHeader header2;
+        readHeader(header2, *streams[s]);
+        for (unsigned i = 0; i < length(header2); ++i)
+        {
+            if (header2[i].type != BAM_HEADER_FIRST)
+                appendValue(header, header2[i]);
+        }
     }
+    std::stable_sort(begin(header, Standard()), end(header, Standard()), BamHeaderRecordTypeLess());
+
+    // Fill sequence names into nameStoreCache.
+    setContigsFromHeader(context, header);
 }
 
+// ==========================================================================
+// struct MergeInput
 // ==========================================================================
 
+// A name-sorted input of merge_and_set_mate() with its current record, the sort key of the record's name and
+// the reference ids of the merged header for the input's reference ids.
+
+struct MergeInput
+{
+    std::unique_ptr<BamFileIn> stream;
+    BamAlignmentRecord record;
+    std::string key;
+    std::vector<int> rIdMap;
+    bool done;
+
+    MergeInput() : done(false)
+    {}
+};
+
+// --------------------------------------------------------------------------
+// Function _mapContigIds()
+// --------------------------------------------------------------------------
+
+template<typename TContext>
 inline void
-mergeHeaders(BamHeader & header,
-        FormattedFileContext<BamFileOut, Owner<> >::Type & context,
-        BamFileIn & stream1,
-        BamFileIn & stream2)
+_mapContigIds(MergeInput & input, TContext & context)
 {
-    StringSet<CharString> contigNames;
-    NameStoreCache<StringSet<CharString> > nameStoreCache;
-    String<int32_t> contigLengths;
-
-    // Read and append the two headers. Remove duplicate entries.
-    readHeader(header, stream1);
-    BamHeader header2;
-    readHeader(header2, stream2);
-    for (unsigned i = 0; i < length(header2); ++i)
+    StringSet<CharString> const & names = contigNames(seqan::context(*input.stream));
+    input.rIdMap.resize(length(names));
+    for (unsigned i = 0; i < length(names); ++i)
     {
-        if (header2[i].type != BAM_HEADER_FIRST)
-            appendValue(header, header2[i]);
+        int id = BamAlignmentRecord::INVALID_REFID;
+        getIdByName(id, contigNamesCache(context), names[i]);
+        input.rIdMap[i] = id;
     }
-    std::stable_sort(begin(header, Standard()), end(header, Standard()), BamHeaderRecordTypeLess());
+}
 
-    // Fill sequence names into nameStoreCache.
-    for (unsigned i = 0; i < length(header); ++i)
+// --------------------------------------------------------------------------
+// Function _advance()
+// --------------------------------------------------------------------------
+
+// Reads the next record of an input, corrects its reference ids for the merged header and computes its key.
+inline void
+_advance(MergeInput & input)
+{
+    if (atEnd(*input.stream))
     {
-        if (header[i].type == BAM_HEADER_REFERENCE)
-        {
-            CharString name, len;
-            for (unsigned j = 0; j < length(header[i].tags); ++j)
-            {
-                if (header[i].tags[j].i1 == "SN")
-                    name = header[i].tags[j].i2;
-                else if (header[i].tags[j].i1 == "LN")
-                    len = header[i].tags[j].i2;
-            }
-            appendName(context._contigNamesCache, name);
-            int32_t l;
-            lexicalCast<int32_t>(l, len);
-            appendValue(context._contigLengths, l);
-        }
+        input.done = true;
+        return;
     }
+
+    readRecord(input.record, *input.stream);
+    if (input.record.rID != BamAlignmentRecord::INVALID_REFID)
+        input.record.rID = input.rIdMap[input.record.rID];
+    if (input.record.rNextId != BamAlignmentRecord::INVALID_REFID)
+        input.record.rNextId = input.rIdMap[input.record.rNextId];
+    nameSortKey(input.key, input.record.qName);
 }
 
-// ==========================================================================
+// --------------------------------------------------------------------------
+// Function _takeRecord()
+// --------------------------------------------------------------------------
 
-// This function is adapted from samtools code (fuction strnum_cmp in bam_sort.c) to ensure the exact same sort order.
-int
-compare_qName(CharString & nameA, CharString & nameB)
+// Appends the current record of an input to a group. The records of the group are reused for the next read
+// name, so that assigning the record does not allocate memory.
+inline void
+_takeRecord(std::vector<BamAlignmentRecord> & group, unsigned & groupSize, MergeInput & input)
 {
-    const char * _a = toCString(nameA);
-    const char * _b = toCString(nameB);
-    const unsigned char *a = (const unsigned char*)_a, *b = (const unsigned char*)_b;
-    const unsigned char *pa = a, *pb = b;
-    while (*pa && *pb) {
-        if (isdigit(*pa) && isdigit(*pb)) {
-            while (*pa == '0') ++pa;
-            while (*pb == '0') ++pb;
-            while (isdigit(*pa) && isdigit(*pb) && *pa == *pb) ++pa, ++pb;
-            if (isdigit(*pa) && isdigit(*pb)) {
-                int i = 0;
-                while (isdigit(pa[i]) && isdigit(pb[i])) ++i;
-                return isdigit(pa[i])? 1 : isdigit(pb[i])? -1 : (int)*pa - (int)*pb;
-            } else if (isdigit(*pa)) return 1;
-            else if (isdigit(*pb)) return -1;
-            else if (pa - a != pb - b) return pa - a < pb - b? 1 : -1;
-        } else {
-            if (*pa != *pb) return (int)*pa - (int)*pb;
-            ++pa; ++pb;
-        }
-    }
-    return *pa? 1 : *pb? -1 : 0;
+    if (groupSize == group.size())
+        group.resize(groupSize + 1);
+    group[groupSize++] = input.record;
 }
 
 // ==========================================================================
 // Function merge_and_set_mate()
 // ==========================================================================
 
-bool
-merge_and_set_mate(CharString & mergedBam, CharString & nonRefBam, CharString & remappedBam)
+// Merges BAM files sorted by read name into one BAM file sorted by read name, or by coordinate if a memory for
+// sorting is given. The records of the first file are paired with the records of the same name in the other files
+// and their mate fields are set. The name of each record is converted once into a sort key, the inputs are merged
+// with a heap on these keys, and the output is compressed on the given number of threads.
+inline bool
+merge_and_set_mate(CharString & mergedBam,
+        std::vector<CharString> const & inputBams,
+        unsigned threads,
+        unsigned long sortMemory = 0)
 {
     std::ostringstream msg;
-    msg << "Merging bam files " << nonRefBam << " and " << remappedBam;
+    msg << "Merging bam files";
+    for (unsigned i = 0; i < inputBams.size(); ++i)
+        msg << (i == 0 ? " " : (i + 1 == inputBams.size() ? " and " : ", ")) << inputBams[i];
     printStatus(msg);
 
-    // Open the two input streams (can read SAM and BAM files).
-    BamFileIn nonRefStream(toCString(nonRefBam));
-    BamFileIn remappedStream(toCString(remappedBam));
+    // Open the input streams (can read SAM and BAM files).
+    std::vector<MergeInput> inputs(inputBams.size());
+    std::vector<std::unique_ptr<BamFileIn> > streams;
+    for (unsigned i = 0; i < inputBams.size(); ++i)
+    {
+        streams.push_back(std::unique_ptr<BamFileIn>(new BamFileIn()));
+        if (!open(*streams[i], toCString(inputBams[i])))
+        {
+            std::cerr << "ERROR: Could not open " << inputBams[i] << std::endl;
+            return 1;
+        }
+    }
 
     printStatus(" - merging headers...");
 
     // Prepare a header for the output file.
     BamHeader outHeader;
     FormattedFileContext<BamFileOut, Owner<> >::Type context;
-    mergeHeaders(outHeader, context, nonRefStream, remappedStream);
+    mergeHeaders(outHeader, context, streams);
 
     printStatus(" - writing header...");
 
-    // Open the output stream and write the header.
-    FormattedFileContext<BamFileOut, Dependent<> >::Type contextDep(context);
-    BamFileOut outStream(contextDep, toCString(mergedBam));
-    writeHeader(outStream, outHeader);
+    // Open the output stream and write the header, or pass the records to the sorter.
+    BgzfFileOut outStream;
+    BamSorter sorter;
+    if (sortMemory != 0)
+    {
+        initSorter(sorter, mergedBam, outHeader, BAM_SORT_COORDINATE, threads, sortMemory);
+    }
+    else
+    {
+        if (!open(outStream, mergedBam, threads))
+        {
+            std::cerr << "ERROR: Could not open " << mergedBam << " for writing." << std::endl;
+            return 1;
+        }
+        writeBamHeader(outStream, outHeader, context);
+    }
+    auto writeMerged = [&](BamAlignmentRecord const & record) {
+        if (sortMemory != 0)
+            return appendRecord(sorter, record);
+        writeBamRecord(outStream, record, context);
+        return false;
+    };
 
     printStatus(" - merging read records...");
 
-    // Read the first record from each input file. Correct ids in records from remappedStreams for new header.
-    BamAlignmentRecord record1, record2;
-    if (!atEnd(nonRefStream)) readRecordAndCorrectRIds(record1, nonRefStream, contigNamesCache(contextDep));
-    else record1.qName = "*";
-    if (!atEnd(remappedStream)) readRecordAndCorrectRIds(record2, remappedStream, contigNamesCache(contextDep));
-    else record2.qName = "*";
+    // Read the first record from each input file. The heap holds the inputs that are not done, ordered by the key
+    // of their current record and, for equal keys, by input.
+    auto greater = [&](unsigned a, unsigned b) {
+        int c = inputs[a].key.compare(inputs[b].key);
+        return c > 0 || (c == 0 && a > b);
+    };
+    std::vector<unsigned> heap;
+    for (unsigned i = 0; i < inputs.size(); ++i)
+    {
+        inputs[i].stream = std::move(streams[i]);
+        _mapContigIds(inputs[i], context);
+        _advance(inputs[i]);
+        if (!inputs[i].done)
+            heap.push_back(i);
+    }
+    std::make_heap(heap.begin(), heap.end(), greater);
 
-    // Iterate both input files, set mate positions in pairs, and write all records to the output file.
-    while (record1.qName != "*" || record2.qName != "*")
+    // Collect all records of the next read name, set mate positions in pairs, and write them to the output file.
+    std::vector<BamAlignmentRecord> firstRecords, otherRecords;
+    std::string key;
+    while (!heap.empty())
     {
-        while ((compare_qName(record2.qName, record1.qName) < 0 || record1.qName == "*") && record2.qName != "*")
+        key = inputs[heap.front()].key;
+        unsigned numFirst = 0, numOther = 0;
+        while (!heap.empty() && inputs[heap.front()].key == key)
         {
-            writeRecord(outStream, record2);
-            if (!atEnd(remappedStream)) readRecordAndCorrectRIds(record2, remappedStream, contigNamesCache(contextDep));
-            else record2.qName = "*";
-        }
+            std::pop_heap(heap.begin(), heap.end(), greater);
+            unsigned i = heap.back();
+            heap.pop_back();
 
-        bool incr1 = false;
-        while (record1.qName == record2.qName && record2.qName != "*")
-        {
-            incr1 = true;
-            setMates(record1, record2);
-            writeRecord(outStream, record1);
-            writeRecord(outStream, record2);
-            if (!atEnd(remappedStream)) readRecordAndCorrectRIds(record2, remappedStream, contigNamesCache(contextDep));
-            else record2.qName = "*";
-        }
-        if (incr1)
-        {
-            if (!atEnd(nonRefStream)) readRecordAndCorrectRIds(record1, nonRefStream, contigNamesCache(contextDep));
-            else record1.qName = "*";
+            do
+            {
+                if (i == 0)
+                    _takeRecord(firstRecords, numFirst, inputs[i]);
+                else
+                    _takeRecord(otherRecords, numOther, inputs[i]);
+                _advance(inputs[i]);
+            }
+            while (!inputs[i].done && inputs[i].key == key);
+
+            if (!inputs[i].done)
+            {
+                heap.push_back(i);
+                std::push_heap(heap.begin(), heap.end(), greater);
+            }
         }
 
-        while ((compare_qName(record1.qName, record2.qName) < 0 || record2.qName == "*") && record1.qName != "*")
+        bool failed = false;
+        unsigned firstBegin = 0;
+        if (numFirst != 0 && numOther != 0)
         {
-            writeRecord(outStream, record1);
-            if (!atEnd(nonRefStream)) readRecordAndCorrectRIds(record1, nonRefStream, contigNamesCache(contextDep));
-            else record1.qName = "*";
+            for (unsigned j = 0; j < numOther; ++j)
+            {
+                setMates(firstRecords[0], otherRecords[j]);
+                failed |= writeMerged(firstRecords[0]);
+                failed |= writeMerged(otherRecords[j]);
+            }
+            firstBegin = 1;
+            numOther = 0;
         }
+        for (unsigned j = firstBegin; j < numFirst; ++j)
+            failed |= writeMerged(firstRecords[j]);
+        for (unsigned j = 0; j < numOther; ++j)
+            failed |= writeMerged(otherRecords[j]);
+        if (failed)
+            return 1;
+    }
+
+    if (sortMemory != 0)
+        return finishSorting(sorter);
+
+    if (!close(outStream))
+    {
+        std::cerr << "ERROR: Could not write " << mergedBam << std::endl;
+        return 1;
     }
 
     return 0;
 }
 
+inline bool
+merge_and_set_mate(CharString & mergedBam,
+        CharString & nonRefBam,
+        CharString & remappedBam,
+        unsigned threads,
+        unsigned long sortMemory = 0)
+{
+    std::vector<CharString> inputBams;
+    inputBams.push_back(nonRefBam);
+    inputBams.push_back(remappedBam);
+    return merge_and_set_mate(mergedBam, inputBams, threads, sortMemory);
+}
+
 // ==========================================================================
-// Function sickle_filtering()
+// Function quality_trimming()
 // ==========================================================================
 
+// Quality trims the reads of existing fastq files. The cropping writes the trimmed reads itself, so this is only
+// needed if the cropping step is skipped.
 inline bool
-sickle_filtering(Triple<CharString> & filteredFiles,
-        Triple<CharString> & fastqFiles,
-        CharString & workingDirectory)
+quality_trimming(Triple<CharString> & filteredFiles, Triple<CharString> & fastqFiles)
 {
-    std::stringstream cmd;
-
     std::ostringstream msg;
-    msg << "Filtering fastq files using " << SICKLE ;
+    msg << "Quality trimming reads from " << fastqFiles.i1 << ", " << fastqFiles.i2 << ", " << fastqFiles.i3;
     printStatus(msg);
 
-    cmd.str("");
-    cmd << SICKLE << " pe -q 20 -l 60 -x -n -t sanger -f" << fastqFiles.i1 << " -r " << fastqFiles.i2;
-    cmd << " -o " << filteredFiles.i1 << " -p " << filteredFiles.i2 << " -s " << filteredFiles.i3;
-    if (system(cmd.str().c_str()) != 0) // runs sickle on paired end reads
+    SeqFileIn firstStream, secondStream, singleStream;
+    if (!open(firstStream, toCString(fastqFiles.i1)) || !open(secondStream, toCString(fastqFiles.i2)) ||
+            !open(singleStream, toCString(fastqFiles.i3)))
     {
-        std::cerr << "ERROR while filtering " << fastqFiles.i1 << " and " << fastqFiles.i2;
-        std::cerr << " using " << SICKLE << std::endl;
+        std::cerr << "ERROR: Could not open " << fastqFiles.i1 << ", " << fastqFiles.i2 << " and " << fastqFiles.i3 << std::endl;
         return 1;
     }
 
-    CharString singleFiltered2 = getFileName(workingDirectory, "filtered.single2.fastq");
+    TrimmedFastqOut<SeqFileOut> out(filteredFiles);
 
-    cmd.str("");
-    cmd << SICKLE << " se -q 20 -l 60 -x -n -t sanger -f " << fastqFiles.i3 << " -o " << singleFiltered2;
-    if (system(cmd.str().c_str()) != 0) // runs sickle on single end reads
+    std::string name, mateName, seq, mateSeq, qual, mateQual;
+    while (!atEnd(firstStream) && !atEnd(secondStream))
     {
-        std::cerr << "ERROR while filtering " << fastqFiles.i3 << " using " << SICKLE << std::endl;
-        return 1;
+        readRecord(name, seq, qual, firstStream);
+        readRecord(mateName, mateSeq, mateQual, secondStream);
+        writeTrimmedPair(out, name, seq, qual, mateSeq, mateQual);
     }
-
-    cmd.str("");
-    cmd << "cat " << singleFiltered2 << " >> " << filteredFiles.i3;
-    if (system(cmd.str().c_str()) != 0) // merges the fastq files of single end reads.
+    if (!atEnd(firstStream) || !atEnd(secondStream))
     {
-        std::cerr << "ERROR while concatenating " << singleFiltered2 << " to " << filteredFiles.i3 << std::endl;
+        std::cerr << "ERROR: Different number of reads in " << fastqFiles.i1 << " and " << fastqFiles.i2 << std::endl;
         return 1;
     }
 
-    remove(toCString(singleFiltered2));
+    while (!atEnd(singleStream))
+    {
+        readRecord(name, seq, qual, singleStream);
+        writeTrimmedSingle(out, name, seq, qual);
+    }
 
     return 0;
 }
@@ -489,6 +583,90 @@ velvet_assembly(Triple<CharString> & filteredFiles, Triple<CharString> & filtere
     return 0;
 }
 
+// ==========================================================================
+// Function velvet_multik_assembly()
+// ==========================================================================
+
+// Assembles the filtered reads with velvet once per k-mer length and writes the deduplicated contigs of all
+// assemblies to contigFile.
+inline bool
+velvet_multik_assembly(Triple<CharString> & filteredFiles,
+        Triple<CharString> & filteredMPFiles,
+        CharString const & workingDirectory,
+        CharString & contigFile,
+        std::vector<unsigned> const & kmerLengths,
+        bool matepair)
+{
+    std::vector<std::string> contigs;
+    for (unsigned i = 0; i < kmerLengths.size(); ++i)
+    {
+        std::ostringstream dirName;
+        dirName << "assembly_k" << kmerLengths[i];
+        CharString assemblyDirectory = getFileName(workingDirectory, CharString(dirName.str()));
+
+        if (velvet_assembly(filteredFiles, filteredMPFiles, assemblyDirectory, kmerLengths[i], matepair) != 0)
+            return 1;
+        if (readContigs(contigs, getFileName(assemblyDirectory, "contigs.fa")) != 0)
+            return 1;
+        removeAssemblyDirectory(assemblyDirectory);
+    }
+
+    size_t numRemoved = deduplicateContigs(contigs);
+    if (writeContigs(contigs, contigFile) != 0)
+        return 1;
+
+    std::ostringstream msg;
+    msg << "Removed " << numRemoved << " duplicate contigs, " << contigs.size() << " contigs written to " << contigFile;
+    printStatus(msg);
+
+    return 0;
+}
+
+// ==========================================================================
+// Function native_assembly()
+// ==========================================================================
+
+// Assembles the filtered reads with the built-in de Bruijn graph assembler and writes the contigs to contigFile.
+// With several k-mer lengths, the reads are loaded once and assembled iteratively with increasing k. The matepair
+// reads are only used to build the graph.
+inline bool
+native_assembly(Triple<CharString> & filteredFiles,
+        Triple<CharString> & filteredMPFiles,
+        CharString & contigFile,
+        std::vector<unsigned> const & kmerLengths,
+        unsigned threads,
+        bool matepair)
+{
+    std::ostringstream msg;
+    msg << "Assembling unmapped reads from filtered fastq files using the native assembler";
+    printStatus(msg);
+
+    AssemblyReads reads;
+    if (loadAssemblyReads(reads, filteredFiles) != 0)
+        return 1;
+    if (matepair)
+    {
+        AssemblyReads matepairReads;
+        if (loadAssemblyReads(matepairReads, filteredMPFiles) != 0)
+            return 1;
+        reads.seqs.insert(reads.seqs.end(), matepairReads.seqs.begin(), matepairReads.seqs.end());
+    }
+
+    NativeAssemblyOptions assemblyOptions;
+    assemblyOptions.threads = threads;
+
+    std::vector<std::string> contigs;
+    assembleReadsMultiK(contigs, reads, kmerLengths, assemblyOptions);
+    if (writeContigs(contigs, contigFile) != 0)
+        return 1;
+
+    msg.str("");
+    msg << contigs.size() << " contigs written to " << contigFile;
+    printStatus(msg);
+
+    return 0;
+}
+
 // ==========================================================================
 // Function popins_assemble()
 // ==========================================================================
@@ -503,6 +681,11 @@ int popins_assemble(int argc, char const ** argv)
     if (res != ArgumentParser::PARSE_OK)
         return res;
 
+    // Memory for the reads waiting for their other read end per cropping thread.
+    unsigned long memory = 0;
+    if (parseMemory(memory, options.memory) != 0)
+        return 7;
+
     // Retrieve the sample ID from the first read group listed in BAM file header.
     if (options.sampleID == "" && retrieveSampleID(options.sampleID, options.mappingFile) == 1)
         return 7;
@@ -518,37 +701,72 @@ int popins_assemble(int argc, char const ** argv)
 
     SampleInfo info = initSampleInfo(options.mappingFile, options.sampleID, options.adapters);
 
-    CharString matesBam = getFileName(workingDirectory, "mates.bam");
     CharString nonRefBamTemp = getFileName(workingDirectory, "non_ref_tmp.bam");
     CharString nonRefBam = getFileName(workingDirectory, "non_ref.bam");
 
+    // The mates are written sorted by read name while cropping.
+    CharString matesBam = (options.referenceFile != "") ? nonRefBamTemp : nonRefBam;
+
     CharString fastqFirst = getFileName(workingDirectory, "paired.1.fastq");
     CharString fastqSecond = getFileName(workingDirectory, "paired.2.fastq");
     CharString fastqSingle = getFileName(workingDirectory, "single.fastq");
     Triple<CharString> fastqFiles = Triple<CharString>(fastqFirst, fastqSecond, fastqSingle);
 
+    CharString firstFiltered = getFileName(workingDirectory, "filtered.paired.1.fastq");
+    CharString secondFiltered = getFileName(workingDirectory, "filtered.paired.2.fastq");
+    CharString singleFiltered = getFileName(workingDirectory, "filtered.single.fastq");
+    Triple<CharString> filteredFiles(firstFiltered, secondFiltered, singleFiltered);
+
     // check if files already exits
     std::fstream stream(toCString(fastqFirst));
     if (!stream.is_open())
     {
+        // The last cropping pass also writes the quality trimmed reads.
+        Triple<CharString> const * trimmedFiles = (options.referenceFile == "") ? &filteredFiles : NULL;
+
         msg.str("");
         msg << "Cropping unmapped reads from " << options.mappingFile;
+        if (options.streaming)
+            msg << " and remapping them using " << BWA;
         printStatus(msg);
 
         // Crop unmapped reads and reads with unreliable mappings from the input bam file.
-        if (options.adapters == "HiSeqX")
+        CharString prefix = "";
+        if (options.streaming)
         {
-            if (crop_unmapped(info.avg_cov, fastqFiles, matesBam, options.mappingFile, options.humanSeqs, HiSeqXAdapters()) != 0)
+            // Remap the cropped reads while cropping; the reads that remain unmapped are written to the fastq files.
+            if (options.adapters == "HiSeqX")
+            {
+                if (streamingRemapping(info.avg_cov, fastqFiles, filteredFiles, matesBam, options.mappingFile, options.referenceFile, workingDirectory,
+                        options.humanSeqs, options.threads, options.memory, prefix, HiSeqXAdapters()) != 0)
+                    return 7;
+            }
+            else if (options.adapters == "HiSeq")
+            {
+                if (streamingRemapping(info.avg_cov, fastqFiles, filteredFiles, matesBam, options.mappingFile, options.referenceFile, workingDirectory,
+                        options.humanSeqs, options.threads, options.memory, prefix, HiSeqAdapters()) != 0)
+                    return 7;
+            }
+            else
+            {
+                if (streamingRemapping(info.avg_cov, fastqFiles, filteredFiles, matesBam, options.mappingFile, options.referenceFile, workingDirectory,
+                        options.humanSeqs, options.threads, options.memory, prefix, NoAdapters()) != 0)
+                    return 7;
+            }
+        }
+        else if (options.adapters == "HiSeqX")
+        {
+            if (crop_unmapped(info.avg_cov, fastqFiles, matesBam, options.mappingFile, options.humanSeqs, options.threads, memory, HiSeqXAdapters(), NULL, trimmedFiles) != 0)
                 return 7;
         }
         else if (options.adapters == "HiSeq")
         {
-            if (crop_unmapped(info.avg_cov, fastqFiles, matesBam, options.mappingFile, options.humanSeqs, HiSeqAdapters()) != 0)
+            if (crop_unmapped(info.avg_cov, fastqFiles, matesBam, options.mappingFile, options.humanSeqs, options.threads, memory, HiSeqAdapters(), NULL, trimmedFiles) != 0)
                 return 7;
         }
         else
         {
-            if (crop_unmapped(info.avg_cov, fastqFiles, matesBam, options.mappingFile, options.humanSeqs, NoAdapters()) != 0)
+            if (crop_unmapped(info.avg_cov, fastqFiles, matesBam, options.mappingFile, options.humanSeqs, options.threads, memory, NoAdapters(), NULL, trimmedFiles) != 0)
                 return 7;
         }
 
@@ -559,39 +777,23 @@ int popins_assemble(int argc, char const ** argv)
         msg << "Sample info written to \'" << sampleInfoFile << "\'.";
         printStatus(msg);
 
-        msg.str("");
-        msg << "Sorting " << matesBam << " using " << SAMTOOLS;
-        printStatus(msg);
-
-        // Sort <WD>/mates.bam by read name.
-        std::stringstream cmd;
-        if (options.referenceFile != "")
-            cmd << SAMTOOLS << " sort -n -@ " << options.threads << " -m " << options.memory << " -o " << nonRefBamTemp << " " << matesBam;
-        else
-            cmd << SAMTOOLS << " sort -n -@ " << options.threads << " -m " << options.memory << " -o " << nonRefBam << " " << matesBam;
-        if (system(cmd.str().c_str()) != 0)
-        {
-            std::cerr << "ERROR while sorting " << matesBam << std::endl;
-            return 7;
-        }
-
-        remove(toCString(matesBam));
-
         // Remapping of unmapped with bwa if a fasta reference is given.
         if (options.referenceFile != "")
         {
-            Triple<CharString> fastqFilesTemp = fastqFiles;
-            fastqFiles = Triple<CharString>(fastqFirst, fastqSecond, fastqSingle);
-
-            // Align with bwa, update fastq files of unaligned reads, and sort remaining bam records by read name.
             CharString remappedBam = getFileName(workingDirectory, "remapped.bam");
-            CharString prefix = "";
-            if (remapping(fastqFilesTemp, fastqFiles, options.referenceFile, workingDirectory,
-                    options.humanSeqs, options.threads, options.memory, prefix) != 0)
-                return 7;
+            if (!options.streaming)
+            {
+                Triple<CharString> fastqFilesTemp = fastqFiles;
+                fastqFiles = Triple<CharString>(fastqFirst, fastqSecond, fastqSingle);
+
+                // Align with bwa, update fastq files of unaligned reads, and sort remaining bam records by read name.
+                if (remapping(fastqFilesTemp, fastqFiles, filteredFiles, options.referenceFile, workingDirectory,
+                        options.humanSeqs, options.threads, options.memory, prefix) != 0)
+                    return 7;
+            }
 
             // Set the mate's location and merge non_ref.bam and remapped.bam into a single file.
-            if (merge_and_set_mate(nonRefBam, nonRefBamTemp, remappedBam) != 0) return 7;
+            if (merge_and_set_mate(nonRefBam, nonRefBamTemp, remappedBam, options.threads) != 0) return 7;
             remove(toCString(remappedBam));
             remove(toCString(nonRefBamTemp));
         }
@@ -599,87 +801,99 @@ int popins_assemble(int argc, char const ** argv)
     else
     {
         printStatus("Found files, skipping cropping step.");
-    }
-
-    CharString firstFiltered = getFileName(workingDirectory, "filtered.paired.1.fastq");
-    CharString secondFiltered = getFileName(workingDirectory, "filtered.paired.2.fastq");
-    CharString singleFiltered = getFileName(workingDirectory, "filtered.single.fastq");
-    Triple<CharString> filteredFiles(firstFiltered, secondFiltered, singleFiltered);
 
-    // Quality filtering/trimming with sickle.
-    if (sickle_filtering(filteredFiles, fastqFiles, workingDirectory) != 0)
-        return 7;
+        if (quality_trimming(filteredFiles, fastqFiles) != 0)
+            return 7;
+    }
 
     // MP handling
-    CharString matesMPBam = getFileName(workingDirectory, "MP.mates.bam");
     CharString nonRefBamMPTemp = getFileName(workingDirectory, "MP.non_ref_tmp.bam");
     CharString nonRefMPBam = getFileName(workingDirectory, "MP.non_ref.bam");
+    CharString matesMPBam = (options.referenceFile != "") ? nonRefBamMPTemp : nonRefMPBam;
 
     CharString fastqMPFirst = getFileName(workingDirectory, "MP.paired.1.fastq");
     CharString fastqMPSecond = getFileName(workingDirectory, "MP.paired.2.fastq");
     CharString fastqMPSingle = getFileName(workingDirectory, "MP.single.fastq");
     Triple<CharString> fastqMPFiles = Triple<CharString>(fastqMPFirst, fastqMPSecond, fastqMPSingle);
 
+    CharString firstMPFiltered = getFileName(workingDirectory, "MP.filtered.paired.1.fastq");
+    CharString secondMPFiltered = getFileName(workingDirectory, "MP.filtered.paired.2.fastq");
+    CharString singleMPFiltered = getFileName(workingDirectory, "MP.filtered.single.fastq");
+    Triple<CharString> filteredMPFiles(firstMPFiltered, secondMPFiltered, singleMPFiltered);
+
     if (options.matepairFile != "")
     {
         // check if MP files already exits
         std::fstream MPstream(toCString(fastqMPFirst));
         if (!MPstream.is_open())
         {
+            // The last cropping pass also writes the quality trimmed reads.
+            Triple<CharString> const * trimmedFiles = (options.referenceFile == "") ? &filteredMPFiles : NULL;
+
             msg.str("");
             msg << "Cropping unmapped matepair reads from " << options.matepairFile;
+            if (options.streaming)
+                msg << " and remapping them using " << BWA;
             printStatus(msg);
 
             // Crop unmapped reads and reads with unreliable mappings from the input bam file.
-            if (options.adapters == "HiSeqX")
+            CharString prefix = "MP.";
+            if (options.streaming)
             {
-                if (crop_unmapped(fastqMPFiles, matesMPBam, options.matepairFile, options.humanSeqs, HiSeqXAdapters()) != 0)
-                    return 7;
+                // Remap the cropped reads while cropping; the reads that remain unmapped are written to the fastq files.
+                double cov;
+                if (options.adapters == "HiSeqX")
+                {
+                    if (streamingRemapping(cov, fastqMPFiles, filteredMPFiles, matesMPBam, options.matepairFile, options.referenceFile, workingDirectory,
+                            options.humanSeqs, options.threads, options.memory, prefix, HiSeqXAdapters()) != 0)
+                        return 7;
+                }
+                else if (options.adapters == "HiSeq")
+                {
+                    if (streamingRemapping(cov, fastqMPFiles, filteredMPFiles, matesMPBam, options.matepairFile, options.referenceFile, workingDirectory,
+                            options.humanSeqs, options.threads, options.memory, prefix, HiSeqAdapters()) != 0)
+                        return 7;
+                }
+                else
+                {
+                    if (streamingRemapping(cov, fastqMPFiles, filteredMPFiles, matesMPBam, options.matepairFile, options.referenceFile, workingDirectory,
+                            options.humanSeqs, options.threads, options.memory, prefix, NoAdapters()) != 0)
+                        return 7;
+                }
             }
-            else if (options.adapters == "HiSeq")
+            else if (options.adapters == "HiSeqX")
             {
-                if (crop_unmapped(fastqMPFiles, matesMPBam, options.matepairFile, options.humanSeqs, HiSeqAdapters()) != 0)
+                if (crop_unmapped(fastqMPFiles, matesMPBam, options.matepairFile, options.humanSeqs, options.threads, memory, HiSeqXAdapters(), NULL, trimmedFiles) != 0)
                     return 7;
             }
-            else
+            else if (options.adapters == "HiSeq")
             {
-                if (crop_unmapped(fastqMPFiles, matesMPBam, options.matepairFile, options.humanSeqs, NoAdapters()) != 0)
+                if (crop_unmapped(fastqMPFiles, matesMPBam, options.matepairFile, options.humanSeqs, options.threads, memory, HiSeqAdapters(), NULL, trimmedFiles) != 0)
                     return 7;
             }
-
-            msg.str("");
-            msg << "Sorting " << matesMPBam << " using " << SAMTOOLS;
-            printStatus(msg);
-
-            // Sort <WD>/mates.bam by read name.
-            std::stringstream cmd;
-            if (options.referenceFile != "")
-                cmd << SAMTOOLS << " sort -n -@ " << options.threads << " -m " << options.memory << " -o " << nonRefBamMPTemp << " " << matesMPBam;
             else
-                cmd << SAMTOOLS << " sort -n -@ " << options.threads << " -m " << options.memory << " -o " << nonRefMPBam << " " << matesMPBam;
-            if (system(cmd.str().c_str()) != 0)
             {
-                std::cerr << "ERROR while sorting " << matesMPBam << std::endl;
-                return 7;
+                if (crop_unmapped(fastqMPFiles, matesMPBam, options.matepairFile, options.humanSeqs, options.threads, memory, NoAdapters(), NULL, trimmedFiles) != 0)
+                    return 7;
             }
 
-            remove(toCString(matesMPBam));
-
             // Remapping of unmapped with bwa if a fasta reference is given.
             if (options.referenceFile != "")
             {
-                Triple<CharString> fastqMPFilesTemp = fastqMPFiles;
-                fastqMPFiles = Triple<CharString>(fastqMPFirst, fastqMPSecond, fastqMPSingle);
-
-                // Align with bwa, update fastq files of unaligned reads, and sort remaining bam records by read name.
                 CharString remappedMPBam = getFileName(workingDirectory, "MP.remapped.bam");
-                CharString prefix = "MP.";
-                if (remapping(fastqMPFilesTemp, fastqMPFiles, options.referenceFile, workingDirectory,
-                        options.humanSeqs, options.threads, options.memory, prefix) != 0)
-                    return 7;
+                if (!options.streaming)
+                {
+                    Triple<CharString> fastqMPFilesTemp = fastqMPFiles;
+                    fastqMPFiles = Triple<CharString>(fastqMPFirst, fastqMPSecond, fastqMPSingle);
+
+                    // Align with bwa, update fastq files of unaligned reads, and sort remaining bam records by read name.
+                    if (remapping(fastqMPFilesTemp, fastqMPFiles, filteredMPFiles, options.referenceFile, workingDirectory,
+                            options.humanSeqs, options.threads, options.memory, prefix) != 0)
+                        return 7;
+                }
 
                 // Set the mate's location and merge non_ref.bam and remapped.bam into a single file.
-                if (merge_and_set_mate(nonRefMPBam, nonRefBamMPTemp, remappedMPBam) != 0)
+                if (merge_and_set_mate(nonRefMPBam, nonRefBamMPTemp, remappedMPBam, options.threads) != 0)
                     return 7;
                 remove(toCString(remappedMPBam));
                 remove(toCString(nonRefBamMPTemp));
@@ -688,26 +902,35 @@ int popins_assemble(int argc, char const ** argv)
         else
         {
             printStatus("Found matepair files, skipping cropping step");
+
+            if (quality_trimming(filteredMPFiles, fastqMPFiles) != 0)
+                return 7;
         }
     }
 
+    // Assembly with velvet or the native assembler.
+    CharString assemblyDirectory = getFileName(workingDirectory, "assembly");
+    CharString contigFile = getFileName(workingDirectory, "contigs.fa");
+    std::vector<unsigned> kmerLengths = options.kmerLengths;
+    if (kmerLengths.empty())
+        kmerLengths.push_back(options.kmerLength);
 
-    CharString firstMPFiltered = getFileName(workingDirectory, "MP.filtered.paired.1.fastq");
-    CharString secondMPFiltered = getFileName(workingDirectory, "MP.filtered.paired.2.fastq");
-    CharString singleMPFiltered = getFileName(workingDirectory, "MP.filtered.single.fastq");
-
-    Triple<CharString> filteredMPFiles(firstMPFiltered, secondMPFiltered, singleMPFiltered);
-
-    if (options.matepairFile != "")
+    if (options.assembler == "native")
     {
-        if (sickle_filtering(filteredMPFiles,fastqMPFiles, workingDirectory) != 0)
+        if (native_assembly(filteredFiles, filteredMPFiles, contigFile, kmerLengths, options.threads,
+                options.matepairFile != "") != 0)
             return 7;
     }
-
-    // Assembly with velvet.
-    CharString assemblyDirectory = getFileName(workingDirectory, "assembly");
-    if (velvet_assembly(filteredFiles, filteredMPFiles, assemblyDirectory, options.kmerLength, options.matepairFile != "") != 0)
+    else if (kmerLengths.size() > 1)
+    {
+        if (velvet_multik_assembly(filteredFiles, filteredMPFiles, workingDirectory, contigFile, kmerLengths,
+                options.matepairFile != "") != 0)
+            return 7;
+    }
+    else if (velvet_assembly(filteredFiles, filteredMPFiles, assemblyDirectory, kmerLengths[0], options.matepairFile != "") != 0)
+    {
         return 7;
+    }
 
     remove(toCString(firstFiltered));
     remove(toCString(secondFiltered));
@@ -721,14 +944,16 @@ int popins_assemble(int argc, char const ** argv)
     }
 
     // Copy contigs file to workingDirectory and remove assembly directory.
-    CharString contigFileAssembly = getFileName(assemblyDirectory, "contigs.fa");
-    CharString contigFile = getFileName(workingDirectory, "contigs.fa");
-    std::ifstream src(toCString(contigFileAssembly), std::ios::binary);
-    std::ofstream dst(toCString(contigFile), std::ios::binary);
-    dst << src.rdbuf();
-    src.close();
-    dst.close();
-    removeAssemblyDirectory(assemblyDirectory);
+    if (options.assembler != "native" && kmerLengths.size() == 1)
+    {
+        CharString contigFileAssembly = getFileName(assemblyDirectory, "contigs.fa");
+        std::ifstream src(toCString(contigFileAssembly), std::ios::binary);
+        std::ofstream dst(toCString(contigFile), std::ios::binary);
+        dst << src.rdbuf();
+        src.close();
+        dst.close();
+        removeAssemblyDirectory(assemblyDirectory);
+    }
 
     return res;
 }
@@ -0,0 +1,172 @@
+#ifndef POPINS_QUALITY_TRIMMING_H_
+#define POPINS_QUALITY_TRIMMING_H_
+
+#include <string>
+
+#include <seqan/basic.h>
+#include <seqan/sequence.h>
+
+using namespace seqan;
+
+// Quality threshold and minimum read length of the quality trimming, as with 'sickle pe/se -q 20 -l 60'.
+#ifndef TRIM_QUALITY_THRESHOLD
+#define TRIM_QUALITY_THRESHOLD 20
+#endif
+#ifndef TRIM_MIN_LENGTH
+#define TRIM_MIN_LENGTH 60
+#endif
+
+// --------------------------------------------------------------------------
+// Function qualityTrimmedLength()
+// --------------------------------------------------------------------------
+
+// Returns the length of a read after trimming its 3' end with sickle's sliding window, or 0 if the read is
+// discarded. The read is given in sequencing orientation with sanger qualities. As with sickle's options
+// -x -n, the 5' end is not trimmed and the read is truncated before its first N.
+//
+// The window covers 10% of the read length. The read is cut at the first base below the quality threshold in
+// the first window with an average quality below the threshold. The sums are compared on the raw quality
+// characters, so that no per-base offset subtraction is needed.
+inline size_t
+qualityTrimmedLength(std::string const & seq, std::string const & qual, unsigned qualThresh, unsigned minLength)
+{
+    size_t len = qual.size();
+    if (len < minLength || len == 0)
+        return 0;
+
+    unsigned char const * q = reinterpret_cast<unsigned char const *>(qual.data());
+    unsigned const rawThresh = qualThresh + 33;
+
+    size_t windowSize = len / 10;
+    if (windowSize == 0)
+        windowSize = len;
+    size_t const windowThresh = rawThresh * windowSize;
+
+    size_t windowQual = 0;
+    for (size_t i = 0; i < windowSize; ++i)
+        windowQual += q[i];
+
+    size_t cut = len;
+    for (size_t windowBegin = 0; windowBegin + windowSize <= len; ++windowBegin)
+    {
+        if (windowQual < windowThresh)
+        {
+            // Cut at the first base in the window below the threshold.
+            size_t j = windowBegin;
+            while (q[j] >= rawThresh)
+                ++j;
+            cut = j;
+            break;
+        }
+
+        windowQual -= q[windowBegin];
+        if (windowBegin + windowSize < len)
+            windowQual += q[windowBegin + windowSize];
+    }
+
+    // Truncate before the first N.
+    size_t n = seq.find_first_of("Nn");
+    if (n < cut)
+        cut = n;
+
+    if (cut < minLength)
+        return 0;
+    return cut;
+}
+
+// ============================================================================
+// struct TrimmedFastqOut
+// ============================================================================
+
+// Fastq output of the quality trimmed reads, written alongside the untrimmed fastq files. As with sickle pe and
+// se, read pairs of which both ends pass the trimming are written to the paired streams and the read ends that
+// remain alone to the single stream.
+
+template<typename TStream>
+struct TrimmedFastqOut
+{
+    TStream firstStream;
+    TStream secondStream;
+    TStream singleStream;
+
+    unsigned qualThresh;
+    unsigned minLength;
+
+    std::string seq;
+    std::string qual;
+
+    TrimmedFastqOut(Triple<CharString> const & trimmedFiles) :
+        firstStream(toCString(trimmedFiles.i1)),
+        secondStream(toCString(trimmedFiles.i2)),
+        singleStream(toCString(trimmedFiles.i3)),
+        qualThresh(TRIM_QUALITY_THRESHOLD),
+        minLength(TRIM_MIN_LENGTH)
+    {}
+};
+
+// --------------------------------------------------------------------------
+// Function _writeTrimmed()
+// --------------------------------------------------------------------------
+
+template<typename TStream, typename TTrimmedStream>
+inline void
+_writeTrimmed(TrimmedFastqOut<TStream> & out,
+        TTrimmedStream & stream,
+        std::string const & name,
+        std::string const & seq,
+        std::string const & qual,
+        size_t len)
+{
+    out.seq.assign(seq, 0, len);
+    out.qual.assign(qual, 0, len);
+    writeRecord(stream, name, out.seq, out.qual);
+}
+
+// --------------------------------------------------------------------------
+// Function writeTrimmedPair()
+// --------------------------------------------------------------------------
+
+template<typename TStream>
+inline void
+writeTrimmedPair(TrimmedFastqOut<TStream> & out,
+        std::string const & name,
+        std::string const & firstSeq,
+        std::string const & firstQual,
+        std::string const & secondSeq,
+        std::string const & secondQual)
+{
+    size_t firstLen = qualityTrimmedLength(firstSeq, firstQual, out.qualThresh, out.minLength);
+    size_t secondLen = qualityTrimmedLength(secondSeq, secondQual, out.qualThresh, out.minLength);
+
+    if (firstLen != 0 && secondLen != 0)
+    {
+        _writeTrimmed(out, out.firstStream, name, firstSeq, firstQual, firstLen);
+        _writeTrimmed(out, out.secondStream, name, secondSeq, secondQual, secondLen);
+    }
+    else if (firstLen != 0)
+    {
+        _writeTrimmed(out, out.singleStream, name, firstSeq, firstQual, firstLen);
+    }
+    else if (secondLen != 0)
+    {
+        _writeTrimmed(out, out.singleStream, name, secondSeq, secondQual, secondLen);
+    }
+}
+
+// --------------------------------------------------------------------------
+// Function writeTrimmedSingle()
+// --------------------------------------------------------------------------
+
+template<typename TStream>
+inline void
+writeTrimmedSingle(TrimmedFastqOut<TStream> & out,
+        std::string const & name,
+        std::string const & seq,
+        std::string const & qual)
+{
+    size_t len = qualityTrimmedLength(seq, qual, out.qualThresh, out.minLength);
+    if (len != 0)
+        _writeTrimmed(out, out.singleStream, name, seq, qual, len);
+}
+
+#endif  // #ifndef POPINS_QUALITY_TRIMMING_H_
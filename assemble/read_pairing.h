@@ -0,0 +1,535 @@
+#ifndef POPINS_READ_PAIRING_H_
+#define POPINS_READ_PAIRING_H_
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <memory>
+
+#include <seqan/sequence.h>
+
+#include "quality_trimming.h"
+
+using namespace seqan;
+
+// Size of the chunks allocated by a RecordArena.
+#ifndef RECORD_ARENA_CHUNK_SIZE
+#define RECORD_ARENA_CHUNK_SIZE (1 << 20)
+#endif
+
+// ============================================================================
+// struct RecordArena
+// ============================================================================
+
+// Append-only storage for records of variable length. Memory is allocated in chunks of RECORD_ARENA_CHUNK_SIZE
+// bytes (or larger for a single large record), so that storing a record does not allocate memory of its own.
+// Records are never freed individually, only the whole arena at once.
+
+struct RecordArena
+{
+    std::vector<std::unique_ptr<char[]> > chunks;
+    size_t capacity;    // capacity of the last chunk
+    size_t used;        // bytes used in the last chunk
+    size_t size;        // bytes allocated in all chunks
+    size_t peakSize;
+
+    RecordArena() :
+        capacity(0), used(0), size(0), peakSize(0)
+    {}
+};
+
+// --------------------------------------------------------------------------
+// Function allocate()
+// --------------------------------------------------------------------------
+
+inline char *
+allocate(RecordArena & arena, size_t len)
+{
+    if (arena.used + len > arena.capacity)
+    {
+        arena.capacity = std::max((size_t)RECORD_ARENA_CHUNK_SIZE, len);
+        arena.chunks.push_back(std::unique_ptr<char[]>(new char[arena.capacity]));
+        arena.used = 0;
+        arena.size += arena.capacity;
+        arena.peakSize = std::max(arena.peakSize, arena.size);
+    }
+    char * record = arena.chunks.back().get() + arena.used;
+    arena.used += len;
+    return record;
+}
+
+// --------------------------------------------------------------------------
+// Function clear()
+// --------------------------------------------------------------------------
+
+inline void
+clear(RecordArena & arena)
+{
+    arena.chunks.clear();
+    arena.capacity = 0;
+    arena.used = 0;
+    arena.size = 0;
+}
+
+// ============================================================================
+// struct ReadPairer
+// ============================================================================
+
+// Reads waiting for their other read end while cropping. Each read is kept as a line
+//   name<TAB>1|2<TAB>seq<TAB>qual<NEWLINE>
+// in a record arena and found via an open-addressing hash table over the read names. If the arena exceeds
+// the memory budget, the waiting reads are written to a temporary run file sorted by name. At the end, the runs
+// and the reads still in memory are merged by name to pair the reads that were spilled before their other
+// read end was seen.
+
+struct ReadPairer
+{
+    struct Entry
+    {
+        unsigned long long hash;
+        char const * line;  // NULL for an empty slot
+    };
+
+    std::vector<Entry> table;
+    size_t numReads;
+
+    RecordArena arena;
+    size_t liveBytes;
+    size_t memoryBudget;
+
+    CharString runPrefix;
+    std::vector<std::string> runs;
+
+    // Buffers reused for every read.
+    std::string line;
+    std::string name;
+    std::string seq, qual;
+    std::string mateSeq, mateQual;
+
+    ReadPairer(CharString const & prefix, size_t budget) :
+        table(1024), numReads(0), liveBytes(0),
+        memoryBudget(std::max(budget, (size_t)4 * RECORD_ARENA_CHUNK_SIZE)), runPrefix(prefix)
+    {}
+};
+
+// --------------------------------------------------------------------------
+// Function _pairingHash()
+// --------------------------------------------------------------------------
+
+// FNV-1a hash of the read name.
+inline unsigned long long
+_pairingHash(char const * name, size_t len)
+{
+    unsigned long long h = 14695981039346656037ull;
+    for (size_t i = 0; i < len; ++i)
+    {
+        h ^= (unsigned char)name[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// --------------------------------------------------------------------------
+// Function _readLine()
+// --------------------------------------------------------------------------
+
+// Splits a stored read line into its name, read number, sequence and quality.
+inline void
+_readLine(std::string & name, bool & isFirst, std::string & seq, std::string & qual, char const * line)
+{
+    char const * t1 = strchr(line, '\t');
+    char const * t2 = t1 + 2;
+    char const * t3 = strchr(t2 + 1, '\t');
+    char const * end = strchr(t3 + 1, '\n');
+
+    name.assign(line, t1);
+    isFirst = (t1[1] == '1');
+    seq.assign(t2 + 1, t3);
+    qual.assign(t3 + 1, end);
+}
+
+// --------------------------------------------------------------------------
+// Function _nameEquals()
+// --------------------------------------------------------------------------
+
+inline bool
+_nameEquals(char const * line, char const * name, size_t len)
+{
+    return strncmp(line, name, len) == 0 && line[len] == '\t';
+}
+
+// --------------------------------------------------------------------------
+// Function _lineLength()
+// --------------------------------------------------------------------------
+
+inline size_t
+_lineLength(char const * line)
+{
+    return strchr(line, '\n') - line + 1;
+}
+
+// --------------------------------------------------------------------------
+// Function _findSlot()
+// --------------------------------------------------------------------------
+
+// Returns the slot holding the read name or the empty slot where it would be inserted.
+inline size_t
+_findSlot(ReadPairer const & pairer, unsigned long long hash, char const * name, size_t len)
+{
+    size_t mask = pairer.table.size() - 1;
+    size_t i = hash & mask;
+    while (pairer.table[i].line != NULL)
+    {
+        if (pairer.table[i].hash == hash && _nameEquals(pairer.table[i].line, name, len))
+            break;
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+// --------------------------------------------------------------------------
+// Function _eraseSlot()
+// --------------------------------------------------------------------------
+
+// Removes an entry by shifting the following entries of its probe sequence back, so that no tombstones are needed.
+inline void
+_eraseSlot(ReadPairer & pairer, size_t i)
+{
+    size_t mask = pairer.table.size() - 1;
+    size_t j = i;
+    while (true)
+    {
+        pairer.table[i].line = NULL;
+        while (true)
+        {
+            j = (j + 1) & mask;
+            if (pairer.table[j].line == NULL)
+                return;
+            // Entries whose home slot lies cyclically in (i, j] must stay.
+            size_t home = pairer.table[j].hash & mask;
+            bool stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+            if (!stays)
+                break;
+        }
+        pairer.table[i] = pairer.table[j];
+        i = j;
+    }
+}
+
+// --------------------------------------------------------------------------
+// Function _growTable()
+// --------------------------------------------------------------------------
+
+inline void
+_growTable(ReadPairer & pairer)
+{
+    std::vector<ReadPairer::Entry> old(pairer.table.size() * 2);
+    old.swap(pairer.table);
+    size_t mask = pairer.table.size() - 1;
+    for (size_t k = 0; k < old.size(); ++k)
+    {
+        if (old[k].line == NULL)
+            continue;
+        size_t i = old[k].hash & mask;
+        while (pairer.table[i].line != NULL)
+            i = (i + 1) & mask;
+        pairer.table[i] = old[k];
+    }
+}
+
+// --------------------------------------------------------------------------
+// Function _storedReads()
+// --------------------------------------------------------------------------
+
+// Returns the reads in memory sorted by read name.
+inline void
+_storedReads(std::vector<char const *> & lines, ReadPairer const & pairer)
+{
+    lines.clear();
+    for (size_t i = 0; i < pairer.table.size(); ++i)
+        if (pairer.table[i].line != NULL)
+            lines.push_back(pairer.table[i].line);
+
+    std::sort(lines.begin(), lines.end(), [](char const * x, char const * y) {
+        while (*x == *y && *x != '\t') { ++x; ++y; }
+        if (*x == '\t' || *y == '\t')
+            return *x == '\t' && *y != '\t';
+        return (unsigned char)*x < (unsigned char)*y;
+    });
+}
+
+// --------------------------------------------------------------------------
+// Function _compactArena()
+// --------------------------------------------------------------------------
+
+// Copies the waiting reads to a new arena, dropping the reads that were paired or replaced.
+inline void
+_compactArena(ReadPairer & pairer)
+{
+    RecordArena compacted;
+    compacted.peakSize = pairer.arena.peakSize;
+    for (size_t i = 0; i < pairer.table.size(); ++i)
+    {
+        if (pairer.table[i].line == NULL)
+            continue;
+        size_t len = _lineLength(pairer.table[i].line);
+        char * line = allocate(compacted, len);
+        memcpy(line, pairer.table[i].line, len);
+        pairer.table[i].line = line;
+    }
+    std::swap(pairer.arena, compacted);
+}
+
+// ==========================================================================
+// Function spillReads()
+// ==========================================================================
+
+// Writes the reads in memory to a new run file sorted by read name and clears the memory.
+inline bool
+spillReads(ReadPairer & pairer)
+{
+    std::ostringstream name;
+    name << pairer.runPrefix << "." << pairer.runs.size() << ".run";
+
+    std::ofstream stream(name.str().c_str(), std::ios::binary);
+    if (!stream.is_open())
+    {
+        std::cerr << "ERROR: Could not open temporary file " << name.str() << " for writing." << std::endl;
+        return 1;
+    }
+
+    std::vector<char const *> lines;
+    _storedReads(lines, pairer);
+    for (size_t k = 0; k < lines.size(); ++k)
+        stream.write(lines[k], _lineLength(lines[k]));
+    stream.close();
+    if (stream.fail())
+    {
+        std::cerr << "ERROR: Could not write temporary file " << name.str() << std::endl;
+        return 1;
+    }
+
+    pairer.runs.push_back(name.str());
+    std::vector<ReadPairer::Entry>(1024).swap(pairer.table);
+    pairer.numReads = 0;
+    pairer.liveBytes = 0;
+    clear(pairer.arena);
+    return 0;
+}
+
+// ==========================================================================
+// Function addRead()
+// ==========================================================================
+
+// Adds a read, given as a line as described above, to the pairer. Returns 1 if the other read end was waiting;
+// it is then removed from the pairer and mateLine points to it until the next call. Returns -1 on error and 0
+// otherwise.
+inline int
+addRead(char const * & mateLine, ReadPairer & pairer, std::string const & line)
+{
+    size_t nameLength = line.find('\t');
+    bool isFirst = (line[nameLength + 1] == '1');
+    unsigned long long hash = _pairingHash(line.data(), nameLength);
+    size_t i = _findSlot(pairer, hash, line.data(), nameLength);
+
+    if (pairer.table[i].line != NULL)
+    {
+        char const * stored = pairer.table[i].line;
+        pairer.liveBytes -= _lineLength(stored);
+
+        if ((stored[nameLength + 1] == '1') != isFirst)
+        {
+            mateLine = stored;
+            _eraseSlot(pairer, i);
+            --pairer.numReads;
+            return 1;
+        }
+        // The same read end again replaces the waiting one.
+    }
+    else
+    {
+        ++pairer.numReads;
+    }
+
+    char * stored = allocate(pairer.arena, line.size());
+    memcpy(stored, line.data(), line.size());
+    pairer.table[i].hash = hash;
+    pairer.table[i].line = stored;
+    pairer.liveBytes += line.size();
+
+    if (2 * pairer.numReads > pairer.table.size())
+        _growTable(pairer);
+
+    // Reclaim the space of paired reads first, spill if the waiting reads alone exceed the budget.
+    if (pairer.arena.size + pairer.table.size() * sizeof(ReadPairer::Entry) > pairer.memoryBudget)
+    {
+        if (pairer.liveBytes < pairer.arena.size / 2)
+            _compactArena(pairer);
+        else if (spillReads(pairer) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+// ==========================================================================
+// struct PairingRun
+// ==========================================================================
+
+// Cursor over the reads of a run file or of the reads in memory of a pairer, in read name order.
+
+struct PairingRun
+{
+    std::unique_ptr<std::ifstream> stream;
+    ReadPairer const * pairer;
+    std::vector<char const *> lines;
+    size_t next;
+
+    std::string name;
+    bool isFirst;
+    std::string seq;
+    std::string qual;
+
+    PairingRun() : pairer(NULL), next(0), isFirst(false)
+    {}
+};
+
+// --------------------------------------------------------------------------
+// Function advance()
+// --------------------------------------------------------------------------
+
+inline bool
+advance(PairingRun & run)
+{
+    if (run.pairer != NULL)
+    {
+        if (run.next == run.lines.size())
+            return false;
+        _readLine(run.name, run.isFirst, run.seq, run.qual, run.lines[run.next++]);
+        return true;
+    }
+
+    std::string line;
+    if (!std::getline(*run.stream, line))
+        return false;
+    line += '\n';
+    _readLine(run.name, run.isFirst, run.seq, run.qual, line.c_str());
+    return true;
+}
+
+// ==========================================================================
+// Function writeWaitingReads()
+// ==========================================================================
+
+// Merges the runs and the reads in memory of all pairers by read name. Reads of which both ends are found are
+// written to the paired streams, all others to the single stream. If trimmedOut is given, the quality trimmed
+// reads are written to it as well. Removes the run files.
+template<typename TStream>
+bool
+writeWaitingReads(TStream & firstStream,
+        TStream & secondStream,
+        TStream & singleStream,
+        std::vector<ReadPairer *> & pairers,
+        TrimmedFastqOut<TStream> * trimmedOut = NULL)
+{
+    typedef std::pair<std::string, unsigned> TQueueEntry;
+
+    // Open a cursor for each run file and for the reads in memory of each pairer.
+    std::vector<std::unique_ptr<PairingRun> > runs;
+    for (unsigned p = 0; p < pairers.size(); ++p)
+    {
+        for (unsigned r = 0; r < pairers[p]->runs.size(); ++r)
+        {
+            runs.push_back(std::unique_ptr<PairingRun>(new PairingRun()));
+            runs.back()->stream.reset(new std::ifstream(pairers[p]->runs[r].c_str(), std::ios::binary));
+            if (!runs.back()->stream->is_open())
+            {
+                std::cerr << "ERROR: Could not open temporary file " << pairers[p]->runs[r] << std::endl;
+                return 1;
+            }
+        }
+        runs.push_back(std::unique_ptr<PairingRun>(new PairingRun()));
+        runs.back()->pairer = pairers[p];
+        _storedReads(runs.back()->lines, *pairers[p]);
+    }
+
+    std::priority_queue<TQueueEntry, std::vector<TQueueEntry>, std::greater<TQueueEntry> > queue;
+    for (unsigned r = 0; r < runs.size(); ++r)
+        if (advance(*runs[r]))
+            queue.push(TQueueEntry(runs[r]->name, r));
+
+    // Reads with the same name are adjacent in the merged order.
+    bool hasPending = false;
+    std::string pendingName, pendingSeq, pendingQual;
+    bool pendingFirst = false;
+    while (!queue.empty())
+    {
+        unsigned r = queue.top().second;
+        PairingRun & run = *runs[r];
+        queue.pop();
+
+        if (hasPending && pendingName == run.name && pendingFirst != run.isFirst)
+        {
+            if (pendingFirst)
+            {
+                writeRecord(firstStream, pendingName, pendingSeq, pendingQual);
+                writeRecord(secondStream, run.name, run.seq, run.qual);
+                if (trimmedOut != NULL)
+                    writeTrimmedPair(*trimmedOut, pendingName, pendingSeq, pendingQual, run.seq, run.qual);
+            }
+            else
+            {
+                writeRecord(firstStream, run.name, run.seq, run.qual);
+                writeRecord(secondStream, pendingName, pendingSeq, pendingQual);
+                if (trimmedOut != NULL)
+                    writeTrimmedPair(*trimmedOut, run.name, run.seq, run.qual, pendingSeq, pendingQual);
+            }
+            hasPending = false;
+        }
+        else
+        {
+            if (hasPending)
+            {
+                writeRecord(singleStream, pendingName, pendingSeq, pendingQual);
+                if (trimmedOut != NULL)
+                    writeTrimmedSingle(*trimmedOut, pendingName, pendingSeq, pendingQual);
+            }
+            hasPending = true;
+            pendingName.swap(run.name);
+            pendingFirst = run.isFirst;
+            pendingSeq.swap(run.seq);
+            pendingQual.swap(run.qual);
+        }
+
+        if (advance(run))
+            queue.push(TQueueEntry(run.name, r));
+    }
+    if (hasPending)
+    {
+        writeRecord(singleStream, pendingName, pendingSeq, pendingQual);
+        if (trimmedOut != NULL)
+            writeTrimmedSingle(*trimmedOut, pendingName, pendingSeq, pendingQual);
+    }
+
+    // Remove the run files and free the memory.
+    runs.clear();
+    for (unsigned p = 0; p < pairers.size(); ++p)
+    {
+        for (unsigned r = 0; r < pairers[p]->runs.size(); ++r)
+            remove(pairers[p]->runs[r].c_str());
+        pairers[p]->runs.clear();
+        std::vector<ReadPairer::Entry>(1024).swap(pairers[p]->table);
+        pairers[p]->numReads = 0;
+        pairers[p]->liveBytes = 0;
+        clear(pairers[p]->arena);
+    }
+
+    return 0;
+}
+
+#endif  // #ifndef POPINS_READ_PAIRING_H_
@@ -0,0 +1,268 @@
+#ifndef POPINS_BAM_IO_H_
+#define POPINS_BAM_IO_H_
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <zlib.h>
+
+#include <seqan/bam_io.h>
+
+using namespace seqan;
+
+// Maximum number of uncompressed bytes in a BGZF block, as in htslib.
+#ifndef BGZF_BLOCK_SIZE
+#define BGZF_BLOCK_SIZE 0xff00
+#endif
+
+// Number of BGZF blocks per thread that are compressed together.
+#ifndef BGZF_BATCH_BLOCKS
+#define BGZF_BATCH_BLOCKS 64
+#endif
+
+// ==========================================================================
+// Function nameSortKey()
+// ==========================================================================
+
+// Computes a binary key of a read name whose byte order is the order of samtools sort -n (strnum_cmp in
+// bam_sort.c), so that names are compared with a plain string comparison. Each run of digits is encoded as '0',
+// the number of significant digits in two bytes, the significant digits and a byte that puts names with more
+// leading zeros first. All other characters are kept.
+inline void
+nameSortKey(std::string & key, CharString const & name)
+{
+    key.clear();
+
+    size_t n = length(name);
+    size_t i = 0;
+    while (i < n)
+    {
+        if (!isdigit((unsigned char)name[i]))
+        {
+            key.push_back(name[i++]);
+            continue;
+        }
+
+        size_t runBegin = i;
+        while (i < n && name[i] == '0')
+            ++i;
+        size_t significant = i;
+        while (i < n && isdigit((unsigned char)name[i]))
+            ++i;
+
+        size_t numDigits = i - significant;
+        size_t numZeros = significant - runBegin;
+        key.push_back('0');
+        key.push_back((char)(numDigits >> 8));
+        key.push_back((char)numDigits);
+        for (size_t j = significant; j < i; ++j)
+            key.push_back(name[j]);
+        key.push_back((char)(255 - std::min(numZeros, (size_t)255)));
+    }
+}
+
+// ==========================================================================
+// Function setContigsFromHeader()
+// ==========================================================================
+
+// Fills the contig names and lengths of a bam io context from the @SQ records of a header.
+template<typename TContext>
+inline void
+setContigsFromHeader(TContext & context, BamHeader const & header)
+{
+    for (unsigned i = 0; i < length(header); ++i)
+    {
+        if (header[i].type == BAM_HEADER_REFERENCE)
+        {
+            CharString name, len;
+            for (unsigned j = 0; j < length(header[i].tags); ++j)
+            {
+                if (header[i].tags[j].i1 == "SN")
+                    name = header[i].tags[j].i2;
+                else if (header[i].tags[j].i1 == "LN")
+                    len = header[i].tags[j].i2;
+            }
+            appendName(contigNamesCache(context), name);
+            int32_t l;
+            lexicalCast<int32_t>(l, len);
+            appendValue(contigLengths(context), l);
+        }
+    }
+}
+
+// ============================================================================
+// struct BgzfFileOut
+// ============================================================================
+
+// BGZF output whose blocks are compressed on several threads. The uncompressed data is collected in the buffer
+// and compressed in batches of BGZF_BATCH_BLOCKS blocks per thread.
+
+struct BgzfFileOut
+{
+    std::ofstream stream;
+    CharString buffer;
+    unsigned threads;
+    std::vector<std::string> blocks;
+
+    BgzfFileOut() : threads(1)
+    {}
+};
+
+// --------------------------------------------------------------------------
+// Function _compressBgzfBlock()
+// --------------------------------------------------------------------------
+
+// Compresses len <= BGZF_BLOCK_SIZE bytes into one BGZF block. Falls back to storing the data uncompressed if
+// it does not compress into the maximum block size.
+inline void
+_compressBgzfBlock(std::string & block, char const * data, size_t len)
+{
+    static unsigned char const header[16] = {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0};
+    size_t const maxBlockSize = 0x10000;
+
+    block.resize(maxBlockSize);
+    size_t compressedLen = 0;
+    for (int level = Z_DEFAULT_COMPRESSION; ; level = Z_NO_COMPRESSION)
+    {
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+        zs.next_in = (Bytef *)data;
+        zs.avail_in = len;
+        zs.next_out = (Bytef *)&block[18];
+        zs.avail_out = maxBlockSize - 18 - 8;
+        int ret = deflate(&zs, Z_FINISH);
+        compressedLen = zs.total_out;
+        deflateEnd(&zs);
+        if (ret == Z_STREAM_END || level == Z_NO_COMPRESSION)
+            break;
+    }
+
+    size_t blockSize = 18 + compressedLen + 8;
+    memcpy(&block[0], header, 16);
+    block[16] = (char)((blockSize - 1) & 0xff);
+    block[17] = (char)((blockSize - 1) >> 8);
+
+    uint32_t crc = crc32(crc32(0, NULL, 0), (Bytef const *)data, len);
+    char * trailer = &block[18 + compressedLen];
+    for (unsigned i = 0; i < 4; ++i)
+    {
+        trailer[i] = (char)((crc >> (8 * i)) & 0xff);
+        trailer[4 + i] = (char)((len >> (8 * i)) & 0xff);
+    }
+    block.resize(blockSize);
+}
+
+// --------------------------------------------------------------------------
+// Function _compressBuffer()
+// --------------------------------------------------------------------------
+
+// Compresses the full blocks of the buffer, or all of it if flushAll is set, and writes them to the file.
+inline void
+_compressBuffer(BgzfFileOut & out, bool flushAll)
+{
+    size_t len = length(out.buffer);
+    size_t numBlocks = flushAll ? (len + BGZF_BLOCK_SIZE - 1) / BGZF_BLOCK_SIZE : len / BGZF_BLOCK_SIZE;
+    if (numBlocks == 0)
+        return;
+
+    if (out.blocks.size() < numBlocks)
+        out.blocks.resize(numBlocks);
+
+    char const * data = begin(out.buffer, Standard());
+    auto compress = [&](unsigned t) {
+        for (size_t b = t; b < numBlocks; b += out.threads)
+        {
+            size_t blockBegin = b * BGZF_BLOCK_SIZE;
+            _compressBgzfBlock(out.blocks[b], data + blockBegin, std::min((size_t)BGZF_BLOCK_SIZE, len - blockBegin));
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < out.threads; ++t)
+        workers.push_back(std::thread(compress, t));
+    compress(0);
+    for (unsigned t = 0; t < workers.size(); ++t)
+        workers[t].join();
+
+    for (size_t b = 0; b < numBlocks; ++b)
+        out.stream.write(out.blocks[b].data(), out.blocks[b].size());
+
+    erase(out.buffer, 0, std::min(len, numBlocks * BGZF_BLOCK_SIZE));
+}
+
+// --------------------------------------------------------------------------
+// Function open()
+// --------------------------------------------------------------------------
+
+inline bool
+open(BgzfFileOut & out, CharString const & filename, unsigned threads)
+{
+    out.threads = std::max(threads, 1u);
+    out.stream.open(toCString(filename), std::ios::binary);
+    reserve(out.buffer, out.threads * BGZF_BATCH_BLOCKS * BGZF_BLOCK_SIZE + BGZF_BLOCK_SIZE, Exact());
+    return out.stream.is_open();
+}
+
+// --------------------------------------------------------------------------
+// Function writeBamHeader()
+// --------------------------------------------------------------------------
+
+template<typename TContext>
+inline void
+writeBamHeader(BgzfFileOut & out, BamHeader const & header, TContext & context)
+{
+    write(out.buffer, header, context, Bam());
+}
+
+// --------------------------------------------------------------------------
+// Function writeBamRecord()
+// --------------------------------------------------------------------------
+
+template<typename TContext>
+inline void
+writeBamRecord(BgzfFileOut & out, BamAlignmentRecord const & record, TContext & context)
+{
+    write(out.buffer, record, context, Bam());
+    if (length(out.buffer) >= out.threads * BGZF_BATCH_BLOCKS * BGZF_BLOCK_SIZE)
+        _compressBuffer(out, false);
+}
+
+// --------------------------------------------------------------------------
+// Function writeBamBytes()
+// --------------------------------------------------------------------------
+
+// Writes data that is already in bam format, e.g. a header or records encoded before.
+inline void
+writeBamBytes(BgzfFileOut & out, char const * data, size_t len)
+{
+    size_t pos = length(out.buffer);
+    resize(out.buffer, pos + len);
+    memcpy(begin(out.buffer, Standard()) + pos, data, len);
+    if (length(out.buffer) >= out.threads * BGZF_BATCH_BLOCKS * BGZF_BLOCK_SIZE)
+        _compressBuffer(out, false);
+}
+
+// --------------------------------------------------------------------------
+// Function close()
+// --------------------------------------------------------------------------
+
+// Compresses the remaining data, appends the BGZF end-of-file block and closes the file. Returns false on error.
+inline bool
+close(BgzfFileOut & out)
+{
+    static char const eofBlock[28] = {31, (char)139, 8, 4, 0, 0, 0, 0, 0, (char)255, 6, 0, 'B', 'C', 2, 0, 27, 0,
+                                      3, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+    _compressBuffer(out, true);
+    out.stream.write(eofBlock, 28);
+    out.stream.close();
+    return !out.stream.fail();
+}
+
+#endif  // #ifndef POPINS_BAM_IO_H_
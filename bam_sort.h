@@ -0,0 +1,451 @@
+#ifndef POPINS_BAM_SORT_H_
+#define POPINS_BAM_SORT_H_
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <seqan/bam_io.h>
+
+#include "bam_io.h"
+
+using namespace seqan;
+
+// ==========================================================================
+// BAM sorting
+// ==========================================================================
+
+// An external memory sorter for bam records, in the order of samtools sort (BAM_SORT_COORDINATE) or samtools
+// sort -n (BAM_SORT_NAME). The records are encoded in bam format into a buffer together with their sort key.
+// When the buffer exceeds the memory budget, it is split into one slice per thread and each thread sorts its
+// slice and writes it as a compressed run file. Finally, the runs and the slices of the remaining records are
+// merged into the output file.
+
+enum BamSortOrder
+{
+    BAM_SORT_NAME,
+    BAM_SORT_COORDINATE
+};
+
+// Position of a record and its key in the buffer, and the part of the key that is a number.
+struct BamSortEntry
+{
+    size_t offset;
+    unsigned keyLength;
+    unsigned recordLength;
+    __uint64 number;
+};
+
+// ============================================================================
+// struct BamSorter
+// ============================================================================
+
+struct BamSorter
+{
+    typedef FormattedFileContext<BamFileOut, Owner<> >::Type TContext;
+
+    BamSortOrder order;
+    unsigned threads;
+    unsigned long memory;       // for all threads
+
+    CharString outFile;
+    BamHeader header;
+    TContext context;
+    CharString headerBytes;
+
+    CharString data;
+    std::vector<BamSortEntry> entries;
+    std::vector<CharString> runFiles;
+
+    std::string key;
+
+    BamSorter() :
+        order(BAM_SORT_NAME), threads(1), memory(0)
+    {}
+};
+
+// --------------------------------------------------------------------------
+// Function _sortKey()
+// --------------------------------------------------------------------------
+
+// Computes the sort key of a record as in samtools sort: the read name and the first/last flags for name order,
+// and the reference id, position and strand for coordinate order, where unmapped reads come last.
+inline void
+_sortKey(std::string & key, __uint64 & number, BamAlignmentRecord const & record, BamSortOrder order)
+{
+    if (order == BAM_SORT_NAME)
+    {
+        nameSortKey(key, record.qName);
+        number = record.flag & (BAM_FLAG_FIRST | BAM_FLAG_LAST);
+    }
+    else
+    {
+        key.clear();
+        number = ((__uint64)(__uint32)record.rID << 32) | ((__uint64)(__uint32)(record.beginPos + 1) << 1) |
+                 (hasFlagRC(record) ? 1 : 0);
+    }
+}
+
+// --------------------------------------------------------------------------
+// Function _keyLess()
+// --------------------------------------------------------------------------
+
+inline bool
+_keyLess(char const * keyA, size_t lenA, __uint64 numberA, char const * keyB, size_t lenB, __uint64 numberB)
+{
+    int c = memcmp(keyA, keyB, std::min(lenA, lenB));
+    if (c != 0)
+        return c < 0;
+    if (lenA != lenB)
+        return lenA < lenB;
+    return numberA < numberB;
+}
+
+// --------------------------------------------------------------------------
+// Function _setSortOrder()
+// --------------------------------------------------------------------------
+
+// Sets the SO tag of the @HD header record, adding the record if there is none.
+inline void
+_setSortOrder(BamHeader & header, BamSortOrder order)
+{
+    CharString sortOrder = (order == BAM_SORT_NAME) ? "queryname" : "coordinate";
+
+    for (unsigned i = 0; i < length(header); ++i)
+    {
+        if (header[i].type != BAM_HEADER_FIRST)
+            continue;
+
+        for (unsigned j = 0; j < length(header[i].tags); ++j)
+        {
+            if (header[i].tags[j].i1 == "SO")
+            {
+                header[i].tags[j].i2 = sortOrder;
+                return;
+            }
+        }
+        appendValue(header[i].tags, Pair<CharString>("SO", sortOrder));
+        return;
+    }
+
+    BamHeaderRecord first;
+    first.type = BAM_HEADER_FIRST;
+    appendValue(first.tags, Pair<CharString>("VN", "1.4"));
+    appendValue(first.tags, Pair<CharString>("SO", sortOrder));
+    insertValue(header, 0, first);
+}
+
+// ==========================================================================
+// Function initSorter()
+// ==========================================================================
+
+// Prepares sorting into outFile. The memory is the budget for the records in memory of all threads together.
+inline void
+initSorter(BamSorter & sorter,
+        CharString const & outFile,
+        BamHeader const & header,
+        BamSortOrder order,
+        unsigned threads,
+        unsigned long memory)
+{
+    sorter.order = order;
+    sorter.threads = std::max(threads, 1u);
+    sorter.memory = std::max(memory, 1ul << 20);
+    sorter.outFile = outFile;
+
+    sorter.header = header;
+    _setSortOrder(sorter.header, order);
+    setContigsFromHeader(sorter.context, sorter.header);
+
+    clear(sorter.headerBytes);
+    write(sorter.headerBytes, sorter.header, sorter.context, Bam());
+
+    clear(sorter.data);
+    sorter.entries.clear();
+    sorter.runFiles.clear();
+}
+
+// --------------------------------------------------------------------------
+// Function _sortSlices()
+// --------------------------------------------------------------------------
+
+// Splits the entries into one slice per thread and sorts the slices in parallel. Entries with equal keys keep
+// their order.
+inline void
+_sortSlices(std::vector<std::pair<size_t, size_t> > & slices, BamSorter & sorter)
+{
+    slices.clear();
+    size_t n = sorter.entries.size();
+    if (n == 0)
+        return;
+
+    unsigned numSlices = std::min((size_t)sorter.threads, n);
+    for (unsigned s = 0; s < numSlices; ++s)
+        slices.push_back(std::make_pair(n * s / numSlices, n * (s + 1) / numSlices));
+
+    char const * data = begin(sorter.data, Standard());
+    auto less = [data](BamSortEntry const & a, BamSortEntry const & b) {
+        if (_keyLess(data + a.offset, a.keyLength, a.number, data + b.offset, b.keyLength, b.number))
+            return true;
+        if (_keyLess(data + b.offset, b.keyLength, b.number, data + a.offset, a.keyLength, a.number))
+            return false;
+        return a.offset < b.offset;
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned s = 0; s < numSlices; ++s)
+        workers.push_back(std::thread([&, s]() {
+            std::sort(sorter.entries.begin() + slices[s].first, sorter.entries.begin() + slices[s].second, less);
+        }));
+    for (unsigned s = 0; s < numSlices; ++s)
+        workers[s].join();
+}
+
+// --------------------------------------------------------------------------
+// Function _spillRuns()
+// --------------------------------------------------------------------------
+
+// Sorts the records in memory and writes each slice to a run file on its own thread.
+inline bool
+_spillRuns(BamSorter & sorter)
+{
+    std::vector<std::pair<size_t, size_t> > slices;
+    _sortSlices(slices, sorter);
+
+    std::vector<CharString> files;
+    for (unsigned s = 0; s < slices.size(); ++s)
+    {
+        std::ostringstream name;
+        name << sorter.outFile << ".tmp." << (sorter.runFiles.size() + s) << ".bam";
+        files.push_back(CharString(name.str()));
+    }
+
+    char const * data = begin(sorter.data, Standard());
+    std::vector<int> failed(slices.size(), 0);
+    std::vector<std::thread> workers;
+    for (unsigned s = 0; s < slices.size(); ++s)
+        workers.push_back(std::thread([&, s]() {
+            BgzfFileOut out;
+            if (!open(out, files[s], 1))
+            {
+                failed[s] = 1;
+                return;
+            }
+            writeBamBytes(out, begin(sorter.headerBytes, Standard()), length(sorter.headerBytes));
+            for (size_t i = slices[s].first; i < slices[s].second; ++i)
+            {
+                BamSortEntry const & entry = sorter.entries[i];
+                writeBamBytes(out, data + entry.offset + entry.keyLength, entry.recordLength);
+            }
+            failed[s] = !close(out);
+        }));
+    for (unsigned s = 0; s < slices.size(); ++s)
+        workers[s].join();
+
+    sorter.runFiles.insert(sorter.runFiles.end(), files.begin(), files.end());
+    for (unsigned s = 0; s < slices.size(); ++s)
+    {
+        if (failed[s])
+        {
+            std::cerr << "ERROR: Could not write temporary file " << files[s] << std::endl;
+            return 1;
+        }
+    }
+
+    clear(sorter.data);
+    sorter.entries.clear();
+    return 0;
+}
+
+// ==========================================================================
+// Function appendRecord()
+// ==========================================================================
+
+// Adds a record whose reference ids refer to the header given to initSorter().
+inline bool
+appendRecord(BamSorter & sorter, BamAlignmentRecord const & record)
+{
+    // Grow the buffer by doubling up to the memory budget, so that small inputs do not reserve all of it.
+    size_t cap = capacity(sorter.data);
+    if (length(sorter.data) + (1 << 16) > cap && cap < sorter.memory)
+        reserve(sorter.data, std::min((size_t)sorter.memory, std::max(2 * cap, (size_t)1 << 20)), Exact());
+
+    BamSortEntry entry;
+    _sortKey(sorter.key, entry.number, record, sorter.order);
+    entry.offset = length(sorter.data);
+    entry.keyLength = sorter.key.size();
+
+    resize(sorter.data, entry.offset + entry.keyLength);
+    memcpy(begin(sorter.data, Standard()) + entry.offset, sorter.key.data(), entry.keyLength);
+    write(sorter.data, record, sorter.context, Bam());
+    entry.recordLength = length(sorter.data) - entry.offset - entry.keyLength;
+    sorter.entries.push_back(entry);
+
+    if (length(sorter.data) + sorter.entries.size() * sizeof(BamSortEntry) >= sorter.memory)
+        return _spillRuns(sorter);
+    return 0;
+}
+
+// ============================================================================
+// struct SortSource
+// ============================================================================
+
+// A sorted input of the final merge: a run file or a slice of the records in memory.
+
+struct SortSource
+{
+    std::unique_ptr<BamFileIn> file;
+    BamAlignmentRecord record;
+    std::string fileKey;
+
+    size_t next;
+    size_t end;
+
+    char const * key;
+    size_t keyLength;
+    __uint64 number;
+    bool done;
+
+    SortSource() :
+        next(0), end(0), key(NULL), keyLength(0), number(0), done(false)
+    {}
+};
+
+// --------------------------------------------------------------------------
+// Function _advance()
+// --------------------------------------------------------------------------
+
+inline void
+_advance(SortSource & source, BamSorter & sorter)
+{
+    if (source.file)
+    {
+        if (atEnd(*source.file))
+        {
+            source.done = true;
+            return;
+        }
+        readRecord(source.record, *source.file);
+        _sortKey(source.fileKey, source.number, source.record, sorter.order);
+        source.key = source.fileKey.data();
+        source.keyLength = source.fileKey.size();
+    }
+    else
+    {
+        if (source.next == source.end)
+        {
+            source.done = true;
+            return;
+        }
+        BamSortEntry const & entry = sorter.entries[source.next++];
+        source.key = begin(sorter.data, Standard()) + entry.offset;
+        source.keyLength = entry.keyLength;
+        source.number = entry.number;
+    }
+}
+
+// ==========================================================================
+// Function finishSorting()
+// ==========================================================================
+
+// Merges the run files and the records in memory into the output file and removes the run files.
+inline bool
+finishSorting(BamSorter & sorter)
+{
+    std::vector<std::pair<size_t, size_t> > slices;
+    _sortSlices(slices, sorter);
+
+    std::vector<SortSource> sources(sorter.runFiles.size() + slices.size());
+    for (unsigned i = 0; i < sorter.runFiles.size(); ++i)
+    {
+        sources[i].file.reset(new BamFileIn());
+        if (!open(*sources[i].file, toCString(sorter.runFiles[i])))
+        {
+            std::cerr << "ERROR: Could not open temporary file " << sorter.runFiles[i] << std::endl;
+            return 1;
+        }
+        BamHeader runHeader;
+        readHeader(runHeader, *sources[i].file);
+    }
+    for (unsigned s = 0; s < slices.size(); ++s)
+    {
+        sources[sorter.runFiles.size() + s].next = slices[s].first;
+        sources[sorter.runFiles.size() + s].end = slices[s].second;
+    }
+
+    BgzfFileOut out;
+    if (!open(out, sorter.outFile, sorter.threads))
+    {
+        std::cerr << "ERROR: Could not open " << sorter.outFile << " for writing." << std::endl;
+        return 1;
+    }
+    writeBamBytes(out, begin(sorter.headerBytes, Standard()), length(sorter.headerBytes));
+
+    // The heap holds the sources that are not done. Sources with equal keys are taken in the order in which
+    // their records were added.
+    auto greater = [&](unsigned a, unsigned b) {
+        SortSource const & x = sources[a];
+        SortSource const & y = sources[b];
+        if (_keyLess(y.key, y.keyLength, y.number, x.key, x.keyLength, x.number))
+            return true;
+        if (_keyLess(x.key, x.keyLength, x.number, y.key, y.keyLength, y.number))
+            return false;
+        return a > b;
+    };
+    std::vector<unsigned> heap;
+    for (unsigned i = 0; i < sources.size(); ++i)
+    {
+        _advance(sources[i], sorter);
+        if (!sources[i].done)
+            heap.push_back(i);
+    }
+    std::make_heap(heap.begin(), heap.end(), greater);
+
+    while (!heap.empty())
+    {
+        std::pop_heap(heap.begin(), heap.end(), greater);
+        SortSource & source = sources[heap.back()];
+
+        if (source.file)
+        {
+            writeBamRecord(out, source.record, sorter.context);
+        }
+        else
+        {
+            BamSortEntry const & entry = sorter.entries[source.next - 1];
+            writeBamBytes(out, source.key + entry.keyLength, entry.recordLength);
+        }
+
+        _advance(source, sorter);
+        if (source.done)
+        {
+            heap.pop_back();
+        }
+        else
+        {
+            std::push_heap(heap.begin(), heap.end(), greater);
+        }
+    }
+
+    sources.clear();
+    for (unsigned i = 0; i < sorter.runFiles.size(); ++i)
+        remove(toCString(sorter.runFiles[i]));
+    sorter.runFiles.clear();
+    clear(sorter.data);
+    shrinkToFit(sorter.data);
+    sorter.entries.clear();
+
+    if (!close(out))
+    {
+        std::cerr << "ERROR: Could not write " << sorter.outFile << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+#endif  // #ifndef POPINS_BAM_SORT_H_
@@ -1,7 +1,10 @@
 #ifndef POPINS_CLP_H_
 #define POPINS_CLP_H_
 
+#include <algorithm>
 #include <string>
+#include <sstream>
+#include <vector>
 #include <seqan/arg_parse.h>
 
 #include "popins_utils.h"
@@ -21,15 +24,18 @@ struct AssemblyOptions {
     CharString sampleID;
 
     unsigned kmerLength;
+    std::vector<unsigned> kmerLengths;
+    CharString assembler;
     CharString adapters;
     int humanSeqs;
 
     unsigned threads;
     CharString memory;
+    bool streaming;
 
     AssemblyOptions () :
         matepairFile(""), referenceFile(""), prefix("."), sampleID(""),
-      kmerLength(47), humanSeqs(maxValue<int>()), threads(1), memory("768M")
+      kmerLength(47), assembler("velvet"), humanSeqs(maxValue<int>()), threads(1), memory("768M"), streaming(false)
     {}
 };
 
@@ -37,9 +43,11 @@ struct MergingOptions {
     CharString prefix;
     CharString outputFile;
     CharString skippedFile;
+    CharString contigStoreFile;
     std::fstream outputStream;
     std::fstream skippedStream;
     bool verbose;
+    bool resume;
 
     double errorRate;
     int minimalLength;
@@ -49,17 +57,37 @@ struct MergingOptions {
     int minScore;
     int minTipScore;
 
+    CharString filter;
+    unsigned minimizerK;
+    unsigned minimizerW;
+    unsigned minSeeds;
+
     double minEntropy;
 
+    unsigned threads;
+    bool batchAlignments;
+
+    CharString shard;
+    unsigned shardIndex;    // 1-based
+    unsigned shardCount;    // 0 if not running as a shard
+    unsigned combineCount;  // 0 if not combining shards
+    CharString shardDir;
+
+    CharString stateDir;    // empty if not merging incrementally
+
     MergingOptions() :
-        prefix("."), outputFile("supercontigs.fa"), skippedFile(""), verbose(false),
-        errorRate(0.01), minimalLength(60), qgramLength(47), matchScore(1), errorPenalty(-5), minScore(90), minTipScore(30), minEntropy(0.75)
+        prefix("."), outputFile("supercontigs.fa"), skippedFile(""), contigStoreFile("contigs.store"), verbose(false), resume(false),
+        errorRate(0.01), minimalLength(60), qgramLength(47), matchScore(1), errorPenalty(-5), minScore(90), minTipScore(30),
+        filter("swift"), minimizerK(15), minimizerW(10), minSeeds(3), minEntropy(0.75),
+        threads(1), batchAlignments(false), shard(""), shardIndex(0), shardCount(0), combineCount(0), shardDir("."),
+        stateDir("")
     {}
 };
 
 struct ContigMapOptions {
     CharString prefix;
     CharString sampleID;
+    String<CharString> sampleIDs;
     CharString contigFile;
     CharString referenceFile;
 
@@ -68,11 +96,12 @@ struct ContigMapOptions {
     bool deleteNonRefNew;
 
     unsigned threads;
+    unsigned sampleThreads;
     CharString memory;
 
     ContigMapOptions() :
         prefix("."), sampleID(""), contigFile("supercontigs.fa"), referenceFile("genome.fa"),
-        bestAlignment(false), maxInsertSize(800), deleteNonRefNew(false), threads(1), memory("768M")
+        bestAlignment(false), maxInsertSize(800), deleteNonRefNew(false), threads(1), sampleThreads(0), memory("768M")
     {}
 };
 
@@ -155,6 +184,7 @@ setHiddenOptions(ArgumentParser & parser, bool hide, AssemblyOptions &)
 {
    hideOption(parser, "matePair", hide);
    hideOption(parser, "kmerLength", hide);
+   hideOption(parser, "kmerLengths", hide);
 }
 
 void
@@ -228,7 +258,7 @@ setupParser(ArgumentParser & parser, AssemblyOptions & options)
     // Define usage line and long description.
     addUsageLine(parser, "[\\fIOPTIONS\\fP] \\fIBAM_FILE\\fP");
     addDescription(parser, "Finds reads without high-quality alignment in the \\fIBAM FILE\\fP, quality filters them "
-          "using SICKLE and assembles them into contigs using VELVET. If the option \'--reference \\fIFASTA FILE\\fP\' "
+          "with a sliding window and assembles them into contigs using VELVET. If the option \'--reference \\fIFASTA FILE\\fP\' "
           "is set, the reads are first remapped to this reference using BwA-MEM and only reads that remain without "
           "high-quality alignment after remapping are quality-filtered and assembled.");
 
@@ -246,20 +276,25 @@ setupParser(ArgumentParser & parser, AssemblyOptions & options)
     addOption(parser, ArgParseOption("r", "reference", "Remap reads to this reference before assembly. Default: \\fIno remapping\\fP.", ArgParseArgument::INPUT_FILE, "FASTA_FILE"));
     addOption(parser, ArgParseOption("f", "filter", "Treat reads aligned to all but the first INT reference sequences after remapping as high-quality aligned even if their alignment quality is low. "
           "Recommended for non-human reference sequences.", ArgParseArgument::INTEGER, "INT"));
-    addOption(parser, ArgParseOption("k", "kmerLength", "The k-mer size for velvet assembly.", ArgParseArgument::INTEGER, "INT"));
+    addOption(parser, ArgParseOption("k", "kmerLength", "The k-mer size for the assembly.", ArgParseArgument::INTEGER, "INT"));
+    addOption(parser, ArgParseOption("", "kmerLengths", "Comma-separated k-mer sizes for a multi-k assembly, e.g. 31,47,63. The contigs of all k-mer sizes are deduplicated. Overrides \\fI--kmerLength\\fP.", ArgParseArgument::STRING, "LIST"));
+    addOption(parser, ArgParseOption("", "assembler", "Assembler to use: VELVET or the built-in de Bruijn graph assembler \\fInative\\fP, which writes no temporary files and uses \\fI--threads\\fP.", ArgParseArgument::STRING, "STR"));
 
     addSection(parser, "Compute resource options");
-    addOption(parser, ArgParseOption("t", "threads", "Number of threads to use for BWA and samtools sort.", ArgParseArgument::INTEGER, "INT"));
-    addOption(parser, ArgParseOption("m", "memory", "Maximum memory per thread for samtools sort; suffix K/M/G recognized.", ArgParseArgument::STRING, "STR"));
+    addOption(parser, ArgParseOption("t", "threads", "Number of threads to use for cropping, BWA and sorting.", ArgParseArgument::INTEGER, "INT"));
+    addOption(parser, ArgParseOption("m", "memory", "Maximum memory per thread for sorting and for unpaired reads while cropping; suffix K/M/G recognized.", ArgParseArgument::STRING, "STR"));
+    addOption(parser, ArgParseOption("", "streaming", "Stream the cropped read pairs through a pipe into the remapping instead of writing them to disk. Requires \\fI--reference\\fP."));
 
     // Set valid and default values.
     setValidValues(parser, "adapters", "HiSeq HiSeqX");
     setValidValues(parser, "reference", "fa fna fasta");
+    setValidValues(parser, "assembler", "velvet native");
     setMinValue(parser, "threads", "1");
 
     setDefaultValue(parser, "prefix", "\'.\'");
     setDefaultValue(parser, "sample", "retrieval from BAM file header");
     setDefaultValue(parser, "kmerLength", options.kmerLength);
+    setDefaultValue(parser, "assembler", options.assembler);
     setDefaultValue(parser, "threads", options.threads);
     setDefaultValue(parser, "memory", options.memory);
 
@@ -285,7 +320,9 @@ setupParser(ArgumentParser & parser, MergingOptions & options)
     addOption(parser, ArgParseOption("p", "prefix", "Path to the sample directories.", ArgParseArgument::STRING, "PATH"));
     addOption(parser, ArgParseOption("c", "contigs", "Name of supercontigs output file.", ArgParseArgument::OUTPUT_FILE, "FASTA_FILE"));
     addOption(parser, ArgParseOption("s", "skipped", "Write skipped contigs to a file. Default: \\fIdo not write skipped contigs\\fP", ArgParseArgument::OUTPUT_FILE, "FASTA_FILE"));
+    addOption(parser, ArgParseOption("", "contigStore", "Packed contig file that is built from the input contigs and reused as long as they do not change.", ArgParseArgument::OUTPUT_FILE, "FILE"));
     addOption(parser, ArgParseOption("v", "verbose", "Enable verbose output of components."));
+    addOption(parser, ArgParseOption("", "resume", "Continue an interrupted merge from the checkpoint files next to the supercontigs output file."));
 
     addSection(parser, "Algorithm options");
     addOption(parser, ArgParseOption("y", "minEntropy", "Ignore low-complexity contigs with entropy below FLOAT. Use 0 to disable.", ArgParseArgument::DOUBLE, "FLOAT"));
@@ -297,6 +334,22 @@ setupParser(ArgumentParser & parser, MergingOptions & options)
     addOption(parser, ArgParseOption("mm", "penalty", "Error penalty for Smith-Waterman alignment.", ArgParseArgument::INTEGER, "INT"));
     addOption(parser, ArgParseOption("a", "minScore", "Minimal score for Smith-Waterman alignment.", ArgParseArgument::INTEGER, "INT"));
     addOption(parser, ArgParseOption("t", "minTipScore", "Minimal score for tips in supercontig graph.", ArgParseArgument::INTEGER, "INT"));
+    addOption(parser, ArgParseOption("", "filter", "Filter for finding candidate contig pairs.", ArgParseArgument::STRING, "FILTER"));
+    addOption(parser, ArgParseOption("", "minimizerK", "Length of k-mers for minimizer filtering.", ArgParseArgument::INTEGER, "INT"));
+    addOption(parser, ArgParseOption("", "minimizerW", "Number of consecutive k-mers from which a minimizer is chosen.", ArgParseArgument::INTEGER, "INT"));
+    addOption(parser, ArgParseOption("", "minSeeds", "Minimal number of co-linear minimizers for a candidate contig pair.", ArgParseArgument::INTEGER, "INT"));
+
+    addSection(parser, "Compute resource options");
+    addOption(parser, ArgParseOption("", "threads", "Number of threads to use for aligning contigs and constructing supercontigs.", ArgParseArgument::INTEGER, "INT"));
+    addOption(parser, ArgParseOption("", "batchAlignments", "Verify the SWIFT hits of a contig in batches with one contig pair per SIMD lane."));
+
+    addSection(parser, "Sharding options");
+    addOption(parser, ArgParseOption("", "shard", "Align only the i-th of N slices of the contigs against all contigs and write the aligned pairs to \'merge_shard_i_of_N.pairs\' in the shard directory instead of constructing supercontigs.", ArgParseArgument::STRING, "i/N"));
+    addOption(parser, ArgParseOption("", "combine", "Construct supercontigs from the aligned pairs written by N shards instead of aligning the contigs.", ArgParseArgument::INTEGER, "N"));
+    addOption(parser, ArgParseOption("", "shardDir", "Directory for the aligned pair files of shards.", ArgParseArgument::STRING, "PATH"));
+
+    addSection(parser, "Incremental merging options");
+    addOption(parser, ArgParseOption("", "stateDir", "Keep the q-gram index, aligned pairs and supercontigs in PATH and reuse them in the next merge, which then only aligns the contigs of new samples. Default: \\fIdo not keep a state\\fP", ArgParseArgument::STRING, "PATH"));
 
     // Set valid values.
     setValidValues(parser, "c", "fa fna fasta");
@@ -308,10 +361,18 @@ setupParser(ArgumentParser & parser, MergingOptions & options)
     setMinValue(parser, "l", "3");
     setMinValue(parser, "k", "3");
     setMinValue(parser, "t", "0");
+    setValidValues(parser, "filter", "swift minimizer");
+    setMinValue(parser, "minimizerK", "5");
+    setMaxValue(parser, "minimizerK", "31");
+    setMinValue(parser, "minimizerW", "1");
+    setMinValue(parser, "minSeeds", "1");
+    setMinValue(parser, "threads", "1");
+    setMinValue(parser, "combine", "1");
 
     // Set default values.
     setDefaultValue(parser, "prefix", "\'.\'");
     setDefaultValue(parser, "c", options.outputFile);
+    setDefaultValue(parser, "contigStore", options.contigStoreFile);
     setDefaultValue(parser, "y", options.minEntropy);
 
     setDefaultValue(parser, "e", options.errorRate);
@@ -321,6 +382,12 @@ setupParser(ArgumentParser & parser, MergingOptions & options)
     setDefaultValue(parser, "mm", options.errorPenalty);
     setDefaultValue(parser, "a", options.minScore);
     setDefaultValue(parser, "t", options.minTipScore);
+    setDefaultValue(parser, "filter", options.filter);
+    setDefaultValue(parser, "minimizerK", options.minimizerK);
+    setDefaultValue(parser, "minimizerW", options.minimizerW);
+    setDefaultValue(parser, "minSeeds", options.minSeeds);
+    setDefaultValue(parser, "threads", options.threads);
+    setDefaultValue(parser, "shardDir", "\'.\'");
 
     // Hide some options from default help.
     setHiddenOptions(parser, true, options);
@@ -334,12 +401,15 @@ setupParser(ArgumentParser & parser, ContigMapOptions & options)
     setDate(parser, VERSION_DATE);
 
     // Define usage line and long description.
-    addUsageLine(parser, "[\\fIOPTIONS\\fP] \\fISAMPLE_ID\\fP");
+    addUsageLine(parser, "[\\fIOPTIONS\\fP] \\fISAMPLE_ID\\fP [\\fISAMPLE_ID\\fP ...]");
     addDescription(parser, "Aligns the reads with low-quality alignments of a sample to the set of supercontigs using "
             "BWA-MEM. Merges the BWA output file with the sample's non_ref.bam file into a non_ref_new.bam file where "
     		"information about read mates is set.");
+    addDescription(parser, "If several samples are given, the BWA index of the supercontigs is loaded into shared "
+            "memory once and the samples are mapped concurrently, each with the number of threads given by "
+            "\\fB--sampleThreads\\fP.");
 
-    addArgument(parser, ArgParseArgument(ArgParseArgument::STRING, "SAMPLE_ID"));
+    addArgument(parser, ArgParseArgument(ArgParseArgument::STRING, "SAMPLE_ID", true));
 
     // Setup the options.
     addSection(parser, "Input/output options");
@@ -353,11 +423,13 @@ setupParser(ArgumentParser & parser, ContigMapOptions & options)
     addOption(parser, ArgParseOption("d", "noNonRefNew", "Delete the non_ref_new.bam file after writing locations."));
 
     addSection(parser, "Compute resource options");
-    addOption(parser, ArgParseOption("t", "threads", "Number of threads to use for BWA and samtools sort.", ArgParseArgument::INTEGER, "INT"));
-    addOption(parser, ArgParseOption("m", "memory", "Maximum memory per thread for samtools sort; suffix K/M/G recognized.", ArgParseArgument::STRING, "STR"));
+    addOption(parser, ArgParseOption("t", "threads", "Number of threads to use for BWA and sorting; split across the samples with \\fB--sampleThreads\\fP.", ArgParseArgument::INTEGER, "INT"));
+    addOption(parser, ArgParseOption("m", "memory", "Maximum memory per thread for sorting; suffix K/M/G recognized.", ArgParseArgument::STRING, "STR"));
+    addOption(parser, ArgParseOption("T", "sampleThreads", "Number of threads per sample when mapping several samples; the samples are mapped concurrently on all threads.", ArgParseArgument::INTEGER, "INT"));
 
     // Set valid values.
     setMinValue(parser, "threads", "1");
+    setMinValue(parser, "sampleThreads", "1");
     setValidValues(parser, "reference", "fa fna fasta");
     setValidValues(parser, "contigs", "fa fna fasta");
 
@@ -370,6 +442,7 @@ setupParser(ArgumentParser & parser, ContigMapOptions & options)
     setDefaultValue(parser, "noNonRefNew", "false");
     setDefaultValue(parser, "threads", options.threads);
     setDefaultValue(parser, "memory", options.memory);
+    setDefaultValue(parser, "sampleThreads", "\'threads\'");
 
     // Hide some options from default help.
     setHiddenOptions(parser, true, options);
@@ -609,10 +682,26 @@ getOptionValues(AssemblyOptions & options, ArgumentParser const & parser)
         getOptionValue(options.humanSeqs, parser, "filter");
     if (isSet(parser, "kmerLength"))
         getOptionValue(options.kmerLength, parser, "kmerLength");
+    if (isSet(parser, "kmerLengths"))
+    {
+        // Invalid list entries are kept as 0 and reported by checkInput().
+        std::string kmerLengths;
+        getOptionValue(kmerLengths, parser, "kmerLengths");
+        std::istringstream ss(kmerLengths);
+        std::string k;
+        while (std::getline(ss, k, ','))
+            options.kmerLengths.push_back(strtoul(k.c_str(), NULL, 10));
+        std::sort(options.kmerLengths.begin(), options.kmerLengths.end());
+        options.kmerLengths.erase(std::unique(options.kmerLengths.begin(), options.kmerLengths.end()), options.kmerLengths.end());
+    }
+    if (isSet(parser, "assembler"))
+        getOptionValue(options.assembler, parser, "assembler");
     if (isSet(parser, "threads"))
         getOptionValue(options.threads, parser, "threads");
     if (isSet(parser, "memory"))
         getOptionValue(options.memory, parser, "memory");
+    if (isSet(parser, "streaming"))
+        options.streaming = true;
 }
 
 void
@@ -624,8 +713,12 @@ getOptionValues(MergingOptions & options, ArgumentParser & parser)
         getOptionValue(options.outputFile, parser, "contigs");
     if (isSet(parser, "skipped"))
         getOptionValue(options.skippedFile, parser, "skipped");
+    if (isSet(parser, "contigStore"))
+        getOptionValue(options.contigStoreFile, parser, "contigStore");
     if (isSet(parser, "verbose"))
         options.verbose = true;
+    if (isSet(parser, "resume"))
+        options.resume = true;
 
     if (isSet(parser, "minEntropy"))
         getOptionValue(options.minEntropy, parser, "minEntropy");
@@ -644,12 +737,41 @@ getOptionValues(MergingOptions & options, ArgumentParser & parser)
         getOptionValue(options.errorPenalty, parser, "penalty");
     if (isSet(parser, "minTipScore"))
         getOptionValue(options.minTipScore, parser, "minTipScore");
+    if (isSet(parser, "filter"))
+        getOptionValue(options.filter, parser, "filter");
+    if (isSet(parser, "minimizerK"))
+        getOptionValue(options.minimizerK, parser, "minimizerK");
+    if (isSet(parser, "minimizerW"))
+        getOptionValue(options.minimizerW, parser, "minimizerW");
+    if (isSet(parser, "minSeeds"))
+        getOptionValue(options.minSeeds, parser, "minSeeds");
+
+    if (isSet(parser, "threads"))
+        getOptionValue(options.threads, parser, "threads");
+    if (isSet(parser, "batchAlignments"))
+        options.batchAlignments = true;
+
+    if (isSet(parser, "shard"))
+        getOptionValue(options.shard, parser, "shard");
+    if (isSet(parser, "combine"))
+        getOptionValue(options.combineCount, parser, "combine");
+    if (isSet(parser, "shardDir"))
+        getOptionValue(options.shardDir, parser, "shardDir");
+
+    if (isSet(parser, "stateDir"))
+        getOptionValue(options.stateDir, parser, "stateDir");
 }
 
 void
 getOptionValues(ContigMapOptions & options, ArgumentParser & parser)
 {
-    getArgumentValue(options.sampleID, parser, 0);
+    for (unsigned i = 0; i < getArgumentValueCount(parser, 0); ++i)
+    {
+        CharString sampleID;
+        getArgumentValue(sampleID, parser, 0, i);
+        appendValue(options.sampleIDs, sampleID);
+    }
+    options.sampleID = options.sampleIDs[0];
 
     if (isSet(parser, "prefix"))
         getOptionValue(options.prefix, parser, "prefix");
@@ -667,6 +789,8 @@ getOptionValues(ContigMapOptions & options, ArgumentParser & parser)
         getOptionValue(options.threads, parser, "threads");
     if (isSet(parser, "memory"))
         getOptionValue(options.memory, parser, "memory");
+    if (isSet(parser, "sampleThreads"))
+        getOptionValue(options.sampleThreads, parser, "sampleThreads");
 }
 
 void
@@ -805,6 +929,34 @@ checkInput(AssemblyOptions & options)
 		res = ArgumentParser::PARSE_ERROR;
 	}
 
+	if (options.streaming && options.referenceFile == "")
+	{
+		std::cerr << "ERROR: Option --streaming requires --reference." << std::endl;
+		res = ArgumentParser::PARSE_ERROR;
+	}
+
+	// With an even k, a k-mer can be its own reverse complement, which the canonical k-mer graph does not handle.
+	if (options.assembler == "native" && options.kmerLengths.empty() &&
+			(options.kmerLength < 15 || options.kmerLength > 63 || options.kmerLength % 2 == 0))
+	{
+		std::cerr << "ERROR: The native assembler requires an odd k-mer length between 15 and 63." << std::endl;
+		res = ArgumentParser::PARSE_ERROR;
+	}
+
+	for (unsigned i = 0; i < options.kmerLengths.size(); ++i)
+	{
+		if (options.kmerLengths[i] == 0 || (options.assembler == "native" &&
+				(options.kmerLengths[i] < 15 || options.kmerLengths[i] > 63 || options.kmerLengths[i] % 2 == 0)))
+		{
+			std::cerr << "ERROR: Invalid k-mer length in --kmerLengths";
+			if (options.assembler == "native")
+				std::cerr << ", the native assembler requires odd k-mer lengths between 15 and 63";
+			std::cerr << "." << std::endl;
+			res = ArgumentParser::PARSE_ERROR;
+			break;
+		}
+	}
+
 	return res;
 }
 
@@ -819,6 +971,41 @@ checkInput(MergingOptions & options)
 		res = ArgumentParser::PARSE_ERROR;
 	}
 
+	if (options.shard != "")
+	{
+		std::istringstream ss(toCString(options.shard));
+		char slash = 0;
+		if (!(ss >> options.shardIndex >> slash >> options.shardCount) || slash != '/' || !ss.eof() ||
+		        options.shardIndex < 1 || options.shardIndex > options.shardCount)
+		{
+			std::cerr << "ERROR: Invalid value \'" << options.shard << "\' for option --shard. Expected i/N with 1 <= i <= N." << std::endl;
+			res = ArgumentParser::PARSE_ERROR;
+		}
+		else if (options.combineCount != 0)
+		{
+			std::cerr << "ERROR: Options --shard and --combine cannot be used together." << std::endl;
+			res = ArgumentParser::PARSE_ERROR;
+		}
+	}
+
+	if (options.shardDir != "." && !exists(options.shardDir))
+	{
+		std::cerr << "ERROR: Shard directory \'" << options.shardDir << "\' does not exist." << std::endl;
+		res = ArgumentParser::PARSE_ERROR;
+	}
+
+	if (options.resume && options.shard != "")
+	{
+		std::cerr << "ERROR: Options --resume and --shard cannot be used together." << std::endl;
+		res = ArgumentParser::PARSE_ERROR;
+	}
+
+	if (options.stateDir != "" && (options.shard != "" || options.combineCount != 0))
+	{
+		std::cerr << "ERROR: Option --stateDir cannot be used together with --shard or --combine." << std::endl;
+		res = ArgumentParser::PARSE_ERROR;
+	}
+
 	return res;
 }
 
@@ -845,6 +1032,12 @@ checkInput(ContigMapOptions & options)
 		res = ArgumentParser::PARSE_ERROR;
 	}
 
+	if (options.sampleThreads > options.threads)
+	{
+		std::cerr << "ERROR: The number of threads per sample exceeds the number of threads." << std::endl;
+		res = ArgumentParser::PARSE_ERROR;
+	}
+
 	return res;
 }
 
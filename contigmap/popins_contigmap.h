@@ -1,142 +1,138 @@
 #ifndef POPINS_CONTIGMAP_H_
 #define POPINS_CONTIGMAP_H_
 
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <ext/stdio_filebuf.h>
+#include <set>
 #include <sstream>
+#include <thread>
+#include <vector>
 
 #include <seqan/file.h>
 #include <seqan/sequence.h>
 #include <seqan/bam_io.h>
 
 #include "../popins_utils.h"
+#include "../bam_sort.h"
 #include "../command_line_parsing.h"
 #include "../assemble/crop_unmapped.h"
 #include "../place/location.h"
 
 using namespace seqan;
 
-// ==========================================================================
-// Function write_fastq()
-// ==========================================================================
+// --------------------------------------------------------------------------
+// Function fillSamStream()
+// --------------------------------------------------------------------------
 
-bool
-write_fastq(CharString & fastqFirst,
-        CharString & fastqSecond,
-        CharString & fastqSingle,
-        CharString & unmappedBam)
+// Fills the sequence and qualities of secondary records without them from the first record of the same read end
+// and sorts all records of a sam stream by read name into outBam. The record and the sequence of the first
+// record are reused, so that filling a record takes a copy of the infix but no allocation.
+inline bool
+fillSamStream(CharString const & outBam, std::istream & samStream, unsigned threads, unsigned long memory)
 {
-    typedef std::map<CharString, Pair<CharString> > TFastqMap;
-
-    // Create maps for fastq records (first read in pair and second read in pair).
-    TFastqMap firstReads, secondReads;
+    typedef Position<IupacString>::Type TPos;
 
-    // Open bam file.
-    BamFileIn inStream(toCString(unmappedBam));
-
-    // Read bam header and clear it since we don't need it.
+    BamFileIn inStream;
+    if (!open(inStream, samStream, Sam()))
+        return 1;
     BamHeader header;
     readHeader(header, inStream);
-    clear(header);
 
-    // Open the output fastq files.    
-    SeqFileOut fastqFirstStream(toCString(fastqFirst));
-    SeqFileOut fastqSecondStream(toCString(fastqSecond));
-    SeqFileOut fastqSingleStream(toCString(fastqSingle));
+    BamSorter sorter;
+    initSorter(sorter, outBam, header, BAM_SORT_NAME, threads, memory);
+
+    CharString firstName, firstQual;
+    IupacString firstSeq;
+    bool firstIsFirst = false;
 
-    // Iterate over bam file and append fastq records.
     BamAlignmentRecord record;
-    while(!atEnd(inStream))
+    while (!atEnd(inStream))
     {
         readRecord(record, inStream);
-        if (hasFlagUnmapped(record))
-            appendFastqRecord(fastqFirstStream, fastqSecondStream, firstReads, secondReads, record);
-    }
 
-    // Write the fastq files.
-    if (writeFastq(fastqFirstStream, fastqSecondStream, fastqSingleStream, firstReads, secondReads) != 0) return 1;
+        if (firstName != record.qName || firstIsFirst != hasFlagFirst(record))
+        {
+            // update first record
+            firstName = record.qName;
+            firstIsFirst = hasFlagFirst(record);
+            if (length(record.seq) == 0 || length(record.qual) == 0)
+            {
+                std::cerr << "ERROR: First record of read " << record.qName << " has no sequence." << std::endl;
+                return 1;
+            }
+            firstSeq = record.seq;
+            firstQual = record.qual;
+        }
+        else if (length(record.seq) == 0 || length(record.qual) == 0)
+        {
+            // fill sequence field and quality string, without the hard clipped ends
+            TPos begin = 0;
+            TPos end = length(firstSeq);
+            TPos last = length(record.cigar) - 1;
+            if (length(record.cigar) != 0 && record.cigar[0].operation == 'H')
+                begin = record.cigar[0].count;
+            if (length(record.cigar) != 0 && record.cigar[last].operation == 'H')
+                end -= record.cigar[last].count;
+
+            record.seq = infix(firstSeq, begin, end);
+            record.qual = infix(firstQual, begin, end);
+        }
+
+        if (appendRecord(sorter, record) != 0)
+            return 1;
+    }
 
-    return 0;
+    return finishSorting(sorter);
 }
 
 // ==========================================================================
 // Function fill_sequences()
 // ==========================================================================
 
-bool
-fill_sequences(CharString & outFile, CharString & inFile)
+// Runs a command that writes sam output, e.g. bwa mem, fills in the sequences of its secondary records and sorts
+// the records by read name into outBam. The sam output is read through a pipe and never written to disk. The
+// memory is the budget for sorting of all threads together.
+inline int
+fill_sequences(CharString const & outBam, std::string const & command, unsigned threads, unsigned long memory)
 {
-    typedef Position<Dna5String>::Type TPos;
-
-    BamFileIn inStream(toCString(inFile));
-    BamFileOut outStream(context(inStream), toCString(outFile));
-
-    BamHeader header;
-    readHeader(header, inStream);
-    writeHeader(outStream, header);
-
-    BamAlignmentRecord firstRecord, nextRecord;
-    while (!atEnd(inStream))
+    FILE * pipe = popen(command.c_str(), "r");
+    if (pipe == NULL)
     {
-        readRecord(nextRecord, inStream);
-
-        if (firstRecord.qName != nextRecord.qName || hasFlagFirst(firstRecord) != hasFlagFirst(nextRecord))
-        {
-            // update first record
-            firstRecord = nextRecord;
-            if (length(firstRecord.seq) == 0 || length(firstRecord.qual) == 0)
-            {
-                std::cerr << "ERROR: First record of read " << firstRecord.qName << " has no sequence." << std::endl;
-                return 1;
-            }
-        }
-        else
-        {
-            // fill sequence field and quality string
-            if (length(nextRecord.seq) == 0 || length(nextRecord.qual) == 0)
-            {
-                TPos last = length(nextRecord.cigar)-1;
-                if (nextRecord.cigar[0].operation == 'H' || nextRecord.cigar[last].operation == 'H')
-                {
-                    TPos begin = 0;
-                    if (nextRecord.cigar[0].operation == 'H')
-                        begin = nextRecord.cigar[0].count;
-
-                    TPos end = length(firstRecord.seq);
-                    if (nextRecord.cigar[last].operation == 'H')
-                        end -= nextRecord.cigar[last].count;
-
-                    nextRecord.seq = infix(firstRecord.seq, begin, end);
-                    nextRecord.qual = infix(firstRecord.qual, begin, end);
-                }
-                else
-                {
-                    nextRecord.seq = firstRecord.seq;
-                    nextRecord.qual = firstRecord.qual;
-                }
-            }
-        }
+        std::cerr << "ERROR: Could not run " << command << std::endl;
+        return 1;
+    }
 
-        writeRecord(outStream, nextRecord);
+    bool failed;
+    {
+        __gnu_cxx::stdio_filebuf<char> pipeBuffer(pipe, std::ios::in);
+        std::istream samStream(&pipeBuffer);
+        failed = fillSamStream(outBam, samStream, threads, memory);
     }
 
-    close(outStream);
+    if (pclose(pipe) != 0 || failed)
+    {
+        std::cerr << "ERROR while filling in sequences in the output of " << command << std::endl;
+        return 1;
+    }
 
     return 0;
 }
 
-
 // ==========================================================================
-// Function popins_contigmap()
+// Function contigmap_sample()
 // ==========================================================================
 
-int popins_contigmap(int argc, char const ** argv)
+// Maps the reads of one sample to the contigs on the given number of threads and writes the sample's
+// non_ref_new.bam and locations.txt. The chromosomes are only read, so that they can be shared by several samples.
+inline int
+contigmap_sample(ContigMapOptions const & options,
+        CharString const & sampleID,
+        std::set<CharString> & chromosomes,
+        unsigned threads)
 {
-    // Parse the command line to get option values.
-    ContigMapOptions options;
-    ArgumentParser::ParseResult res = parseCommandLine(options, argc, argv);
-    if (res != ArgumentParser::PARSE_OK)
-        return res;
-
-    CharString workingDirectory = getFileName(options.prefix, options.sampleID);
+    CharString workingDirectory = getFileName(options.prefix, sampleID);
 
     // Check for input files to exist.
     CharString fastqFirst = getFileName(workingDirectory, "paired.1.fastq");
@@ -150,120 +146,133 @@ int popins_contigmap(int argc, char const ** argv)
     {
         std::cerr << "ERROR: Could not find all input files ";
         std::cerr << fastqFirst << ", " << fastqSecond << ", " << fastqSingle << ", and " << nonRefBam << std::endl;
-        return 7;
+        return 1;
     }
 
     // Create names of temporary files.
-    CharString mappedSam = getFileName(workingDirectory, "contig_mapped_unsorted.sam");
-    CharString mappedBamUnsorted = getFileName(workingDirectory, "contig_mapped_unsorted.bam");
     CharString mappedBam = getFileName(workingDirectory, "contig_mapped.bam");
-    CharString mergedBam = getFileName(workingDirectory, "merged.bam");
-
-    std::stringstream cmd;
-
-    CharString indexFile = options.contigFile;
-    indexFile += ".bwt";
-    if (!exists(indexFile))
-    {
-        std::ostringstream msg;
-        msg << "Indexing contigs int \'" << options.contigFile << "\'using " << BWA;
-        printStatus(msg);
 
-        cmd.str("");
-        cmd << BWA << " index " << options.contigFile;
-        if (system(cmd.str().c_str()) != 0)
-        {
-            std::cerr << "ERROR while indexing \'" << options.contigFile << "\' using " << BWA << std::endl;
-            return 7;
-        }
-    }
+    unsigned long memory = 0;
+    if (parseMemory(memory, options.memory) != 0)
+        return 1;
 
     std::ostringstream msg;
-    msg << "Mapping reads to contigs using " << BWA;
+    msg << "Mapping reads of " << sampleID << " to contigs using " << BWA
+        << ", filling in sequences of secondary records and sorting by read name";
     printStatus(msg);
 
-    // Remapping to contigs with bwa.
-    cmd.str("");
-    if (!options.bestAlignment) cmd << BWA << " mem -a ";
-    else cmd << BWA << " mem ";
-    cmd << "-t " << options.threads << " " << options.contigFile << " " << fastqFirst << " " << fastqSecond << " > " << mappedSam;
-    if (system(cmd.str().c_str()) != 0)
-    {
-        std::cerr << "ERROR while running bwa on " << fastqFirst << " and " << fastqSecond << std::endl;
-        return 7;
-    }
-    //remove(toCString(fastqFirst));
-    //remove(toCString(fastqSecond));
+    // Remapping to contigs with bwa: the read pairs, followed by the single end reads without a second header.
+    CharString bwaCmd = BWA;
+    bwaCmd += (options.bestAlignment) ? " mem" : " mem -a";
+    std::stringstream cmd;
+    cmd << "{ " << bwaCmd << " -t " << threads << " " << options.contigFile << " " << fastqFirst << " " << fastqSecond
+        << " && " << bwaCmd << " -t " << threads << " " << options.contigFile << " " << fastqSingle << " | awk '$1 !~ /^@/'; }";
 
-    cmd.str("");
-    if (!options.bestAlignment) cmd << BWA << " mem -a ";
-    else cmd << BWA << " mem ";
-    cmd << "-t " << options.threads << " " << options.contigFile << " " << fastqSingle << " | awk '$1 !~ /@/' >> " << mappedSam;
-    if (system(cmd.str().c_str()) != 0)
-    {
-        std::cerr << "ERROR while running bwa on " << fastqSingle << std::endl;
-        return 7;
-    }
-    //remove(toCString(fastqSingle));
+    // Fill in sequences in bwa output and sort it into <WD>/contig_mapped.bam by read name.
+    if (fill_sequences(mappedBam, cmd.str(), threads, memory * threads) != 0)
+        return 1;
 
-    printStatus("Filling in sequences of secondary records in bwa output");
+    // Merge non_ref.bam with contig_mapped, set the mates and sort the records by beginPos into <WD>/non_ref_new.bam.
+    if (merge_and_set_mate(nonRefNew, nonRefBam, mappedBam, threads, memory * threads) != 0)
+        return 1;
 
-    // Fill in sequences in bwa output.
-    if (fill_sequences(mappedBamUnsorted, mappedSam) != 0)
-    {
-        return 7;
-    }
-    remove(toCString(mappedSam));
+    remove(toCString(mappedBam));
+    //remove(toCString(nonRefBam));
 
     msg.str("");
-    msg << "Sorting " << mappedBamUnsorted << " by read name using " << SAMTOOLS;
+    msg << "Indexing " << nonRefNew << " by beginPos using " << SAMTOOLS;
     printStatus(msg);
 
-    // Sort <WD>/contig_mapped.bam by read name
+    // Index <WD>/non_ref_new.bam.
     cmd.str("");
-    cmd << SAMTOOLS << " sort -n -@ " << options.threads << " -m " << options.memory << " -o " << mappedBam << " " << mappedBamUnsorted;
+    cmd << SAMTOOLS << " index " << nonRefNew;
     if (system(cmd.str().c_str()) != 0)
     {
-        std::cerr << "ERROR while sorting " << mappedBamUnsorted << " by read name using " << SAMTOOLS << std::endl;
-        return 7;
+        std::cerr << "ERROR while indexing " << nonRefNew << " using " << SAMTOOLS << std::endl;
+        return 1;
     }
-    remove(toCString(mappedBamUnsorted));
 
-    // Merge non_ref.bam with contig_mapped and set the mates.
-    if (merge_and_set_mate(mergedBam, nonRefBam, mappedBam) != 0)
-        return 7;
+    msg.str("");
+    msg << "Computing contig locations from anchoring reads in " << nonRefNew;
+    printStatus(msg);
 
-    remove(toCString(mappedBam));
-    //remove(toCString(nonRefBam));
+    // Find anchoring locations of contigs for this individual.
+    String<Location> locations;
+    findLocations(locations, nonRefNew, chromosomes, options.maxInsertSize);
+    scoreLocations(locations);
+    if (writeLocations(locationsFile, locations) != 0)
+        return 1;
 
-    msg.str("");
-    msg << "Sorting " << mergedBam << " using " << SAMTOOLS;
+    // Remove the non_ref_new.bam file.
+    if (options.deleteNonRefNew)
+        remove(toCString(nonRefNew));
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+// Function loadSharedIndex()
+// --------------------------------------------------------------------------
+
+// Loads the bwa index of the contigs into shared memory, where bwa mem finds it instead of reading the index
+// files. Returns false if the index is already in shared memory, e.g. loaded by another run, or could not be
+// loaded, e.g. with bwa before 0.7.11, which has no bwa shm. In the latter case, bwa mem reads the index files.
+inline bool
+loadSharedIndex(CharString const & contigFile)
+{
+    std::ostringstream cmd;
+    cmd << BWA << " shm -l 2> /dev/null | grep -q -F \'" << contigFile << "\'";
+    if (system(cmd.str().c_str()) == 0)
+        return false;
+
+    std::ostringstream msg;
+    msg << "Loading the " << BWA << " index of \'" << contigFile << "\' into shared memory";
     printStatus(msg);
 
-    // Sort <WD>/merged.bam by beginPos, output is <WD>/non_ref.bam.
     cmd.str("");
-    cmd << SAMTOOLS << " sort -@ " << options.threads << " -m " << options.memory << " -o " << nonRefNew << " " << mergedBam;
+    cmd << BWA << " shm " << contigFile << " 2> /dev/null";
     if (system(cmd.str().c_str()) != 0)
     {
-        std::cerr << "ERROR while sorting " << mergedBam << " by beginPos using " << SAMTOOLS << std::endl;
-        return 7;
+        std::cerr << "WARNING: Could not load the index of \'" << contigFile << "\' into shared memory using " << BWA
+                  << " shm (requires bwa 0.7.11 or later). Each sample reads the index files." << std::endl;
+        return false;
     }
-    remove(toCString(mergedBam));
 
-    msg.str("");
-    msg << "Indexing " << nonRefNew << " by beginPos using " << SAMTOOLS;
-    printStatus(msg);
+    return true;
+}
 
-    // Index <WD>/non_ref_new.bam.
-    cmd.str("");
-    cmd << SAMTOOLS << " index " << nonRefNew;
-    if (system(cmd.str().c_str()) != 0)
+// ==========================================================================
+// Function popins_contigmap()
+// ==========================================================================
+
+int popins_contigmap(int argc, char const ** argv)
+{
+    // Parse the command line to get option values.
+    ContigMapOptions options;
+    ArgumentParser::ParseResult res = parseCommandLine(options, argc, argv);
+    if (res != ArgumentParser::PARSE_OK)
+        return res;
+
+    std::stringstream cmd;
+
+    CharString indexFile = options.contigFile;
+    indexFile += ".bwt";
+    if (!exists(indexFile))
     {
-        std::cerr << "ERROR while indexing " << nonRefNew << " using " << SAMTOOLS << std::endl;
-        return 7;
+        std::ostringstream msg;
+        msg << "Indexing contigs int \'" << options.contigFile << "\'using " << BWA;
+        printStatus(msg);
+
+        cmd.str("");
+        cmd << BWA << " index " << options.contigFile;
+        if (system(cmd.str().c_str()) != 0)
+        {
+            std::cerr << "ERROR while indexing \'" << options.contigFile << "\' using " << BWA << std::endl;
+            return 7;
+        }
     }
 
-    msg.str("");
+    std::ostringstream msg;
     msg << "Reading chromosomes from " << options.referenceFile;
     printStatus(msg);
 
@@ -271,22 +280,59 @@ int popins_contigmap(int argc, char const ** argv)
     if (readChromosomes(chromosomes, options.referenceFile) != 0)
         return 7;
 
+    unsigned numSamples = length(options.sampleIDs);
+    if (numSamples == 1)
+        return (contigmap_sample(options, options.sampleID, chromosomes, options.threads) != 0) ? 7 : 0;
+
+    // Map several samples concurrently with the contig index loaded once.
+    bool loaded = loadSharedIndex(options.contigFile);
+
+    unsigned sampleThreads = (options.sampleThreads == 0) ? options.threads : options.sampleThreads;
+    unsigned numWorkers = std::min(numSamples, options.threads / sampleThreads);
+
     msg.str("");
-    msg << "Computing contig locations from anchoring reads in " << nonRefNew;
+    msg << "Mapping " << numSamples << " samples, " << numWorkers << " at a time with " << sampleThreads << " threads each";
     printStatus(msg);
 
-    // Find anchoring locations of contigs for this individual.
-    String<Location> locations;
-    findLocations(locations, nonRefNew, chromosomes, options.maxInsertSize);
-    scoreLocations(locations);
-    if (writeLocations(locationsFile, locations) != 0) return 7;
+    std::atomic<unsigned> nextSample(0);
+    std::vector<char> failed(numSamples, false);
+    auto worker = [&]() {
+        for (unsigned i = nextSample++; i < numSamples; i = nextSample++)
+            failed[i] = contigmap_sample(options, options.sampleIDs[i], chromosomes, sampleThreads) != 0;
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned w = 0; w < numWorkers; ++w)
+        workers.push_back(std::thread(worker));
+    for (unsigned w = 0; w < numWorkers; ++w)
+        workers[w].join();
+
+    // Dropping the index with bwa shm -d removes all indices from shared memory, so only do it if we loaded it.
+    if (loaded)
+    {
+        cmd.str("");
+        cmd << BWA << " shm -d";
+        if (system(cmd.str().c_str()) != 0)
+            std::cerr << "WARNING: Could not remove the index of \'" << options.contigFile << "\' from shared memory." << std::endl;
+    }
 
-    // Remove the non_ref_new.bam file.
-    if (options.deleteNonRefNew)
-        remove(toCString(nonRefNew));
+    unsigned numFailed = 0;
+    for (unsigned i = 0; i < numSamples; ++i)
+    {
+        if (failed[i])
+        {
+            std::cerr << "ERROR: Mapping of sample " << options.sampleIDs[i] << " failed." << std::endl;
+            ++numFailed;
+        }
+    }
+    if (numFailed != 0)
+        return 7;
+
+    msg.str("");
+    msg << "Mapped all " << numSamples << " samples to contigs.";
+    printStatus(msg);
 
     return 0;
 }
 
 #endif // #ifndef POPINS_CONTIGMAP_H_
-
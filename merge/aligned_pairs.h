@@ -0,0 +1,194 @@
+#ifndef POPINS_MERGE_ALIGNED_PAIRS_H_
+#define POPINS_MERGE_ALIGNED_PAIRS_H_
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "contig_structs.h"
+#include "contig_store.h"
+#include "union_find.h"
+#include "partition.h"
+
+using namespace seqan;
+
+// --------------------------------------------------------------------------
+// Function shardPairsFile()
+// --------------------------------------------------------------------------
+
+inline CharString
+shardPairsFile(MergingOptions & options, unsigned shardIndex, unsigned shardCount)
+{
+    std::ostringstream name;
+    name << "merge_shard_" << shardIndex << "_of_" << shardCount << ".pairs";
+    return getFileName(options.shardDir, CharString(name.str()));
+}
+
+// ==========================================================================
+// Function writeAlignedPairs()
+// ==========================================================================
+
+// Writes the aligned pairs of a shard. Contigs are identified by sample and contig name so that the pairs stay
+// valid independent of the order in which the contigs are loaded. The first contig of a pair is always a forward
+// contig, the last column gives the orientation of the second contig.
+template<typename TSize>
+bool
+writeAlignedPairs(CharString & filename,
+        std::set<Pair<TSize> > & alignedPairs,
+        ContigStore & store)
+{
+    // Write to a temporary file first so that an interrupted shard does not leave a truncated pairs file.
+    CharString tmpFilename = filename;
+    tmpFilename += ".tmp";
+
+    std::fstream stream(toCString(tmpFilename), std::ios::out);
+    if (!stream.is_open())
+    {
+        std::cerr << "ERROR: Could not open aligned pairs file " << tmpFilename << " for writing." << std::endl;
+        return 1;
+    }
+
+    stream << "#contigs\t" << numFwdContigs(store) << std::endl;
+
+    typedef typename std::set<Pair<TSize> >::iterator TIter;
+    for (TIter it = alignedPairs.begin(); it != alignedPairs.end(); ++it)
+    {
+        ContigId a, b;
+        loadContigId(a, store, (*it).i1);
+        loadContigId(b, store, (*it).i2);
+        stream << a.pn << "\t" << a.contigId << "\t" << b.pn << "\t" << b.contigId << "\t" << (b.orientation ? "+" : "-") << std::endl;
+    }
+
+    stream.close();
+    if (stream.fail() || rename(toCString(tmpFilename), toCString(filename)) != 0)
+    {
+        std::cerr << "ERROR: Could not write aligned pairs to " << filename << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+// ==========================================================================
+// Function readAlignedPairs()
+// ==========================================================================
+
+// Reads aligned pairs written by writeAlignedPairs() on expectedContigs contigs and joins them into the union-find.
+template<typename TSize>
+bool
+readAlignedPairs(ConcurrentUnionFind & uf,
+        std::set<Pair<TSize> > & alignedPairs,
+        CharString & filename,
+        std::map<Pair<CharString>, TSize> & contigIndices,
+        ContigStore & store,
+        unsigned expectedContigs)
+{
+    std::fstream stream(toCString(filename), std::ios::in);
+    if (!stream.is_open())
+    {
+        std::cerr << "ERROR: Could not open aligned pairs file " << filename << std::endl;
+        return 1;
+    }
+
+    int fwdContigCount = numFwdContigs(store);
+
+    // Check that the pairs were computed on the same set of contigs.
+    std::string line;
+    std::string field;
+    unsigned numContigs = 0;
+    std::getline(stream, line);
+    std::istringstream header(line);
+    if (!(header >> field >> numContigs) || field != "#contigs")
+    {
+        std::cerr << "ERROR: Missing header line in aligned pairs file " << filename << std::endl;
+        return 1;
+    }
+    if (numContigs != expectedContigs)
+    {
+        std::cerr << "ERROR: Aligned pairs file " << filename << " was computed on " << numContigs << " contigs, but "
+                  << expectedContigs << " contigs were expected." << std::endl;
+        return 1;
+    }
+
+    unsigned lineNo = 1;
+    while (std::getline(stream, line))
+    {
+        ++lineNo;
+
+        std::istringstream ss(line);
+        std::string pnA, contigA, pnB, contigB, orientation;
+        if (!std::getline(ss, pnA, '\t') || !std::getline(ss, contigA, '\t') ||
+                !std::getline(ss, pnB, '\t') || !std::getline(ss, contigB, '\t') ||
+                !std::getline(ss, orientation) || (orientation != "+" && orientation != "-"))
+        {
+            std::cerr << "ERROR: Invalid line " << lineNo << " in aligned pairs file " << filename << std::endl;
+            return 1;
+        }
+
+        typename std::map<Pair<CharString>, TSize>::iterator itA = contigIndices.find(Pair<CharString>(CharString(pnA), CharString(contigA)));
+        typename std::map<Pair<CharString>, TSize>::iterator itB = contigIndices.find(Pair<CharString>(CharString(pnB), CharString(contigB)));
+        if (itA == contigIndices.end() || itB == contigIndices.end())
+        {
+            std::cerr << "ERROR: Unknown contig in line " << lineNo << " of aligned pairs file " << filename << std::endl;
+            return 1;
+        }
+
+        TSize a = itA->second;
+        TSize b = itB->second;
+        if (orientation == "-") b += fwdContigCount;
+
+        alignedPairs.insert(Pair<TSize>(a, b));
+        joinAlignedContigs(uf, a, b, fwdContigCount);
+    }
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+// Function mapContigIds()
+// --------------------------------------------------------------------------
+
+// Maps the sample and contig name of the forward contigs to their index.
+template<typename TSize>
+void
+mapContigIds(std::map<Pair<CharString>, TSize> & contigIndices, ContigStore & store)
+{
+    for (TSize i = 0; i < numFwdContigs(store); ++i)
+    {
+        ContigId id;
+        loadContigId(id, store, i);
+        contigIndices[Pair<CharString>(id.pn, id.contigId)] = i;
+    }
+}
+
+// ==========================================================================
+// Function combineShards()
+// ==========================================================================
+
+template<typename TSize>
+bool
+combineShards(ConcurrentUnionFind & uf,
+        std::set<Pair<TSize> > & alignedPairs,
+        ContigStore & store,
+        MergingOptions & options)
+{
+    printStatus("Combining aligned pairs of shards");
+
+    std::map<Pair<CharString>, TSize> contigIndices;
+    mapContigIds(contigIndices, store);
+
+    for (unsigned i = 1; i <= options.combineCount; ++i)
+    {
+        CharString filename = shardPairsFile(options, i, options.combineCount);
+        if (readAlignedPairs(uf, alignedPairs, filename, contigIndices, store, numFwdContigs(store)) != 0)
+            return 1;
+    }
+
+    std::ostringstream msg;
+    msg << "Number of valid alignments:     " << length(alignedPairs);
+    printStatus(msg);
+
+    return 0;
+}
+
+#endif // #ifndef POPINS_MERGE_ALIGNED_PAIRS_H_
@@ -0,0 +1,552 @@
+#ifndef POPINS_MERGE_BANDED_ALIGNMENT_H_
+#define POPINS_MERGE_BANDED_ALIGNMENT_H_
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define POPINS_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#include <seqan/score.h>
+
+using namespace seqan;
+
+// ============================================================================
+// Score-only banded local alignment
+// ============================================================================
+
+// The contig pairs found by the SWIFT filter are verified by a banded local alignment with linear gap costs that
+// only needs to decide whether the best score exceeds the minimal score. The kernels below compute the score
+// only and stop as soon as a cell exceeds the minimal score. Diagonal d of the band holds the cells (i, j) of
+// seq2 position i and seq1 position j with j - i = d, as in SeqAn's banded localAlignment().
+//
+// The single-pair kernels walk the band in wavefronts of cells with the same value of 2*i + (d - lowerDiag),
+// which are independent of each other and lie contiguously in two arrays for the even and odd band columns.
+// The batch kernels align one pair per SIMD lane and walk all bands in lockstep row by row.
+//
+// SSE4.1 and AVX2 versions are selected at runtime. They compute with saturated 16 bit scores and are used
+// only if the minimal score leaves enough headroom.
+
+enum SimdLevel
+{
+    SIMD_NONE,
+    SIMD_SSE41,
+    SIMD_AVX2
+};
+
+// Code of positions outside a sequence in the batch kernels; nucleotides have codes 0 to 4.
+const int16_t BANDED_ALIGNMENT_SENTINEL = 7;
+
+// --------------------------------------------------------------------------
+// Function simdLevel()
+// --------------------------------------------------------------------------
+
+inline SimdLevel
+_detectSimdLevel()
+{
+#ifdef POPINS_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return SIMD_SSE41;
+#endif
+    return SIMD_NONE;
+}
+
+inline SimdLevel
+simdLevel()
+{
+    static const SimdLevel level = _detectSimdLevel();
+    return level;
+}
+
+// --------------------------------------------------------------------------
+// struct BandedAlignmentScoring
+// --------------------------------------------------------------------------
+
+struct BandedAlignmentScoring
+{
+    int match;
+    int mismatch;
+    int gap;
+    int minScore;
+
+    BandedAlignmentScoring(Score<int, Simple> const & scoringScheme, int minScore_) :
+        match(scoreMatch(scoringScheme)), mismatch(scoreMismatch(scoringScheme)), gap(scoreGapExtend(scoringScheme)),
+        minScore(minScore_)
+    {}
+};
+
+// --------------------------------------------------------------------------
+// Function _fitsInt16()
+// --------------------------------------------------------------------------
+
+// Returns true if the 16 bit kernels cannot overflow before they reach the minimal score.
+inline bool
+_fitsInt16(BandedAlignmentScoring const & sc)
+{
+    return sc.match >= 0 && sc.match < 1000 && sc.mismatch > -1000 && sc.gap > -1000 && sc.gap <= 0 &&
+            sc.minScore >= 0 && sc.minScore < 30000;
+}
+
+// --------------------------------------------------------------------------
+// Function _bandedLocalScalar()
+// --------------------------------------------------------------------------
+
+// Wavefront kernel. c1 holds the codes of seq1, r2 the codes of seq2 in reverse order. E and O hold the cells of
+// the even and odd band columns of the last two wavefronts at offset 1 and must be zero-initialized. The SIMD
+// versions below hold the cells in 16 bit.
+inline bool
+_bandedLocalScalar(int16_t const * c1, int n1,
+        int16_t const * r2, int n2,
+        int lowerDiag, int width,
+        BandedAlignmentScoring const & sc,
+        int * E, int * O)
+{
+    int wEnd = 2 * (n2 - 1) + width;
+    for (int w = 0; w < wEnd; ++w)
+    {
+        int p = w & 1;
+        int h = w >> 1;
+        int mBegin = std::max(0, std::max(h - n2 + 1, -(h + lowerDiag + p)));
+        int mEnd = std::min((width - p + 1) >> 1, std::min(h + 1, n1 - h - lowerDiag - p));
+
+        int * self = p ? O + 1 : E + 1;
+        int const * up = p ? E + 2 : O + 1;
+        int const * left = p ? E + 1 : O;
+        int16_t const * a = c1 + h + lowerDiag + p;
+        int16_t const * b = r2 + n2 - 1 - h;
+
+        for (int m = mBegin; m < mEnd; ++m)
+        {
+            int score = self[m] + (a[m] == b[m] ? sc.match : sc.mismatch);
+            score = std::max(score, up[m] + sc.gap);
+            score = std::max(score, left[m] + sc.gap);
+            score = std::max(score, 0);
+            if (score > sc.minScore)
+                return true;
+            self[m] = score;
+        }
+    }
+    return false;
+}
+
+#ifdef POPINS_X86_SIMD
+
+// --------------------------------------------------------------------------
+// Function _bandedLocalSse41()
+// --------------------------------------------------------------------------
+
+// Wavefront kernel with 8 cells per vector. The code and cell arrays must be padded by 8 elements.
+__attribute__((target("sse4.1")))
+inline bool
+_bandedLocalSse41(int16_t const * c1, int n1,
+        int16_t const * r2, int n2,
+        int lowerDiag, int width,
+        BandedAlignmentScoring const & sc,
+        int16_t * E, int16_t * O)
+{
+    const __m128i vMatch = _mm_set1_epi16(sc.match);
+    const __m128i vMismatch = _mm_set1_epi16(sc.mismatch);
+    const __m128i vGap = _mm_set1_epi16(sc.gap);
+    const __m128i vMinScore = _mm_set1_epi16(sc.minScore);
+    const __m128i vZero = _mm_setzero_si128();
+    const __m128i vLane = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+
+    int wEnd = 2 * (n2 - 1) + width;
+    for (int w = 0; w < wEnd; ++w)
+    {
+        int p = w & 1;
+        int h = w >> 1;
+        int mBegin = std::max(0, std::max(h - n2 + 1, -(h + lowerDiag + p)));
+        int mEnd = std::min((width - p + 1) >> 1, std::min(h + 1, n1 - h - lowerDiag - p));
+
+        int16_t * self = p ? O + 1 : E + 1;
+        int16_t const * up = p ? E + 2 : O + 1;
+        int16_t const * left = p ? E + 1 : O;
+        int16_t const * a = c1 + h + lowerDiag + p;
+        int16_t const * b = r2 + n2 - 1 - h;
+
+        __m128i vMax = vZero;
+        for (int m = mBegin; m < mEnd; m += 8)
+        {
+            __m128i vSelf = _mm_loadu_si128((__m128i const *)(self + m));
+            __m128i vEq = _mm_cmpeq_epi16(_mm_loadu_si128((__m128i const *)(a + m)),
+                                          _mm_loadu_si128((__m128i const *)(b + m)));
+            __m128i vScore = _mm_adds_epi16(vSelf, _mm_blendv_epi8(vMismatch, vMatch, vEq));
+            vScore = _mm_max_epi16(vScore, _mm_adds_epi16(_mm_loadu_si128((__m128i const *)(up + m)), vGap));
+            vScore = _mm_max_epi16(vScore, _mm_adds_epi16(_mm_loadu_si128((__m128i const *)(left + m)), vGap));
+            vScore = _mm_max_epi16(vScore, vZero);
+
+            // Keep the cells beyond the end of the wavefront.
+            __m128i vBeyond = _mm_cmpgt_epi16(vLane, _mm_set1_epi16(mEnd - 1 - m));
+            vScore = _mm_blendv_epi8(vScore, vSelf, vBeyond);
+
+            _mm_storeu_si128((__m128i *)(self + m), vScore);
+            vMax = _mm_max_epi16(vMax, vScore);
+        }
+        if (_mm_movemask_epi8(_mm_cmpgt_epi16(vMax, vMinScore)) != 0)
+            return true;
+    }
+    return false;
+}
+
+// --------------------------------------------------------------------------
+// Function _bandedLocalAvx2()
+// --------------------------------------------------------------------------
+
+// Wavefront kernel with 16 cells per vector. The code and cell arrays must be padded by 16 elements.
+__attribute__((target("avx2")))
+inline bool
+_bandedLocalAvx2(int16_t const * c1, int n1,
+        int16_t const * r2, int n2,
+        int lowerDiag, int width,
+        BandedAlignmentScoring const & sc,
+        int16_t * E, int16_t * O)
+{
+    const __m256i vMatch = _mm256_set1_epi16(sc.match);
+    const __m256i vMismatch = _mm256_set1_epi16(sc.mismatch);
+    const __m256i vGap = _mm256_set1_epi16(sc.gap);
+    const __m256i vMinScore = _mm256_set1_epi16(sc.minScore);
+    const __m256i vZero = _mm256_setzero_si256();
+    const __m256i vLane = _mm256_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+    int wEnd = 2 * (n2 - 1) + width;
+    for (int w = 0; w < wEnd; ++w)
+    {
+        int p = w & 1;
+        int h = w >> 1;
+        int mBegin = std::max(0, std::max(h - n2 + 1, -(h + lowerDiag + p)));
+        int mEnd = std::min((width - p + 1) >> 1, std::min(h + 1, n1 - h - lowerDiag - p));
+
+        int16_t * self = p ? O + 1 : E + 1;
+        int16_t const * up = p ? E + 2 : O + 1;
+        int16_t const * left = p ? E + 1 : O;
+        int16_t const * a = c1 + h + lowerDiag + p;
+        int16_t const * b = r2 + n2 - 1 - h;
+
+        __m256i vMax = vZero;
+        for (int m = mBegin; m < mEnd; m += 16)
+        {
+            __m256i vSelf = _mm256_loadu_si256((__m256i const *)(self + m));
+            __m256i vEq = _mm256_cmpeq_epi16(_mm256_loadu_si256((__m256i const *)(a + m)),
+                                             _mm256_loadu_si256((__m256i const *)(b + m)));
+            __m256i vScore = _mm256_adds_epi16(vSelf, _mm256_blendv_epi8(vMismatch, vMatch, vEq));
+            vScore = _mm256_max_epi16(vScore, _mm256_adds_epi16(_mm256_loadu_si256((__m256i const *)(up + m)), vGap));
+            vScore = _mm256_max_epi16(vScore, _mm256_adds_epi16(_mm256_loadu_si256((__m256i const *)(left + m)), vGap));
+            vScore = _mm256_max_epi16(vScore, vZero);
+
+            // Keep the cells beyond the end of the wavefront.
+            __m256i vBeyond = _mm256_cmpgt_epi16(vLane, _mm256_set1_epi16(mEnd - 1 - m));
+            vScore = _mm256_blendv_epi8(vScore, vSelf, vBeyond);
+
+            _mm256_storeu_si256((__m256i *)(self + m), vScore);
+            vMax = _mm256_max_epi16(vMax, vScore);
+        }
+        if (_mm256_movemask_epi8(_mm256_cmpgt_epi16(vMax, vMinScore)) != 0)
+            return true;
+    }
+    return false;
+}
+
+// --------------------------------------------------------------------------
+// Function _bandedLocalBatchSse41()
+// --------------------------------------------------------------------------
+
+// Batch kernel for 8 pairs. S1[(i + k) * 8 + l] holds the code of seq1 at the position of band column k in row i
+// of lane l and S2[i * 8 + l] the code of seq2 at row i, or the sentinel outside the sequences. K[k] is -1 in the
+// lanes whose band has column k. Returns the bit mask of lanes that exceed the minimal score.
+__attribute__((target("sse4.1")))
+inline unsigned
+_bandedLocalBatchSse41(int16_t const * S1, int16_t const * S2, int16_t const * K,
+        int rows, int width,
+        BandedAlignmentScoring const & sc,
+        int16_t * prev, int16_t * cur)
+{
+    const __m128i vMatch = _mm_set1_epi16(sc.match);
+    const __m128i vMismatch = _mm_set1_epi16(sc.mismatch);
+    const __m128i vGap = _mm_set1_epi16(sc.gap);
+    const __m128i vMinScore = _mm_set1_epi16(sc.minScore);
+    const __m128i vZero = _mm_setzero_si128();
+    const __m128i vCodes = _mm_set1_epi16(5);
+
+    __m128i vMax = vZero;
+    for (int i = 0; i < rows; ++i)
+    {
+        __m128i vC2 = _mm_loadu_si128((__m128i const *)(S2 + i * 8));
+        __m128i vRowValid = _mm_cmplt_epi16(vC2, vCodes);
+        __m128i vLeft = vZero;
+        for (int k = 0; k < width; ++k)
+        {
+            __m128i vC1 = _mm_loadu_si128((__m128i const *)(S1 + (i + k) * 8));
+            __m128i vEq = _mm_cmpeq_epi16(vC1, vC2);
+            __m128i vScore = _mm_adds_epi16(_mm_loadu_si128((__m128i const *)(prev + k * 8)),
+                                            _mm_blendv_epi8(vMismatch, vMatch, vEq));
+            vScore = _mm_max_epi16(vScore, _mm_adds_epi16(_mm_loadu_si128((__m128i const *)(prev + (k + 1) * 8)), vGap));
+            vScore = _mm_max_epi16(vScore, _mm_adds_epi16(vLeft, vGap));
+            vScore = _mm_max_epi16(vScore, vZero);
+
+            __m128i vValid = _mm_and_si128(_mm_and_si128(vRowValid, _mm_cmplt_epi16(vC1, vCodes)),
+                                           _mm_loadu_si128((__m128i const *)(K + k * 8)));
+            vScore = _mm_and_si128(vScore, vValid);
+
+            _mm_storeu_si128((__m128i *)(cur + k * 8), vScore);
+            vMax = _mm_max_epi16(vMax, vScore);
+            vLeft = vScore;
+        }
+        std::swap(prev, cur);
+
+        if (_mm_movemask_epi8(_mm_cmpgt_epi16(vMax, vMinScore)) == 0xffff)
+            break;
+    }
+
+    unsigned mask = _mm_movemask_epi8(_mm_cmpgt_epi16(vMax, vMinScore));
+    unsigned lanes = 0;
+    for (unsigned l = 0; l < 8; ++l)
+        if (mask & (1u << (2 * l)))
+            lanes |= 1u << l;
+    return lanes;
+}
+
+// --------------------------------------------------------------------------
+// Function _bandedLocalBatchAvx2()
+// --------------------------------------------------------------------------
+
+// Batch kernel for 16 pairs, see _bandedLocalBatchSse41().
+__attribute__((target("avx2")))
+inline unsigned
+_bandedLocalBatchAvx2(int16_t const * S1, int16_t const * S2, int16_t const * K,
+        int rows, int width,
+        BandedAlignmentScoring const & sc,
+        int16_t * prev, int16_t * cur)
+{
+    const __m256i vMatch = _mm256_set1_epi16(sc.match);
+    const __m256i vMismatch = _mm256_set1_epi16(sc.mismatch);
+    const __m256i vGap = _mm256_set1_epi16(sc.gap);
+    const __m256i vMinScore = _mm256_set1_epi16(sc.minScore);
+    const __m256i vZero = _mm256_setzero_si256();
+    const __m256i vCodes = _mm256_set1_epi16(5);
+
+    __m256i vMax = vZero;
+    for (int i = 0; i < rows; ++i)
+    {
+        __m256i vC2 = _mm256_loadu_si256((__m256i const *)(S2 + i * 16));
+        __m256i vRowValid = _mm256_cmpgt_epi16(vCodes, vC2);
+        __m256i vLeft = vZero;
+        for (int k = 0; k < width; ++k)
+        {
+            __m256i vC1 = _mm256_loadu_si256((__m256i const *)(S1 + (i + k) * 16));
+            __m256i vEq = _mm256_cmpeq_epi16(vC1, vC2);
+            __m256i vScore = _mm256_adds_epi16(_mm256_loadu_si256((__m256i const *)(prev + k * 16)),
+                                               _mm256_blendv_epi8(vMismatch, vMatch, vEq));
+            vScore = _mm256_max_epi16(vScore, _mm256_adds_epi16(_mm256_loadu_si256((__m256i const *)(prev + (k + 1) * 16)), vGap));
+            vScore = _mm256_max_epi16(vScore, _mm256_adds_epi16(vLeft, vGap));
+            vScore = _mm256_max_epi16(vScore, vZero);
+
+            __m256i vValid = _mm256_and_si256(_mm256_and_si256(vRowValid, _mm256_cmpgt_epi16(vCodes, vC1)),
+                                              _mm256_loadu_si256((__m256i const *)(K + k * 16)));
+            vScore = _mm256_and_si256(vScore, vValid);
+
+            _mm256_storeu_si256((__m256i *)(cur + k * 16), vScore);
+            vMax = _mm256_max_epi16(vMax, vScore);
+            vLeft = vScore;
+        }
+        std::swap(prev, cur);
+
+        if ((unsigned)_mm256_movemask_epi8(_mm256_cmpgt_epi16(vMax, vMinScore)) == 0xffffffffu)
+            break;
+    }
+
+    unsigned mask = _mm256_movemask_epi8(_mm256_cmpgt_epi16(vMax, vMinScore));
+    unsigned lanes = 0;
+    for (unsigned l = 0; l < 16; ++l)
+        if (mask & (1u << (2 * l)))
+            lanes |= 1u << l;
+    return lanes;
+}
+
+#endif  // #ifdef POPINS_X86_SIMD
+
+// --------------------------------------------------------------------------
+// Function _encodeSeq()
+// --------------------------------------------------------------------------
+
+// Writes the nucleotide codes of seq, optionally in reverse order, followed by padding elements.
+template<typename TSeq>
+inline void
+_encodeSeq(std::vector<int16_t> & codes, TSeq const & seq, bool reverse, unsigned padding)
+{
+    unsigned n = length(seq);
+    codes.assign(n + padding, BANDED_ALIGNMENT_SENTINEL);
+    for (unsigned i = 0; i < n; ++i)
+        codes[reverse ? n - 1 - i : i] = ordValue(seq[i]);
+}
+
+// ==========================================================================
+// Function bandedLocalAlignment()
+// ==========================================================================
+
+// Returns true if the best local alignment of seq1 and seq2 within the diagonals [lowerDiag, upperDiag] scores
+// more than minScore.
+template<typename TSeq>
+bool
+bandedLocalAlignment(TSeq const & seq1,
+        TSeq const & seq2,
+        Score<int, Simple> const & scoringScheme,
+        int lowerDiag,
+        int upperDiag,
+        int minScore)
+{
+    static thread_local std::vector<int16_t> c1, r2, E, O;
+    static thread_local std::vector<int> scalarE, scalarO;
+
+    BandedAlignmentScoring sc(scoringScheme, minScore);
+    int n1 = length(seq1);
+    int n2 = length(seq2);
+    int width = upperDiag - lowerDiag + 1;
+    if (n1 == 0 || n2 == 0 || width <= 0)
+        return minScore < 0;
+
+    const unsigned padding = 16;
+    _encodeSeq(c1, seq1, false, padding);
+    _encodeSeq(r2, seq2, true, padding);
+    unsigned cells = (width + 1) / 2 + 2 + padding;
+
+#ifdef POPINS_X86_SIMD
+    if (_fitsInt16(sc) && simdLevel() != SIMD_NONE)
+    {
+        E.assign(cells, 0);
+        O.assign(cells, 0);
+        if (simdLevel() == SIMD_AVX2)
+            return _bandedLocalAvx2(&c1[0], n1, &r2[0], n2, lowerDiag, width, sc, &E[0], &O[0]);
+        return _bandedLocalSse41(&c1[0], n1, &r2[0], n2, lowerDiag, width, sc, &E[0], &O[0]);
+    }
+#endif
+    scalarE.assign(cells, 0);
+    scalarO.assign(cells, 0);
+    return _bandedLocalScalar(&c1[0], n1, &r2[0], n2, lowerDiag, width, sc, &scalarE[0], &scalarO[0]);
+}
+
+// --------------------------------------------------------------------------
+// struct BandedAlignmentPair
+// --------------------------------------------------------------------------
+
+// A contig pair and alignment band for bandedLocalAlignments().
+template<typename TSeq>
+struct BandedAlignmentPair
+{
+    TSeq const * seq1;
+    TSeq const * seq2;
+    int lowerDiag;
+    int upperDiag;
+
+    BandedAlignmentPair() :
+        seq1(0), seq2(0), lowerDiag(0), upperDiag(0)
+    {}
+
+    BandedAlignmentPair(TSeq const & s1, TSeq const & s2, int l, int u) :
+        seq1(&s1), seq2(&s2), lowerDiag(l), upperDiag(u)
+    {}
+};
+
+// --------------------------------------------------------------------------
+// Function _bandedLocalBatch()
+// --------------------------------------------------------------------------
+
+// Aligns pairs [begin, end) with one pair per lane and sets aligned[i] for the pairs that exceed the minimal score.
+template<typename TSeq>
+void
+_bandedLocalBatch(String<bool> & aligned,
+        String<BandedAlignmentPair<TSeq> > const & pairs,
+        unsigned begin,
+        unsigned end,
+        unsigned lanes,
+        BandedAlignmentScoring const & sc)
+{
+    static thread_local std::vector<int16_t> S1, S2, K, prev, cur;
+
+    int rows = 0, width = 0;
+    for (unsigned p = begin; p < end; ++p)
+    {
+        rows = std::max(rows, (int)length(*pairs[p].seq2));
+        width = std::max(width, pairs[p].upperDiag - pairs[p].lowerDiag + 1);
+    }
+
+    // Interleave the sequence codes of the lanes.
+    S1.assign((size_t)(rows + width) * lanes, BANDED_ALIGNMENT_SENTINEL);
+    S2.assign((size_t)rows * lanes, BANDED_ALIGNMENT_SENTINEL);
+    K.assign((size_t)width * lanes, 0);
+    for (unsigned p = begin; p < end; ++p)
+    {
+        unsigned l = p - begin;
+        TSeq const & seq1 = *pairs[p].seq1;
+        TSeq const & seq2 = *pairs[p].seq2;
+        int n1 = length(seq1);
+        int lowerDiag = pairs[p].lowerDiag;
+
+        for (int i = 0; i < (int)length(seq2); ++i)
+            S2[(size_t)i * lanes + l] = ordValue(seq2[i]);
+        for (int x = std::max(0, -lowerDiag); x < rows + width && x + lowerDiag < n1; ++x)
+            S1[(size_t)x * lanes + l] = ordValue(seq1[x + lowerDiag]);
+        for (int k = 0; k < pairs[p].upperDiag - lowerDiag + 1; ++k)
+            K[(size_t)k * lanes + l] = -1;
+    }
+    prev.assign((size_t)(width + 1) * lanes, 0);
+    cur.assign((size_t)(width + 1) * lanes, 0);
+
+    unsigned mask = 0;
+#ifdef POPINS_X86_SIMD
+    if (lanes == 16)
+        mask = _bandedLocalBatchAvx2(&S1[0], &S2[0], &K[0], rows, width, sc, &prev[0], &cur[0]);
+    else
+        mask = _bandedLocalBatchSse41(&S1[0], &S2[0], &K[0], rows, width, sc, &prev[0], &cur[0]);
+#endif
+
+    for (unsigned p = begin; p < end; ++p)
+        aligned[p] = (mask >> (p - begin)) & 1;
+}
+
+// ==========================================================================
+// Function bandedLocalAlignments()
+// ==========================================================================
+
+// Verifies a batch of contig pairs like bandedLocalAlignment(), aligning as many pairs at once as there are SIMD
+// lanes. Sets aligned[i] to true if pair i scores more than minScore.
+template<typename TSeq>
+void
+bandedLocalAlignments(String<bool> & aligned,
+        String<BandedAlignmentPair<TSeq> > const & pairs,
+        Score<int, Simple> const & scoringScheme,
+        int minScore)
+{
+    BandedAlignmentScoring sc(scoringScheme, minScore);
+    resize(aligned, length(pairs), false);
+
+    unsigned lanes = 0;
+#ifdef POPINS_X86_SIMD
+    if (_fitsInt16(sc))
+    {
+        if (simdLevel() == SIMD_AVX2)
+            lanes = 16;
+        else if (simdLevel() == SIMD_SSE41)
+            lanes = 8;
+    }
+#endif
+
+    unsigned p = 0;
+    if (lanes != 0)
+    {
+        // Full batches only; the remaining pairs are aligned one by one.
+        for (; p + lanes <= length(pairs); p += lanes)
+            _bandedLocalBatch(aligned, pairs, p, p + lanes, lanes, sc);
+    }
+    for (; p < length(pairs); ++p)
+        aligned[p] = bandedLocalAlignment(*pairs[p].seq1, *pairs[p].seq2, scoringScheme,
+                pairs[p].lowerDiag, pairs[p].upperDiag, minScore);
+}
+
+#endif  // #ifndef POPINS_MERGE_BANDED_ALIGNMENT_H_
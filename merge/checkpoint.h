@@ -0,0 +1,284 @@
+#ifndef POPINS_MERGE_CHECKPOINT_H_
+#define POPINS_MERGE_CHECKPOINT_H_
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "contig_structs.h"
+#include "contig_store.h"
+#include "union_find.h"
+#include "aligned_pairs.h"
+#include "merge_state.h"
+
+using namespace seqan;
+
+// ============================================================================
+// Checkpoints
+// ============================================================================
+
+// Merge writes a checkpoint after each expensive phase so that an interrupted run can be continued with --resume:
+//
+//   <output>.checkpoint             phase and description of the input
+//   <output>.checkpoint.pairs       aligned pairs after partitioning
+//   <output>.checkpoint.components  components after adding the singletons
+//
+// A checkpoint is only used if the merge parameters and the contig files are the same as in the interrupted run,
+// which guarantees the same contig numbering. The checkpoint files are removed when merge finishes.
+
+enum CheckpointPhase
+{
+    CHECKPOINT_NONE,
+    CHECKPOINT_PARTITIONED,
+    CHECKPOINT_COMPONENTS
+};
+
+// --------------------------------------------------------------------------
+// Function checkpointFile()
+// --------------------------------------------------------------------------
+
+inline CharString
+checkpointFile(MergingOptions & options, char const * suffix)
+{
+    CharString filename = options.outputFile;
+    filename += ".checkpoint";
+    filename += suffix;
+    return filename;
+}
+
+// --------------------------------------------------------------------------
+// Function checkpointDescription()
+// --------------------------------------------------------------------------
+
+// Describes the input of the merge: parameters, number of contigs and the contig files in contig store order.
+inline std::string
+checkpointDescription(String<Pair<CharString> > & contigFiles, ContigStore & store, MergingOptions & options)
+{
+    std::ostringstream description;
+    description << "parameters\t" << mergeParameters(options) << "\n";
+    description << "contigs\t" << numFwdContigs(store) << "\n";
+    for (unsigned i = 0; i < length(contigFiles); ++i)
+        description << "contigFile\t" << contigFileDescription(contigFiles[i]) << "\n";
+    return description.str();
+}
+
+// --------------------------------------------------------------------------
+// Function _writeAtomically()
+// --------------------------------------------------------------------------
+
+inline bool
+_writeAtomically(CharString const & filename, std::string const & content)
+{
+    CharString tmpFilename = filename;
+    tmpFilename += ".tmp";
+
+    std::fstream stream(toCString(tmpFilename), std::ios::out);
+    if (!stream.is_open())
+    {
+        std::cerr << "ERROR: Could not open checkpoint file " << tmpFilename << " for writing." << std::endl;
+        return 1;
+    }
+    stream << content;
+    stream.close();
+
+    if (stream.fail() || rename(toCString(tmpFilename), toCString(filename)) != 0)
+    {
+        std::cerr << "ERROR: Could not write checkpoint file " << filename << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// ==========================================================================
+// Function readCheckpointPhase()
+// ==========================================================================
+
+// Returns the phase of the last checkpoint if it was written for the same input, CHECKPOINT_NONE otherwise.
+inline CheckpointPhase
+readCheckpointPhase(std::string const & description, MergingOptions & options)
+{
+    CharString filename = checkpointFile(options, "");
+    std::fstream stream(toCString(filename), std::ios::in);
+    if (!stream.is_open())
+    {
+        printStatus("No checkpoint to resume from, starting from the beginning.");
+        return CHECKPOINT_NONE;
+    }
+
+    std::string line;
+    std::getline(stream, line);
+    int phase = CHECKPOINT_NONE;
+    if (line.compare(0, 6, "phase\t") == 0)
+        phase = atoi(line.c_str() + 6);
+
+    std::ostringstream rest;
+    rest << stream.rdbuf();
+    if (rest.str() != description || phase < CHECKPOINT_PARTITIONED || phase > CHECKPOINT_COMPONENTS)
+    {
+        std::ostringstream msg;
+        msg << "Checkpoint " << filename << " was written for different input or parameters, starting from the beginning.";
+        printStatus(msg);
+        return CHECKPOINT_NONE;
+    }
+
+    std::ostringstream msg;
+    msg << "Resuming from checkpoint " << filename << " after "
+        << (phase == CHECKPOINT_PARTITIONED ? "partitioning" : "computing the components");
+    printStatus(msg);
+
+    return static_cast<CheckpointPhase>(phase);
+}
+
+// ==========================================================================
+// Function writeCheckpointPhase()
+// ==========================================================================
+
+inline bool
+writeCheckpointPhase(CheckpointPhase phase, std::string const & description, MergingOptions & options)
+{
+    std::ostringstream content;
+    content << "phase\t" << phase << "\n" << description;
+    return _writeAtomically(checkpointFile(options, ""), content.str());
+}
+
+// ==========================================================================
+// Function writePairsCheckpoint()
+// ==========================================================================
+
+template<typename TSize>
+bool
+writePairsCheckpoint(std::set<Pair<TSize> > & alignedPairs,
+        ContigStore & store,
+        std::string const & description,
+        MergingOptions & options)
+{
+    CharString filename = checkpointFile(options, ".pairs");
+    if (writeAlignedPairs(filename, alignedPairs, store) != 0)
+        return 1;
+    return writeCheckpointPhase(CHECKPOINT_PARTITIONED, description, options);
+}
+
+// ==========================================================================
+// Function readPairsCheckpoint()
+// ==========================================================================
+
+// Reads the aligned pairs of the checkpoint and rebuilds the union-find from them.
+template<typename TSize>
+bool
+readPairsCheckpoint(ConcurrentUnionFind & uf,
+        std::set<Pair<TSize> > & alignedPairs,
+        ContigStore & store,
+        MergingOptions & options)
+{
+    std::map<Pair<CharString>, TSize> contigIndices;
+    mapContigIds(contigIndices, store);
+
+    CharString filename = checkpointFile(options, ".pairs");
+    if (readAlignedPairs(uf, alignedPairs, filename, contigIndices, store, numFwdContigs(store)) != 0)
+        return 1;
+
+    std::ostringstream msg;
+    msg << "Number of valid alignments:     " << length(alignedPairs);
+    printStatus(msg);
+
+    return 0;
+}
+
+// ==========================================================================
+// Function writeComponentsCheckpoint()
+// ==========================================================================
+
+// Writes each component as a line with its key and number of aligned pairs, followed by one line per pair.
+template<typename TSize, typename TSeq>
+bool
+writeComponentsCheckpoint(std::map<TSize, ContigComponent<TSeq> > & components,
+        std::string const & description,
+        MergingOptions & options)
+{
+    typedef typename std::map<TSize, ContigComponent<TSeq> >::iterator TIter;
+    typedef typename std::set<Pair<TSize> >::iterator TPairIter;
+
+    std::ostringstream content;
+    for (TIter it = components.begin(); it != components.end(); ++it)
+    {
+        content << ">" << it->first << "\t" << it->second.alignedPairs.size() << "\n";
+        for (TPairIter p = it->second.alignedPairs.begin(); p != it->second.alignedPairs.end(); ++p)
+            content << (*p).i1 << "\t" << (*p).i2 << "\n";
+    }
+
+    if (_writeAtomically(checkpointFile(options, ".components"), content.str()) != 0)
+        return 1;
+    return writeCheckpointPhase(CHECKPOINT_COMPONENTS, description, options);
+}
+
+// ==========================================================================
+// Function readComponentsCheckpoint()
+// ==========================================================================
+
+template<typename TSize, typename TSeq>
+bool
+readComponentsCheckpoint(std::map<TSize, ContigComponent<TSeq> > & components,
+        ContigStore & store,
+        MergingOptions & options)
+{
+    CharString filename = checkpointFile(options, ".components");
+    std::fstream stream(toCString(filename), std::ios::in);
+    if (!stream.is_open())
+    {
+        std::cerr << "ERROR: Could not open checkpoint file " << filename << std::endl;
+        return 1;
+    }
+
+    TSize maxContig = 2 * numFwdContigs(store);
+    std::string line;
+    while (std::getline(stream, line))
+    {
+        TSize key = 0, i1 = 0, i2 = 0;
+        unsigned numPairs = 0;
+        std::istringstream header(line);
+        char c = 0;
+        if (!(header >> c >> key >> numPairs) || c != '>' || key >= maxContig)
+        {
+            std::cerr << "ERROR: Invalid line in checkpoint file " << filename << ": " << line << std::endl;
+            return 1;
+        }
+
+        ContigComponent<TSeq> & component = components[key];
+        for (unsigned i = 0; i < numPairs; ++i)
+        {
+            if (!std::getline(stream, line))
+            {
+                std::cerr << "ERROR: Checkpoint file " << filename << " is truncated." << std::endl;
+                return 1;
+            }
+            std::istringstream ss(line);
+            if (!(ss >> i1 >> i2) || i1 >= maxContig || i2 >= maxContig)
+            {
+                std::cerr << "ERROR: Invalid line in checkpoint file " << filename << ": " << line << std::endl;
+                return 1;
+            }
+            component.alignedPairs.insert(Pair<TSize>(i1, i2));
+        }
+    }
+
+    std::ostringstream msg;
+    msg << "There are " << components.size() << " components including singletons.";
+    printStatus(msg);
+
+    return 0;
+}
+
+// ==========================================================================
+// Function removeCheckpoints()
+// ==========================================================================
+
+inline void
+removeCheckpoints(MergingOptions & options)
+{
+    remove(toCString(checkpointFile(options, "")));
+    remove(toCString(checkpointFile(options, ".pairs")));
+    remove(toCString(checkpointFile(options, ".components")));
+}
+
+#endif  // #ifndef POPINS_MERGE_CHECKPOINT_H_
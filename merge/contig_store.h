@@ -0,0 +1,509 @@
+#ifndef POPINS_MERGE_CONTIG_STORE_H_
+#define POPINS_MERGE_CONTIG_STORE_H_
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "contig_structs.h"
+
+using namespace seqan;
+
+// ============================================================================
+// Contig store file layout
+// ============================================================================
+
+// The contig store holds the contigs of all samples in one binary file that merge memory-maps:
+//
+//   header | packed sequences | records | filtered records | N runs | sample names | names | manifest
+//
+// Sequences are packed with 2 bits per base (A=0, C=1, G=2, T=3) and start at a byte boundary. Stretches
+// of N are stored as runs and put back in when a sequence is decoded. Filtered records are the contigs
+// that failed the entropy filter; they are only kept for the skipped contigs file. The manifest lists the
+// input files with size and modification time and tells whether the store is up to date.
+
+static const char CONTIG_STORE_MAGIC[8] = {'P', 'O', 'P', 'I', 'N', 'S', 'C', 'S'};
+static const uint64_t CONTIG_STORE_VERSION = 1;
+
+struct ContigStoreHeader
+{
+    char magic[8];
+    uint64_t version;
+    uint64_t numSamples;
+    uint64_t numContigs;
+    uint64_t numFiltered;
+    uint64_t numNRuns;
+    uint64_t recordsOffset;
+    uint64_t filteredOffset;
+    uint64_t nRunsOffset;
+    uint64_t samplesOffset;
+    uint64_t namesOffset;
+    uint64_t namesLength;
+    uint64_t manifestOffset;
+    uint64_t manifestLength;
+};
+
+struct ContigStoreRecord
+{
+    uint64_t seqOffset;     // file offset of the packed sequence
+    uint64_t nameOffset;    // offset of the zero-terminated contig name in the names block
+    uint64_t nRunsBegin;    // index of the first N run of the contig
+    uint32_t length;
+    uint32_t numNRuns;
+    uint32_t sample;
+    uint32_t padding;
+    double entropy;
+};
+
+struct ContigStoreNRun
+{
+    uint32_t begin;
+    uint32_t length;
+};
+
+// ============================================================================
+// struct ContigStoreWriter
+// ============================================================================
+
+// Writes the packed sequences while the contig files are read and keeps the (small) tables in memory
+// until finishContigStore() appends them. The store is written to a temporary file and renamed at the end.
+
+struct ContigStoreWriter
+{
+    std::fstream stream;
+    CharString filename;
+    CharString tmpFilename;
+    uint64_t offset;
+
+    std::vector<ContigStoreRecord> records;
+    std::vector<ContigStoreRecord> filtered;
+    std::vector<ContigStoreNRun> nRuns;
+    std::vector<uint64_t> samples;
+    std::string names;
+    std::string manifest;
+
+    ContigStoreWriter() :
+        offset(0)
+    {}
+};
+
+// --------------------------------------------------------------------------
+// Function createContigStore()
+// --------------------------------------------------------------------------
+
+inline bool
+createContigStore(ContigStoreWriter & writer, CharString const & filename, std::string const & manifest)
+{
+    std::ostringstream tmp;
+    tmp << filename << "." << getpid() << ".tmp";
+
+    writer.filename = filename;
+    writer.tmpFilename = tmp.str();
+    writer.manifest = manifest;
+
+    writer.stream.open(toCString(writer.tmpFilename), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!writer.stream.is_open())
+    {
+        std::cerr << "ERROR: Could not open contig store " << writer.tmpFilename << " for writing." << std::endl;
+        return 1;
+    }
+
+    // Reserve space for the header; it is written by finishContigStore().
+    ContigStoreHeader header;
+    memset(&header, 0, sizeof(header));
+    writer.stream.write(reinterpret_cast<char const *>(&header), sizeof(header));
+    writer.offset = sizeof(header);
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+// Function addSample()                                     ContigStoreWriter
+// --------------------------------------------------------------------------
+
+inline unsigned
+addSample(ContigStoreWriter & writer, CharString const & sampleName)
+{
+    writer.samples.push_back(writer.names.size());
+    writer.names.append(toCString(sampleName));
+    writer.names.push_back('\0');
+    return writer.samples.size() - 1;
+}
+
+// --------------------------------------------------------------------------
+// Function appendContig()                                  ContigStoreWriter
+// --------------------------------------------------------------------------
+
+template<typename TSeq>
+void
+appendContig(ContigStoreWriter & writer,
+        unsigned sample,
+        CharString const & contigName,
+        TSeq const & seq,
+        double entropy,
+        bool passedFilter)
+{
+    ContigStoreRecord record;
+    memset(&record, 0, sizeof(record));
+    record.seqOffset = writer.offset;
+    record.nameOffset = writer.names.size();
+    record.nRunsBegin = writer.nRuns.size();
+    record.length = length(seq);
+    record.sample = sample;
+    record.entropy = entropy;
+
+    writer.names.append(toCString(contigName));
+    writer.names.push_back('\0');
+
+    // Pack the sequence and collect the runs of N.
+    std::string packed((length(seq) + 3) / 4, '\0');
+    for (unsigned i = 0; i < length(seq); ++i)
+    {
+        unsigned value = ordValue(seq[i]);
+        if (value > 3)
+        {
+            if (writer.nRuns.size() > record.nRunsBegin && writer.nRuns.back().begin + writer.nRuns.back().length == i)
+            {
+                ++writer.nRuns.back().length;
+            }
+            else
+            {
+                ContigStoreNRun run = {i, 1};
+                writer.nRuns.push_back(run);
+            }
+            value = 0;
+        }
+        packed[i / 4] |= value << (2 * (i % 4));
+    }
+    record.numNRuns = writer.nRuns.size() - record.nRunsBegin;
+
+    writer.stream.write(packed.data(), packed.size());
+    writer.offset += packed.size();
+
+    if (passedFilter)
+        writer.records.push_back(record);
+    else
+        writer.filtered.push_back(record);
+}
+
+// --------------------------------------------------------------------------
+// Function _writeBlock()                                   ContigStoreWriter
+// --------------------------------------------------------------------------
+
+// Writes a table 8-byte aligned and returns its file offset.
+inline uint64_t
+_writeBlock(ContigStoreWriter & writer, void const * data, uint64_t size)
+{
+    static const char zeros[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    uint64_t padding = (8 - writer.offset % 8) % 8;
+    writer.stream.write(zeros, padding);
+    writer.offset += padding;
+
+    uint64_t blockOffset = writer.offset;
+    writer.stream.write(static_cast<char const *>(data), size);
+    writer.offset += size;
+
+    return blockOffset;
+}
+
+// --------------------------------------------------------------------------
+// Function finishContigStore()                             ContigStoreWriter
+// --------------------------------------------------------------------------
+
+inline bool
+finishContigStore(ContigStoreWriter & writer)
+{
+    ContigStoreHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CONTIG_STORE_MAGIC, sizeof(header.magic));
+    header.version = CONTIG_STORE_VERSION;
+    header.numSamples = writer.samples.size();
+    header.numContigs = writer.records.size();
+    header.numFiltered = writer.filtered.size();
+    header.numNRuns = writer.nRuns.size();
+
+    header.recordsOffset = _writeBlock(writer, writer.records.data(), writer.records.size() * sizeof(ContigStoreRecord));
+    header.filteredOffset = _writeBlock(writer, writer.filtered.data(), writer.filtered.size() * sizeof(ContigStoreRecord));
+    header.nRunsOffset = _writeBlock(writer, writer.nRuns.data(), writer.nRuns.size() * sizeof(ContigStoreNRun));
+    header.samplesOffset = _writeBlock(writer, writer.samples.data(), writer.samples.size() * sizeof(uint64_t));
+    header.namesOffset = _writeBlock(writer, writer.names.data(), writer.names.size());
+    header.namesLength = writer.names.size();
+    header.manifestOffset = _writeBlock(writer, writer.manifest.data(), writer.manifest.size());
+    header.manifestLength = writer.manifest.size();
+
+    writer.stream.seekp(0);
+    writer.stream.write(reinterpret_cast<char const *>(&header), sizeof(header));
+    writer.stream.close();
+
+    if (writer.stream.fail() || rename(toCString(writer.tmpFilename), toCString(writer.filename)) != 0)
+    {
+        std::cerr << "ERROR: Could not write contig store " << writer.filename << std::endl;
+        remove(toCString(writer.tmpFilename));
+        return 1;
+    }
+
+    return 0;
+}
+
+// ============================================================================
+// struct ContigStore
+// ============================================================================
+
+// Read-only view of a memory-mapped contig store. Contig i in [0, n) is the i-th forward contig and
+// contig i + n is its reverse complement, as in the contig numbering used by partitionContigs().
+
+struct ContigStore
+{
+    int fd;
+    char const * data;
+    size_t size;
+
+    ContigStoreHeader const * header;
+    ContigStoreRecord const * records;
+    ContigStoreRecord const * filtered;
+    ContigStoreNRun const * nRuns;
+    uint64_t const * samples;
+    char const * names;
+
+    ContigStore() :
+        fd(-1), data(0), size(0), header(0), records(0), filtered(0), nRuns(0), samples(0), names(0)
+    {}
+
+    ~ContigStore()
+    {
+        if (data != 0) munmap(const_cast<char *>(data), size);
+        if (fd != -1) ::close(fd);
+    }
+
+private:
+    ContigStore(ContigStore const &);
+    ContigStore & operator=(ContigStore const &);
+};
+
+// --------------------------------------------------------------------------
+// Function closeContigStore()
+// --------------------------------------------------------------------------
+
+inline void
+closeContigStore(ContigStore & store)
+{
+    if (store.data != 0) munmap(const_cast<char *>(store.data), store.size);
+    if (store.fd != -1) ::close(store.fd);
+
+    store.fd = -1;
+    store.data = 0;
+    store.size = 0;
+    store.header = 0;
+}
+
+// --------------------------------------------------------------------------
+// Function openContigStore()
+// --------------------------------------------------------------------------
+
+inline bool
+openContigStore(ContigStore & store, CharString const & filename)
+{
+    closeContigStore(store);
+
+    store.fd = ::open(toCString(filename), O_RDONLY);
+    struct stat st;
+    if (store.fd == -1 || fstat(store.fd, &st) != 0)
+    {
+        std::cerr << "ERROR: Could not open contig store " << filename << std::endl;
+        closeContigStore(store);
+        return 1;
+    }
+    store.size = st.st_size;
+
+    if (store.size < sizeof(ContigStoreHeader))
+    {
+        std::cerr << "ERROR: Contig store " << filename << " is truncated." << std::endl;
+        closeContigStore(store);
+        return 1;
+    }
+
+    void * data = mmap(0, store.size, PROT_READ, MAP_SHARED, store.fd, 0);
+    if (data == MAP_FAILED)
+    {
+        std::cerr << "ERROR: Could not memory-map contig store " << filename << std::endl;
+        closeContigStore(store);
+        return 1;
+    }
+    store.data = static_cast<char const *>(data);
+
+    store.header = reinterpret_cast<ContigStoreHeader const *>(store.data);
+    ContigStoreHeader const & h = *store.header;
+    if (memcmp(h.magic, CONTIG_STORE_MAGIC, sizeof(h.magic)) != 0 || h.version != CONTIG_STORE_VERSION ||
+            h.recordsOffset + h.numContigs * sizeof(ContigStoreRecord) > store.size ||
+            h.filteredOffset + h.numFiltered * sizeof(ContigStoreRecord) > store.size ||
+            h.nRunsOffset + h.numNRuns * sizeof(ContigStoreNRun) > store.size ||
+            h.samplesOffset + h.numSamples * sizeof(uint64_t) > store.size ||
+            h.namesOffset + h.namesLength > store.size ||
+            h.manifestOffset + h.manifestLength > store.size)
+    {
+        std::cerr << "ERROR: " << filename << " is not a valid contig store." << std::endl;
+        closeContigStore(store);
+        return 1;
+    }
+
+    store.records = reinterpret_cast<ContigStoreRecord const *>(store.data + h.recordsOffset);
+    store.filtered = reinterpret_cast<ContigStoreRecord const *>(store.data + h.filteredOffset);
+    store.nRuns = reinterpret_cast<ContigStoreNRun const *>(store.data + h.nRunsOffset);
+    store.samples = reinterpret_cast<uint64_t const *>(store.data + h.samplesOffset);
+    store.names = store.data + h.namesOffset;
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+// Function contigFileDescription()
+// --------------------------------------------------------------------------
+
+// Describes a contig file of a sample by its sample id, path, size and modification time.
+inline std::string
+contigFileDescription(Pair<CharString> const & contigFile)
+{
+    struct stat st;
+    if (stat(toCString(contigFile.i2), &st) != 0)
+        st.st_size = st.st_mtime = 0;
+
+    std::ostringstream description;
+    description << contigFile.i1 << "\t" << contigFile.i2 << "\t" << st.st_size << "\t" << st.st_mtime;
+    return description.str();
+}
+
+// --------------------------------------------------------------------------
+// Function isCurrent()                                           ContigStore
+// --------------------------------------------------------------------------
+
+// Returns true if the store was built from the input files described by manifest.
+inline bool
+isCurrent(ContigStore const & store, std::string const & manifest)
+{
+    return store.header != 0 &&
+            store.header->manifestLength == manifest.size() &&
+            memcmp(store.data + store.header->manifestOffset, manifest.data(), manifest.size()) == 0;
+}
+
+// --------------------------------------------------------------------------
+// Function numFwdContigs()                                       ContigStore
+// --------------------------------------------------------------------------
+
+inline unsigned
+numFwdContigs(ContigStore const & store)
+{
+    return store.header->numContigs;
+}
+
+// --------------------------------------------------------------------------
+// Function contigSample()                                        ContigStore
+// --------------------------------------------------------------------------
+
+// Returns the sample number of contig i, which is cheaper to compare than the sample name.
+inline unsigned
+contigSample(ContigStore const & store, unsigned i)
+{
+    return store.records[i % store.header->numContigs].sample;
+}
+
+// --------------------------------------------------------------------------
+// Function _decodeContigSeq()                                    ContigStore
+// --------------------------------------------------------------------------
+
+template<typename TSeq>
+void
+_decodeContigSeq(TSeq & seq, ContigStore const & store, ContigStoreRecord const & record)
+{
+    static const char bases[4] = {'A', 'C', 'G', 'T'};
+
+    unsigned char const * packed = reinterpret_cast<unsigned char const *>(store.data + record.seqOffset);
+
+    resize(seq, record.length, Exact());
+    for (unsigned i = 0; i < record.length; ++i)
+        seq[i] = bases[(packed[i / 4] >> (2 * (i % 4))) & 3];
+
+    for (unsigned r = 0; r < record.numNRuns; ++r)
+    {
+        ContigStoreNRun const & run = store.nRuns[record.nRunsBegin + r];
+        for (unsigned i = run.begin; i < run.begin + run.length; ++i)
+            seq[i] = 'N';
+    }
+}
+
+// --------------------------------------------------------------------------
+// Function loadContigSeq()                                       ContigStore
+// --------------------------------------------------------------------------
+
+// Decodes the sequence of contig i, which is a reverse complement for i >= numFwdContigs(store).
+template<typename TSeq>
+void
+loadContigSeq(TSeq & seq, ContigStore const & store, unsigned i)
+{
+    unsigned n = store.header->numContigs;
+    _decodeContigSeq(seq, store, store.records[i % n]);
+    if (i >= n)
+        reverseComplement(seq);
+}
+
+// --------------------------------------------------------------------------
+// Function loadContigId()                                        ContigStore
+// --------------------------------------------------------------------------
+
+inline void
+loadContigId(ContigId & id, ContigStore const & store, unsigned i)
+{
+    unsigned n = store.header->numContigs;
+    ContigStoreRecord const & record = store.records[i % n];
+    id.pn = store.names + store.samples[record.sample];
+    id.contigId = store.names + record.nameOffset;
+    id.orientation = (i < n);
+}
+
+// --------------------------------------------------------------------------
+// Function loadContig()                                          ContigStore
+// --------------------------------------------------------------------------
+
+template<typename TSeq>
+void
+loadContig(Contig<TSeq> & contig, ContigStore const & store, unsigned i)
+{
+    loadContigSeq(contig.seq, store, i);
+    loadContigId(contig.id, store, i);
+}
+
+// --------------------------------------------------------------------------
+// Function writeFilteredContigs()                                ContigStore
+// --------------------------------------------------------------------------
+
+// Writes the contigs that failed the entropy filter to the skipped contigs file.
+template<typename TSeq, typename TStream>
+void
+writeFilteredContigs(TStream & stream, ContigStore const & store)
+{
+    for (unsigned j = 0; j < store.header->numFiltered; ++j)
+    {
+        ContigStoreRecord const & record = store.filtered[j];
+
+        ContigId id;
+        id.pn = store.names + store.samples[record.sample];
+        id.contigId = store.names + record.nameOffset;
+        id.orientation = true;
+
+        TSeq seq;
+        _decodeContigSeq(seq, store, record);
+
+        stream << ">" << id << " entropy: " << record.entropy << std::endl;
+        stream << seq << std::endl;
+    }
+}
+
+#endif  // #ifndef POPINS_MERGE_CONTIG_STORE_H_
@@ -116,7 +116,7 @@ struct ContigComponent
 {
     typedef typename Size<TSeq>::Type TSize;
 
-    StringSet<Contig<TSeq>, Dependent<> > contigs;
+    StringSet<Contig<TSeq> > contigs;
     std::set<Pair<TSize> > alignedPairs;
 
     ContigComponent()
@@ -1,12 +1,31 @@
 #ifndef POPINS_MERGE_SEQS_H_
 #define POPINS_MERGE_SEQS_H_
 
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+
 #include <seqan/align.h>
 
 #include "contig_structs.h"
+#include "contig_store.h"
+#include "work_stealing.h"
 
 using namespace seqan;
 
+// Maximum number of bytes of output of finished components kept in memory until it is written. Further finished
+// components are written to a spill file.
+#ifndef SUPERCONTIG_MAX_BUFFERED_BYTES
+#define SUPERCONTIG_MAX_BUFFERED_BYTES (256ul << 20)
+#endif
+
 // --------------------------------------------------------------------------
 // struct Path
 // --------------------------------------------------------------------------
@@ -167,9 +186,9 @@ enumeratePaths(String<Path<TSeq, typename ComponentGraph<TSeq>::TVertexDescripto
 // Function getSeqsByAlignOrder()
 // --------------------------------------------------------------------------
 
-template<typename TSeq,typename TContigs>
+template<typename TSeq>
 void
-getSeqsByAlignOrder(ContigComponent<TSeq> & component, TContigs & contigs)
+getSeqsByAlignOrder(ContigComponent<TSeq> & component, ContigStore & store)
 {
     typedef typename Size<TSeq>::Type TSize;
     typedef typename std::set<Pair<TSize> >::iterator TPairIter;
@@ -199,9 +218,13 @@ getSeqsByAlignOrder(ContigComponent<TSeq> & component, TContigs & contigs)
     }
     clear(ordered);
 
-    // --- bring contigs and contig ids into the order ---
+    // --- load contigs and contig ids in this order ---
     for (TSize i = 0; i < length(order); ++i)
-        appendValue(component.contigs, contigs[order[i]]);
+    {
+        Contig<TSeq> contig;
+        loadContig(contig, store, order[i]);
+        appendValue(component.contigs, contig);
+    }
 }
 
 // --------------------------------------------------------------------------
@@ -420,7 +443,7 @@ addSequencesToGraph(ComponentGraph<TSeq1> & compGraph,
 // Function mergeSequences()
 // --------------------------------------------------------------------------
 
-template<typename TSeq1, typename TSeq2, typename TSpec, typename TLength, typename TValueMatch, typename TValueError>
+template<typename TSeq1, typename TSeq2, typename TSpec, typename TLength, typename TValueMatch, typename TValueError, typename TStream>
 bool
 mergeSequences(String<TSeq1> & mergedSeqs,
         StringSet<Contig<TSeq2>, TSpec> & contigs,
@@ -428,7 +451,8 @@ mergeSequences(String<TSeq1> & mergedSeqs,
         TValueMatch matchScore,
         TValueError errorPenalty,
         unsigned qgramLength,
-        bool verbose)
+        bool verbose,
+        TStream & verboseStream)
 {
     typedef ComponentGraph<TSeq1> TGraph;
     typedef Path<TSeq1, typename TGraph::TVertexDescriptor> TPath;
@@ -443,11 +467,11 @@ mergeSequences(String<TSeq1> & mergedSeqs,
 
     if (verbose && numVertices(compGraph.graph) > 1)
     {
-        std::cout << compGraph.graph;
-        std::cout << "Vertex map:" << std::endl;
+        verboseStream << compGraph.graph;
+        verboseStream << "Vertex map:" << std::endl;
         for (TSize i = 0; i < length(compGraph.sequenceMap); ++i)
         {
-            std::cout << "Vertex: " << i << ", Length: " << length(compGraph.sequenceMap[i]) << std::endl;
+            verboseStream << "Vertex: " << i << ", Length: " << length(compGraph.sequenceMap[i]) << std::endl;
         }
     }
 
@@ -509,75 +533,373 @@ writeSupercontigs(TStream & outputStream, String<TSeq> & mergedSeqs, unsigned nu
     }
 }
 
+// --------------------------------------------------------------------------
+// struct SupercontigCacheEntry
+// --------------------------------------------------------------------------
+
+// Supercontigs of a component from a previous merge, reused by incremental merges as long as the component
+// consists of the same contigs.
+struct SupercontigCacheEntry
+{
+    String<CharString> seqs;
+    unsigned numContigs;
+    bool veryBranching;
+
+    SupercontigCacheEntry() :
+        numContigs(0), veryBranching(false)
+    {}
+};
+
+// Maps the sorted forward contig numbers of a component to its supercontigs.
+typedef std::map<std::vector<unsigned>, SupercontigCacheEntry> SupercontigCache;
+
+// --------------------------------------------------------------------------
+// struct SupercontigResult
+// --------------------------------------------------------------------------
+
+// Output of one component, buffered until the output of all preceding components has been written. If the
+// buffer budget is exceeded, the output is moved to the spill file and only its position is kept.
+struct SupercontigResult
+{
+    std::ostringstream output;
+    std::ostringstream skipped;
+    std::ostringstream verbose;
+    bool singleton;
+    bool branching;
+    bool veryBranching;
+    bool cached;
+
+    std::vector<unsigned> members;
+    SupercontigCacheEntry entry;
+
+    size_t bufferedBytes;
+    bool spilled;
+    std::streamoff spillOffset;
+    size_t outputLength;
+    size_t skippedLength;
+    size_t verboseLength;
+
+    SupercontigResult() :
+        singleton(false), branching(false), veryBranching(false), cached(false), bufferedBytes(0), spilled(false),
+        spillOffset(0), outputLength(0), skippedLength(0), verboseLength(0)
+    {}
+};
+
+// --------------------------------------------------------------------------
+// struct SupercontigSpill
+// --------------------------------------------------------------------------
+
+// File for the output of finished components that do not fit into the buffer budget. Workers append to it and
+// the writer reads the output back in component order.
+struct SupercontigSpill
+{
+    CharString file;
+    std::fstream stream;
+    std::mutex mutex;
+};
+
+// --------------------------------------------------------------------------
+// Function spillResult()
+// --------------------------------------------------------------------------
+
+// Moves the output of a finished component to the spill file. Returns false if the spill file cannot be written.
+inline bool
+spillResult(SupercontigResult & result, SupercontigSpill & spill)
+{
+    std::string output = result.output.str();
+    std::string skipped = result.skipped.str();
+    std::string verbose = result.verbose.str();
+
+    std::lock_guard<std::mutex> lock(spill.mutex);
+    if (!spill.stream.is_open())
+    {
+        spill.stream.open(toCString(spill.file), std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary);
+        if (!spill.stream.is_open())
+            return false;
+    }
+
+    spill.stream.seekp(0, std::ios::end);
+    result.spillOffset = spill.stream.tellp();
+    spill.stream << output << skipped << verbose;
+    if (!spill.stream.good())
+        return false;
+
+    result.outputLength = output.size();
+    result.skippedLength = skipped.size();
+    result.verboseLength = verbose.size();
+    result.output.str("");
+    result.skipped.str("");
+    result.verbose.str("");
+    result.spilled = true;
+    return true;
+}
+
+// --------------------------------------------------------------------------
+// Function readSpilledResult()
+// --------------------------------------------------------------------------
+
+// Reads the output of a component back from the spill file.
+inline void
+readSpilledResult(std::string & output,
+        std::string & skipped,
+        std::string & verbose,
+        SupercontigResult const & result,
+        SupercontigSpill & spill)
+{
+    std::lock_guard<std::mutex> lock(spill.mutex);
+    spill.stream.seekg(result.spillOffset);
+    output.resize(result.outputLength);
+    skipped.resize(result.skippedLength);
+    verbose.resize(result.verboseLength);
+    spill.stream.read(&output[0], output.size());
+    spill.stream.read(&skipped[0], skipped.size());
+    spill.stream.read(&verbose[0], verbose.size());
+}
+
+// --------------------------------------------------------------------------
+// Function componentMembers()
+// --------------------------------------------------------------------------
+
+// Lists the forward contig numbers of the contigs in a component.
+template<typename TSequence>
+void
+componentMembers(std::vector<unsigned> & members, ContigComponent<TSequence> const & component, unsigned fwdContigCount)
+{
+    typedef typename Size<TSequence>::Type TSize;
+    typedef typename std::set<Pair<TSize> >::const_iterator TPairIter;
+
+    members.clear();
+    for (TPairIter it = component.alignedPairs.begin(); it != component.alignedPairs.end(); ++it)
+        members.push_back((*it).i1 % fwdContigCount);
+
+    std::sort(members.begin(), members.end());
+    members.erase(std::unique(members.begin(), members.end()), members.end());
+}
+
+// --------------------------------------------------------------------------
+// Function constructSupercontig()
+// --------------------------------------------------------------------------
+
+template<typename TSize, typename TSequence>
+void
+constructSupercontig(SupercontigResult & result,
+        TSize key,
+        ContigComponent<TSequence> const & comp,
+        ContigStore & store,
+        SupercontigCache const & cache,
+        unsigned pos,
+        MergingOptions & options)
+{
+    ContigComponent<TSequence> component = comp;
+
+    // Output component if consisting of a single contig.
+    if (length(component.alignedPairs) == 0)
+    {
+        Contig<TSequence> contig;
+        loadContig(contig, store, key);
+        if (contig.id.orientation == false)
+        {
+            contig.id.orientation = true;
+            reverseComplement(contig.seq);
+        }
+        result.output << ">" << contig.id << std::endl;
+        result.output << contig.seq << std::endl;
+
+        result.singleton = true;
+        return;
+    }
+
+    // Reuse the supercontigs of a previous merge if the component has not changed.
+    componentMembers(result.members, component, numFwdContigs(store));
+    SupercontigCache::const_iterator cached = cache.find(result.members);
+    if (cached != cache.end())
+    {
+        result.entry = cached->second;
+        result.cached = true;
+        if (result.entry.veryBranching)
+        {
+            if (options.skippedFile != "")
+            {
+                getSeqsByAlignOrder(component, store);
+                writeSkippedBranching(result.skipped, component.contigs);
+            }
+            result.veryBranching = true;
+            result.branching = true;
+            return;
+        }
+        if (length(result.entry.seqs) > 1) result.branching = true;
+        writeSupercontigs(result.output, result.entry.seqs, result.entry.numContigs, pos);
+        return;
+    }
+
+    // Sort the contigs for merging.
+    getSeqsByAlignOrder(component, store);
+    result.entry.numContigs = length(component.contigs);
+
+    if (options.verbose) result.verbose << "COMPONENT_" << pos << " size:" << length(component.contigs) << std::endl;
+
+    // --- MERGE CONTIGS OF THE COMPONENT ---
+    String<TSequence> mergedSeqs;
+    if (!mergeSequences(mergedSeqs, component.contigs,
+            options.minTipScore, options.matchScore, options.errorPenalty, options.qgramLength,
+            options.verbose, result.verbose))
+    {
+        if (options.verbose)
+            result.verbose << "COMPONENT_" << pos << " size:" << length(component.contigs) << " given up." << std::endl;
+        if (options.skippedFile != "")
+            writeSkippedBranching(result.skipped, component.contigs);
+        result.veryBranching = true;
+        result.branching = true;
+        result.entry.veryBranching = true;
+        return;
+    }
+
+    if (length(mergedSeqs) > 1) result.branching = true;
+    for (unsigned i = 0; i < length(mergedSeqs); ++i)
+        appendValue(result.entry.seqs, CharString(mergedSeqs[i]));
+
+    // Output the supercontig.
+    writeSupercontigs(result.output, mergedSeqs, length(component.contigs), pos);
+}
+
 // ==========================================================================
 // Function constructSupercontigs()
 // ==========================================================================
 
-template<typename TSize, typename TSequence, typename TContigs>
+// Constructs the supercontigs of all components. Components found in the cache are not merged again; on return,
+// the cache holds the supercontigs of the current components.
+template<typename TSize, typename TSequence>
 void
 constructSupercontigs(std::map<TSize, ContigComponent<TSequence> > & components,
-        TContigs & contigs,
+        ContigStore & store,
+        SupercontigCache & cache,
         MergingOptions & options)
 {
     typedef std::map<TSize, ContigComponent<TSequence> > TComponents;
 
     printStatus("Constructing supercontigs");
 
-    unsigned numSingleton = 0;
-    unsigned numBranching = 0;
-    unsigned numVeryBranching = 0;
-
-    // Iterate over the set of components.
+    // Number the components in map order; singletons do not get a COMPONENT_ number.
+    std::vector<typename TComponents::iterator> tasks;
+    std::vector<unsigned> positions;
     unsigned pos = 0;
     for (typename TComponents::iterator it = components.begin(); it != components.end(); ++it)
     {
-        ContigComponent<TSequence> component = it->second;
+        tasks.push_back(it);
+        positions.push_back(pos);
+        if (length(it->second.alignedPairs) != 0) ++pos;
+    }
 
-        // Output component if consisting of a single contig.
-        if (length(component.alignedPairs) == 0)
+    // Results are allocated when a component is started and freed once written. The output of finished components
+    // waiting for the output of a preceding, expensive component is kept in memory up to a budget and spilled
+    // to disk beyond that, so that the workers never wait for the writer.
+    std::vector<std::unique_ptr<SupercontigResult> > results(tasks.size());
+    std::vector<char> done(tasks.size(), 0);
+    size_t bufferedBytes = 0;
+    bool spillFailed = false;
+    std::mutex doneMutex;
+    std::condition_variable doneCondition;
+
+    SupercontigSpill spill;
+    spill.file = options.outputFile;
+    spill.file += ".spill";
+
+    // Merge the components on a work-stealing pool; costs per component are very skewed.
+    WorkStealingQueues queues;
+    initTasks(queues, tasks.size(), options.threads);
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < options.threads; ++t)
+    {
+        workers.push_back(std::thread([&, t]()
         {
-            if (contigs[it->first].id.orientation == false)
+            size_t task;
+            while (popTask(task, queues, t))
             {
-                contigs[it->first].id.orientation = true;
-                reverseComplement(contigs[it->first].seq);
+                std::unique_ptr<SupercontigResult> result(new SupercontigResult);
+                constructSupercontig(*result, tasks[task]->first, tasks[task]->second, store, cache, positions[task],
+                        options);
+
+                size_t bytes = (size_t)result->output.tellp() + (size_t)result->skipped.tellp() + (size_t)result->verbose.tellp();
+                bool toSpill = false;
+                {
+                    std::lock_guard<std::mutex> lock(doneMutex);
+                    if (bufferedBytes + bytes > SUPERCONTIG_MAX_BUFFERED_BYTES)
+                        toSpill = true;
+                    else
+                        bufferedBytes += bytes;
+                }
+                if (toSpill && !spillResult(*result, spill))
+                {
+                    // Keep the output in memory rather than lose it.
+                    std::lock_guard<std::mutex> lock(doneMutex);
+                    spillFailed = true;
+                    bufferedBytes += bytes;
+                    toSpill = false;
+                }
+                if (!toSpill)
+                    result->bufferedBytes = bytes;
+
+                std::lock_guard<std::mutex> lock(doneMutex);
+                results[task] = std::move(result);
+                done[task] = 1;
+                doneCondition.notify_one();
             }
-            options.outputStream << ">" << contigs[it->first].id << std::endl;
-            options.outputStream << contigs[it->first].seq << std::endl;
+        }));
+    }
 
-            ++numSingleton;
-            continue;
+    // Write the buffered output in component order.
+    SupercontigCache newCache;
+    unsigned numSingleton = 0;
+    unsigned numBranching = 0;
+    unsigned numVeryBranching = 0;
+    unsigned numCached = 0;
+    std::string output, skipped, verbose;
+    for (size_t task = 0; task < tasks.size(); ++task)
+    {
+        std::unique_ptr<SupercontigResult> result;
+        {
+            std::unique_lock<std::mutex> lock(doneMutex);
+            doneCondition.wait(lock, [&]() { return done[task] != 0; });
+            result = std::move(results[task]);
         }
 
-        // Sort the contigs for merging.
-        getSeqsByAlignOrder(component, contigs);
-
-        if (options.verbose) std::cout << "COMPONENT_" << pos << " size:" << length(component.contigs) << std::endl;
-
-        // --- MERGE CONTIGS OF THE COMPONENT ---
-        String<TSequence> mergedSeqs;
-        if (!mergeSequences(mergedSeqs, component.contigs,
-                options.minTipScore, options.matchScore, options.errorPenalty, options.qgramLength,
-                options.verbose))
+        if (result->spilled)
         {
-            if (options.verbose)
-                std::cout << "COMPONENT_" << pos << " size:" << length(component.contigs) << " given up." << std::endl;
-            if (options.skippedFile != "")
-                writeSkippedBranching(options.skippedStream, component.contigs);
-            ++numVeryBranching;
-            ++numBranching;
-            clear(component);
-            ++pos;
-            continue;
+            readSpilledResult(output, skipped, verbose, *result, spill);
         }
+        else
+        {
+            output = result->output.str();
+            skipped = result->skipped.str();
+            verbose = result->verbose.str();
+        }
+        if (options.verbose) std::cout << verbose;
+        if (options.skippedFile != "") options.skippedStream << skipped;
+        options.outputStream << output;
+
+        if (result->singleton) ++numSingleton;
+        if (result->branching) ++numBranching;
+        if (result->veryBranching) ++numVeryBranching;
+        if (result->cached) ++numCached;
+        if (!result->singleton) std::swap(newCache[result->members], result->entry);
+
+        std::lock_guard<std::mutex> lock(doneMutex);
+        bufferedBytes -= result->bufferedBytes;
+    }
 
-        if (length(mergedSeqs) > 1) ++numBranching;
-
-        // Output the supercontig.
-        writeSupercontigs(options.outputStream, mergedSeqs, length(component.contigs), pos);
+    for (unsigned t = 0; t < workers.size(); ++t)
+        workers[t].join();
 
-        clear(component);
-        ++pos;
+    if (spill.stream.is_open())
+    {
+        spill.stream.close();
+        remove(toCString(spill.file));
     }
+    if (spillFailed)
+        std::cerr << "WARNING: Could not write to " << spill.file << ", kept all supercontig output in memory." << std::endl;
+
+    std::swap(cache, newCache);
 
     options.outputStream.close();
 
@@ -592,6 +914,13 @@ constructSupercontigs(std::map<TSize, ContigComponent<TSequence> > & components,
     msg.str("");
     msg << numBranching << " components are branching, given up on " << numVeryBranching << " of them.";
     printStatus(msg);
+
+    if (numCached > 0)
+    {
+        msg.str("");
+        msg << numCached << " components are unchanged since the previous merge and were not merged again.";
+        printStatus(msg);
+    }
 }
 
 #endif // #ifndef POPINS_MERGE_SEQS_H_
@@ -0,0 +1,401 @@
+#ifndef POPINS_MERGE_STATE_H_
+#define POPINS_MERGE_STATE_H_
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "contig_store.h"
+#include "partition.h"
+#include "aligned_pairs.h"
+#include "merge_seqs.h"
+
+using namespace seqan;
+
+// ============================================================================
+// struct MergeState
+// ============================================================================
+
+// State of a previous merge kept in the state directory for incremental merges:
+//
+//   merge.state         parameters, contig files in contig store order, number of contigs, index generations
+//   index.<g>.*         q-gram index over the contigs added by the g-th merge
+//   aligned.pairs       aligned pairs of all contigs
+//   supercontigs.cache  supercontigs per component
+//
+// Contigs keep their numbers as long as the contig files of earlier samples do not change, because the
+// contig files of new samples are always appended to the contig store.
+
+struct MergeState
+{
+    std::string parameters;
+    std::vector<std::string> contigFiles;
+    unsigned numContigs;
+    std::vector<int> generationEnds;
+
+    MergeState() :
+        numContigs(0)
+    {}
+};
+
+// --------------------------------------------------------------------------
+// Function mergeParameters()
+// --------------------------------------------------------------------------
+
+// Options that change the aligned pairs or the supercontigs; the state is only reused if they are unchanged.
+inline std::string
+mergeParameters(MergingOptions & options)
+{
+    std::ostringstream params;
+    params << std::setprecision(17)
+           << "minEntropy=" << options.minEntropy << ";errRate=" << options.errorRate
+           << ";minLength=" << options.minimalLength << ";kmerLength=" << options.qgramLength
+           << ";match=" << options.matchScore << ";penalty=" << options.errorPenalty
+           << ";minScore=" << options.minScore << ";minTipScore=" << options.minTipScore << ";filter=" << options.filter;
+    if (options.filter == "minimizer")
+        params << ";minimizerK=" << options.minimizerK << ";minimizerW=" << options.minimizerW
+               << ";minSeeds=" << options.minSeeds;
+    return params.str();
+}
+
+// --------------------------------------------------------------------------
+// Function generationFile()
+// --------------------------------------------------------------------------
+
+inline CharString
+generationFile(MergingOptions & options, unsigned g)
+{
+    std::ostringstream name;
+    name << "index." << g;
+    return getFileName(options.stateDir, CharString(name.str()));
+}
+
+// ==========================================================================
+// Function readMergeState()
+// ==========================================================================
+
+// Reads merge.state from the state directory. Leaves the state empty if there is none.
+inline bool
+readMergeState(MergeState & state, MergingOptions & options)
+{
+    state = MergeState();
+
+    CharString filename = getFileName(options.stateDir, "merge.state");
+    if (!exists(filename))
+        return 0;
+
+    std::fstream stream(toCString(filename), std::ios::in);
+    if (!stream.is_open())
+    {
+        std::cerr << "ERROR: Could not open merge state file " << filename << std::endl;
+        return 1;
+    }
+
+    std::string line;
+    while (std::getline(stream, line))
+    {
+        size_t tab = line.find('\t');
+        std::string key = line.substr(0, tab);
+        std::string value = (tab == std::string::npos) ? "" : line.substr(tab + 1);
+
+        if (key == "parameters")
+            state.parameters = value;
+        else if (key == "contigFile")
+            state.contigFiles.push_back(value);
+        else if (key == "contigs")
+            state.numContigs = atoi(value.c_str());
+        else if (key == "generation")
+            state.generationEnds.push_back(atoi(value.c_str()));
+        else
+        {
+            std::cerr << "ERROR: Invalid line in merge state file " << filename << ": " << line << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// ==========================================================================
+// Function writeMergeState()
+// ==========================================================================
+
+// Writes merge.state. This is done last so that an interrupted merge leaves the previous state intact.
+inline bool
+writeMergeState(MergeState & state, MergingOptions & options)
+{
+    CharString filename = getFileName(options.stateDir, "merge.state");
+    CharString tmpFilename = filename;
+    tmpFilename += ".tmp";
+
+    std::fstream stream(toCString(tmpFilename), std::ios::out);
+    if (!stream.is_open())
+    {
+        std::cerr << "ERROR: Could not open merge state file " << tmpFilename << " for writing." << std::endl;
+        return 1;
+    }
+
+    stream << "parameters\t" << state.parameters << "\n";
+    for (unsigned i = 0; i < state.contigFiles.size(); ++i)
+        stream << "contigFile\t" << state.contigFiles[i] << "\n";
+    stream << "contigs\t" << state.numContigs << "\n";
+    for (unsigned g = 0; g < state.generationEnds.size(); ++g)
+        stream << "generation\t" << state.generationEnds[g] << "\n";
+
+    stream.close();
+    if (stream.fail() || rename(toCString(tmpFilename), toCString(filename)) != 0)
+    {
+        std::cerr << "ERROR: Could not write merge state file " << filename << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+// Function applyMergeState()
+// --------------------------------------------------------------------------
+
+// Puts the contig files of the samples in the state first, in their previous order, followed by the new samples.
+// Returns false and clears the state if it cannot be continued: the parameters changed, or a contig file of
+// a previous sample changed or disappeared.
+inline bool
+applyMergeState(String<Pair<CharString> > & contigFiles, MergeState & state, MergingOptions & options)
+{
+    if (state.numContigs == 0)
+        return false;
+
+    std::map<std::string, unsigned> fileIndices;
+    for (unsigned i = 0; i < length(contigFiles); ++i)
+        fileIndices[contigFileDescription(contigFiles[i])] = i;
+
+    bool valid = (state.parameters == mergeParameters(options));
+    for (unsigned i = 0; valid && i < state.contigFiles.size(); ++i)
+        valid = fileIndices.count(state.contigFiles[i]) != 0;
+
+    if (!valid)
+    {
+        state = MergeState();
+        return false;
+    }
+
+    String<Pair<CharString> > ordered;
+    std::vector<bool> used(length(contigFiles), false);
+    for (unsigned i = 0; i < state.contigFiles.size(); ++i)
+    {
+        unsigned j = fileIndices[state.contigFiles[i]];
+        appendValue(ordered, contigFiles[j]);
+        used[j] = true;
+    }
+    for (unsigned j = 0; j < length(contigFiles); ++j)
+        if (!used[j])
+            appendValue(ordered, contigFiles[j]);
+
+    contigFiles = ordered;
+    return true;
+}
+
+// --------------------------------------------------------------------------
+// Function checkStateContigs()
+// --------------------------------------------------------------------------
+
+// Returns true if the first state.numContigs contigs of the store are exactly the contigs of the previous samples.
+inline bool
+checkStateContigs(ContigStore & store, MergeState & state)
+{
+    unsigned n = numFwdContigs(store);
+    unsigned numSamples = state.contigFiles.size();
+
+    if (state.numContigs > n)
+        return false;
+    if (state.numContigs > 0 && contigSample(store, state.numContigs - 1) >= numSamples)
+        return false;
+    if (state.numContigs < n && contigSample(store, state.numContigs) < numSamples)
+        return false;
+    // The minimizer filter keeps no index generations.
+    if (!state.generationEnds.empty() && state.generationEnds.back() != (int)state.numContigs)
+        return false;
+
+    return true;
+}
+
+// ==========================================================================
+// Function loadGenerations()
+// ==========================================================================
+
+template<typename TSeq>
+bool
+loadGenerations(ContigIndex<TSeq> & index, MergeState & state, MergingOptions & options)
+{
+    typedef typename ContigIndex<TSeq>::TIndex TIndex;
+
+    for (unsigned g = 0; g < state.generationEnds.size(); ++g)
+    {
+        CharString filename = generationFile(options, g);
+
+        std::unique_ptr<TIndex> generation(new TIndex());
+        resize(indexShape(*generation), options.qgramLength);
+        if (!open(*generation, toCString(filename)) ||
+                (int)length(indexText(*generation)) != state.generationEnds[g] - index.begins.back())
+        {
+            std::cerr << "ERROR: Could not load q-gram index " << filename << std::endl;
+            return 1;
+        }
+
+        index.generations.push_back(std::move(generation));
+        index.begins.push_back(state.generationEnds[g]);
+    }
+
+    std::ostringstream msg;
+    msg << "- Loaded " << state.generationEnds.size() << " q-gram index generations over " << state.numContigs << " contigs";
+    printStatus(msg);
+
+    return 0;
+}
+
+// ==========================================================================
+// Function saveGeneration()
+// ==========================================================================
+
+template<typename TSeq>
+bool
+saveGeneration(ContigIndex<TSeq> & index, unsigned g, MergingOptions & options)
+{
+    CharString filename = generationFile(options, g);
+    if (!save(*index.generations[g], toCString(filename)))
+    {
+        std::cerr << "ERROR: Could not save q-gram index " << filename << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// ==========================================================================
+// Function readStatePairs()
+// ==========================================================================
+
+// Reads the aligned pairs of the previous merge and joins them into the union-find.
+template<typename TSize>
+bool
+readStatePairs(ConcurrentUnionFind & uf,
+        std::set<Pair<TSize> > & alignedPairs,
+        ContigStore & store,
+        MergeState & state,
+        MergingOptions & options)
+{
+    std::map<Pair<CharString>, TSize> contigIndices;
+    mapContigIds(contigIndices, store);
+
+    CharString filename = getFileName(options.stateDir, "aligned.pairs");
+    if (readAlignedPairs(uf, alignedPairs, filename, contigIndices, store, state.numContigs) != 0)
+        return 1;
+
+    std::ostringstream msg;
+    msg << "- Loaded " << alignedPairs.size() << " aligned pairs of the previous merge";
+    printStatus(msg);
+
+    return 0;
+}
+
+// ==========================================================================
+// Function readSupercontigCache()
+// ==========================================================================
+
+// Reads the supercontigs of the previous merge. Each component is written as a line
+//   >member1,member2,...<TAB>numContigs<TAB>veryBranching<TAB>numSeqs
+// followed by numSeqs lines of sequence.
+inline bool
+readSupercontigCache(SupercontigCache & cache, MergingOptions & options)
+{
+    cache.clear();
+
+    CharString filename = getFileName(options.stateDir, "supercontigs.cache");
+    if (!exists(filename))
+        return 0;
+
+    std::fstream stream(toCString(filename), std::ios::in);
+    if (!stream.is_open())
+    {
+        std::cerr << "ERROR: Could not open supercontig cache " << filename << std::endl;
+        return 1;
+    }
+
+    std::string line;
+    while (std::getline(stream, line))
+    {
+        std::istringstream ss(line);
+        std::string members;
+        SupercontigCacheEntry entry;
+        unsigned numSeqs = 0;
+        if (line.empty() || line[0] != '>' || !(ss >> members >> entry.numContigs >> entry.veryBranching >> numSeqs))
+        {
+            std::cerr << "ERROR: Invalid line in supercontig cache " << filename << ": " << line << std::endl;
+            return 1;
+        }
+
+        std::vector<unsigned> key;
+        std::istringstream memberStream(members.substr(1));
+        std::string member;
+        while (std::getline(memberStream, member, ','))
+            key.push_back(atoi(member.c_str()));
+
+        for (unsigned i = 0; i < numSeqs; ++i)
+        {
+            if (!std::getline(stream, line))
+            {
+                std::cerr << "ERROR: Supercontig cache " << filename << " is truncated." << std::endl;
+                return 1;
+            }
+            appendValue(entry.seqs, CharString(line));
+        }
+
+        cache[key] = entry;
+    }
+
+    return 0;
+}
+
+// ==========================================================================
+// Function writeSupercontigCache()
+// ==========================================================================
+
+inline bool
+writeSupercontigCache(SupercontigCache & cache, MergingOptions & options)
+{
+    CharString filename = getFileName(options.stateDir, "supercontigs.cache");
+    CharString tmpFilename = filename;
+    tmpFilename += ".tmp";
+
+    std::fstream stream(toCString(tmpFilename), std::ios::out);
+    if (!stream.is_open())
+    {
+        std::cerr << "ERROR: Could not open supercontig cache " << tmpFilename << " for writing." << std::endl;
+        return 1;
+    }
+
+    for (SupercontigCache::iterator it = cache.begin(); it != cache.end(); ++it)
+    {
+        stream << ">";
+        for (unsigned i = 0; i < it->first.size(); ++i)
+            stream << (i == 0 ? "" : ",") << it->first[i];
+        stream << "\t" << it->second.numContigs << "\t" << it->second.veryBranching << "\t" << length(it->second.seqs) << "\n";
+        for (unsigned i = 0; i < length(it->second.seqs); ++i)
+            stream << it->second.seqs[i] << "\n";
+    }
+
+    stream.close();
+    if (stream.fail() || rename(toCString(tmpFilename), toCString(filename)) != 0)
+    {
+        std::cerr << "ERROR: Could not write supercontig cache " << filename << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+#endif  // #ifndef POPINS_MERGE_STATE_H_
@@ -0,0 +1,457 @@
+#ifndef POPINS_MERGE_MINIMIZER_FILTER_H_
+#define POPINS_MERGE_MINIMIZER_FILTER_H_
+
+#include <cstdint>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <algorithm>
+
+#include "contig_structs.h"
+#include "contig_store.h"
+#include "union_find.h"
+#include "banded_alignment.h"
+#include "partition.h"
+
+using namespace seqan;
+
+// ============================================================================
+// Minimizer filter
+// ============================================================================
+
+// Alternative to the SWIFT filter for --filter minimizer. Every forward contig is sketched by its (w,k)-minimizers,
+// the smallest hash value among each w consecutive k-mers. A query contig's minimizers are looked up in a table of
+// all minimizers sorted by hash. The seeds to each target contig are clustered by diagonal, and a cluster becomes a
+// candidate for the banded verification if it holds a chain of at least --minSeeds co-linear seeds. Minimizers
+// that occur more than MINIMIZER_MAX_OCC times are ignored, which removes most hits between repetitive contigs.
+
+const unsigned MINIMIZER_MAX_OCC = 1000;
+
+// --------------------------------------------------------------------------
+// struct MinimizerEntry
+// --------------------------------------------------------------------------
+
+struct MinimizerEntry
+{
+    uint64_t hash;
+    int contig;
+    int pos;
+
+    MinimizerEntry() :
+        hash(0), contig(0), pos(0)
+    {}
+
+    MinimizerEntry(uint64_t h, int c, int p) :
+        hash(h), contig(c), pos(p)
+    {}
+
+    bool operator<(MinimizerEntry const & other) const
+    {
+        if (hash != other.hash) return hash < other.hash;
+        if (contig != other.contig) return contig < other.contig;
+        return pos < other.pos;
+    }
+};
+
+// --------------------------------------------------------------------------
+// struct MinimizerSeed
+// --------------------------------------------------------------------------
+
+// A shared minimizer of the query at qPos and target contig b at tPos, on diagonal qPos - tPos.
+struct MinimizerSeed
+{
+    int contig;
+    int diag;
+    int qPos;
+    int tPos;
+
+    MinimizerSeed(int c, int q, int t) :
+        contig(c), diag(q - t), qPos(q), tPos(t)
+    {}
+
+    bool operator<(MinimizerSeed const & other) const
+    {
+        if (contig != other.contig) return contig < other.contig;
+        if (diag != other.diag) return diag < other.diag;
+        return qPos < other.qPos;
+    }
+};
+
+// --------------------------------------------------------------------------
+// struct MinimizerIndex
+// --------------------------------------------------------------------------
+
+template<typename TSeq>
+struct MinimizerIndex
+{
+    typedef TSeq TSequence;
+
+    // Buffers of one thread for sketching and chaining.
+    struct TFilter
+    {
+        std::vector<MinimizerEntry> sketch;
+        std::vector<MinimizerSeed> seeds;
+        std::vector<int> chain;
+        String<VerifiedHit> candidates;
+    };
+
+    StringSet<TSeq> seqs;                   // forward contigs
+    std::vector<MinimizerEntry> table;      // minimizers of all forward contigs, sorted
+    unsigned k;
+    unsigned w;
+
+    MinimizerIndex() :
+        k(0), w(0)
+    {}
+};
+
+// --------------------------------------------------------------------------
+// Function _minimizerHash()
+// --------------------------------------------------------------------------
+
+// Invertible integer hash of a 2-bit encoded k-mer, so that minimizers are not biased towards poly-A.
+inline uint64_t
+_minimizerHash(uint64_t key, uint64_t mask)
+{
+    key = (~key + (key << 21)) & mask;
+    key = key ^ (key >> 24);
+    key = ((key + (key << 3)) + (key << 8)) & mask;
+    key = key ^ (key >> 14);
+    key = ((key + (key << 2)) + (key << 4)) & mask;
+    key = key ^ (key >> 28);
+    key = (key + (key << 31)) & mask;
+    return key;
+}
+
+// --------------------------------------------------------------------------
+// Function sketchContig()
+// --------------------------------------------------------------------------
+
+// Appends the (w,k)-minimizers of seq to sketch, tagged with contig. K-mers with N are skipped.
+template<typename TSeq>
+void
+sketchContig(std::vector<MinimizerEntry> & sketch, TSeq const & seq, int contig, unsigned k, unsigned w)
+{
+    uint64_t mask = (k < 32) ? ((uint64_t)1 << (2 * k)) - 1 : ~(uint64_t)0;
+    uint64_t kmer = 0;
+    unsigned runLength = 0;     // bases since the last N
+    unsigned runKmers = 0;      // k-mers since the last N
+    int lastPos = -1;
+    std::deque<MinimizerEntry> window;
+
+    int n = length(seq);
+    for (int i = 0; i <= n; ++i)
+    {
+        unsigned c = (i < n) ? ordValue(seq[i]) : 4;
+        if (c > 3)
+        {
+            // Output the minimizer of a stretch shorter than the window.
+            if (runKmers > 0 && runKmers < w && window.front().pos != lastPos)
+            {
+                sketch.push_back(window.front());
+                lastPos = window.front().pos;
+            }
+            kmer = 0;
+            runLength = runKmers = 0;
+            window.clear();
+            continue;
+        }
+
+        kmer = ((kmer << 2) | c) & mask;
+        if (++runLength < k)
+            continue;
+
+        MinimizerEntry entry(_minimizerHash(kmer, mask), contig, i - k + 1);
+        while (!window.empty() && window.back().hash > entry.hash)
+            window.pop_back();
+        window.push_back(entry);
+        while (window.front().pos + (int)w <= entry.pos)
+            window.pop_front();
+
+        if (++runKmers >= w && window.front().pos != lastPos)
+        {
+            sketch.push_back(window.front());
+            lastPos = window.front().pos;
+        }
+    }
+}
+
+// ==========================================================================
+// Function buildMinimizerIndex()
+// ==========================================================================
+
+// Loads all forward contigs of the store and builds the sorted minimizer table.
+template<typename TSeq>
+void
+buildMinimizerIndex(MinimizerIndex<TSeq> & index, ContigStore & store, MergingOptions & options)
+{
+    index.k = options.minimizerK;
+    index.w = options.minimizerW;
+
+    int n = numFwdContigs(store);
+    clear(index.seqs);
+    reserve(index.seqs, n, Exact());
+    index.table.clear();
+    for (int i = 0; i < n; ++i)
+    {
+        TSeq seq;
+        loadContigSeq(seq, store, i);
+        appendValue(index.seqs, seq);
+        sketchContig(index.table, index.seqs[i], i, index.k, index.w);
+    }
+
+    std::sort(index.table.begin(), index.table.end());
+
+    std::ostringstream msg;
+    msg << "- Sketched " << n << " contigs with " << index.table.size() << " minimizers";
+    printStatus(msg);
+}
+
+// --------------------------------------------------------------------------
+// Function numIndexedContigs()                                MinimizerIndex
+// --------------------------------------------------------------------------
+
+template<typename TSeq>
+inline int
+numIndexedContigs(MinimizerIndex<TSeq> const & index)
+{
+    return length(index.seqs);
+}
+
+// --------------------------------------------------------------------------
+// Function contigSeq()                                        MinimizerIndex
+// --------------------------------------------------------------------------
+
+template<typename TSeq>
+inline TSeq &
+contigSeq(MinimizerIndex<TSeq> & index, int i)
+{
+    return index.seqs[i];
+}
+
+// --------------------------------------------------------------------------
+// Function initFilter()                                       MinimizerIndex
+// --------------------------------------------------------------------------
+
+template<typename TSeq>
+inline void
+initFilter(typename MinimizerIndex<TSeq>::TFilter & filter, MinimizerIndex<TSeq> & /*index*/)
+{
+    filter.sketch.clear();
+    filter.seeds.clear();
+}
+
+// --------------------------------------------------------------------------
+// Function _chainLength()
+// --------------------------------------------------------------------------
+
+// Returns the number of seeds in the longest chain of seeds [begin, end) that is co-linear in query and target.
+// The seeds must be sorted by query position.
+inline unsigned
+_chainLength(std::vector<int> & tails,
+        std::vector<MinimizerSeed>::const_iterator begin,
+        std::vector<MinimizerSeed>::const_iterator end)
+{
+    // Longest strictly increasing subsequence of target positions.
+    tails.clear();
+    for (std::vector<MinimizerSeed>::const_iterator it = begin; it != end; ++it)
+    {
+        std::vector<int>::iterator t = std::lower_bound(tails.begin(), tails.end(), it->tPos);
+        if (t == tails.end())
+            tails.push_back(it->tPos);
+        else
+            *t = it->tPos;
+    }
+    return tails.size();
+}
+
+// --------------------------------------------------------------------------
+// Function minimizerCandidates()
+// --------------------------------------------------------------------------
+
+// Finds the candidate contigs of one strand of forward contig a and appends them to candidates as hits of a that
+// are not verified yet. As for the SWIFT filter, a hit of the reverse complement of a to contig b is recorded as a
+// hit of a to the reverse complement of b.
+template<typename TSeq>
+void
+minimizerCandidates(String<VerifiedHit> & candidates,
+        typename MinimizerIndex<TSeq>::TFilter & filter,
+        int a,
+        TSeq const & query,
+        bool reverse,
+        MinimizerIndex<TSeq> & index,
+        ContigStore & store,
+        MergingOptions & options)
+{
+    int fwdContigCount = numIndexedContigs(index);
+    int diagExtension = options.minScore/10;
+    unsigned sample = contigSample(store, a);
+
+    // Collect the seeds to contigs of other individuals.
+    filter.sketch.clear();
+    sketchContig(filter.sketch, query, a, index.k, index.w);
+
+    filter.seeds.clear();
+    for (unsigned i = 0; i < filter.sketch.size(); ++i)
+    {
+        std::vector<MinimizerEntry>::const_iterator first = std::lower_bound(index.table.begin(), index.table.end(),
+                MinimizerEntry(filter.sketch[i].hash, 0, 0));
+        std::vector<MinimizerEntry>::const_iterator last = std::upper_bound(first, index.table.end(),
+                MinimizerEntry(filter.sketch[i].hash, maxValue<int>(), maxValue<int>()));
+        if (last - first > (int)MINIMIZER_MAX_OCC)
+            continue;
+
+        for (std::vector<MinimizerEntry>::const_iterator it = first; it != last; ++it)
+            if (contigSample(store, it->contig) != sample)
+                filter.seeds.push_back(MinimizerSeed(it->contig, filter.sketch[i].pos, it->pos));
+    }
+    std::sort(filter.seeds.begin(), filter.seeds.end());
+
+    // Cluster the seeds of each target contig by diagonal and chain each cluster.
+    std::vector<MinimizerSeed>::iterator clusterBegin = filter.seeds.begin();
+    while (clusterBegin != filter.seeds.end())
+    {
+        std::vector<MinimizerSeed>::iterator clusterEnd = clusterBegin + 1;
+        while (clusterEnd != filter.seeds.end() && clusterEnd->contig == clusterBegin->contig &&
+                clusterEnd->diag - (clusterEnd - 1)->diag <= diagExtension)
+            ++clusterEnd;
+
+        int lowerDiag = clusterBegin->diag - diagExtension;
+        int upperDiag = (clusterEnd - 1)->diag + diagExtension;
+
+        if (clusterEnd - clusterBegin >= (int)options.minSeeds)
+        {
+            std::sort(clusterBegin, clusterEnd,
+                    [](MinimizerSeed const & x, MinimizerSeed const & y) {
+                        return x.qPos < y.qPos || (x.qPos == y.qPos && x.tPos > y.tPos);
+                    });
+            if (_chainLength(filter.chain, clusterBegin, clusterEnd) >= options.minSeeds)
+            {
+                int b = clusterBegin->contig;
+                int c = reverse ? b + fwdContigCount : b;
+                appendValue(candidates, VerifiedHit(c, lowerDiag, upperDiag, VerifiedHit::NOT_VERIFIED));
+            }
+        }
+
+        clusterBegin = clusterEnd;
+    }
+}
+
+// --------------------------------------------------------------------------
+// Function _contigCandidates()
+// --------------------------------------------------------------------------
+
+// Finds the candidates of the forward strand and then of the reverse complement of contig a.
+template<typename TSeq>
+void
+_contigCandidates(String<VerifiedHit> & candidates,
+        TSeq & revSeq,
+        typename MinimizerIndex<TSeq>::TFilter & filter,
+        int a,
+        MinimizerIndex<TSeq> & index,
+        ContigStore & store,
+        MergingOptions & options)
+{
+    clear(candidates);
+    minimizerCandidates(candidates, filter, a, contigSeq(index, a), false, index, store, options);
+
+    revSeq = contigSeq(index, a);
+    reverseComplement(revSeq);
+    minimizerCandidates(candidates, filter, a, revSeq, true, index, store, options);
+}
+
+// --------------------------------------------------------------------------
+// Function alignContigsWorker()                               MinimizerIndex
+// --------------------------------------------------------------------------
+
+// Thread function: finds the candidates of both strands of the contigs in [blockBegin, blockEnd) and verifies
+// them like collectVerifiedHits() verifies the SWIFT hits.
+template<typename TSeq>
+void
+alignContigsWorker(String<String<VerifiedHit> > & blockHits,
+        ConcurrentUnionFind & sharedUf,
+        std::atomic<int> & nextContig,
+        int blockBegin,
+        int blockEnd,
+        MinimizerIndex<TSeq> & index,
+        ContigStore & store,
+        MergingOptions & options)
+{
+    typename MinimizerIndex<TSeq>::TFilter filter;
+    initFilter(filter, index);
+    Score<int, Simple> scoringScheme(options.matchScore, options.errorPenalty, options.errorPenalty);
+    int fwdContigCount = numIndexedContigs(index);
+    TSeq revSeq;
+
+    for (int a = nextContig++; a < blockEnd; a = nextContig++)
+    {
+        String<VerifiedHit> & hits = blockHits[a - blockBegin];
+        _contigCandidates(hits, revSeq, filter, a, index, store, options);
+
+        String<BandedAlignmentPair<TSeq> > batch;
+        String<unsigned> batchHits;
+        for (unsigned i = 0; i < length(hits); ++i)
+        {
+            int c = hits[i].contig;
+            if (findSet(sharedUf, a) == findSet(sharedUf, c))
+                continue;
+
+            TSeq & query = (c < fwdContigCount) ? contigSeq(index, a) : revSeq;
+            TSeq & target = contigSeq(index, c % fwdContigCount);
+            if (options.batchAlignments)
+            {
+                appendValue(batchHits, i);
+                appendValue(batch, BandedAlignmentPair<TSeq>(query, target, hits[i].lowerDiag, hits[i].upperDiag));
+            }
+            else
+            {
+                if (pairwiseAlignment(query, target, scoringScheme, hits[i].lowerDiag, hits[i].upperDiag, options.minScore))
+                {
+                    hits[i].status = VerifiedHit::ALIGNED;
+                    joinAlignedContigs(sharedUf, a, c, fwdContigCount);
+                }
+                else
+                {
+                    hits[i].status = VerifiedHit::NOT_ALIGNED;
+                }
+            }
+        }
+
+        if (empty(batch))
+            continue;
+
+        String<bool> aligned;
+        bandedLocalAlignments(aligned, batch, scoringScheme, options.minScore);
+        for (unsigned i = 0; i < length(batch); ++i)
+        {
+            VerifiedHit & hit = hits[batchHits[i]];
+            hit.status = aligned[i] ? VerifiedHit::ALIGNED : VerifiedHit::NOT_ALIGNED;
+            if (aligned[i])
+                joinAlignedContigs(sharedUf, a, hit.contig, fwdContigCount);
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+// Function alignContigSerial()                                MinimizerIndex
+// --------------------------------------------------------------------------
+
+// Aligns forward contig a, then its reverse complement, to the candidates of the minimizer filter.
+template<typename TSize, typename TSeq>
+void
+alignContigSerial(ConcurrentUnionFind & uf,
+        std::set<Pair<TSize> > & alignedPairs,
+        TSize & numComparisons,
+        int a,
+        MinimizerIndex<TSeq> & index,
+        typename MinimizerIndex<TSeq>::TFilter & filter,
+        ContigStore & store,
+        Score<int, Simple> & scoringScheme,
+        MergingOptions & options)
+{
+    TSeq revSeq;
+    _contigCandidates(filter.candidates, revSeq, filter, a, index, store, options);
+    joinVerifiedHits(uf, alignedPairs, numComparisons, filter.candidates, a, index, scoringScheme, options);
+}
+
+#endif  // #ifndef POPINS_MERGE_MINIMIZER_FILTER_H_
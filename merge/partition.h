@@ -1,10 +1,19 @@
 #ifndef POPINS_MERGE_PARTITION_H_
 #define POPINS_MERGE_PARTITION_H_
 
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
 #include <seqan/index.h>
 #include <seqan/align.h>
 
 #include "contig_structs.h"
+#include "contig_store.h"
+#include "union_find.h"
+#include "banded_alignment.h"
 
 using namespace seqan;
 
@@ -12,6 +21,7 @@ using namespace seqan;
 // Function pairwiseAlignment()
 // --------------------------------------------------------------------------
 
+// Returns true if the banded local alignment of the two contigs scores more than minScore.   --> banded_alignment.h
 template<typename TSeq, typename TValueScore>
 inline bool
 pairwiseAlignment(TSeq & contig1,
@@ -21,58 +31,498 @@ pairwiseAlignment(TSeq & contig1,
         int upperDiag,
         TValueScore minScore)
 {
-    // setup alignment object
-    Align<TSeq, ArrayGaps> align;
-    resize(rows(align), 2);
-    setSource(row(align, 0), contig1);
-    setSource(row(align, 1), contig2);
+    return bandedLocalAlignment(contig1, contig2, scoringScheme, lowerDiag, upperDiag, minScore);
+}
 
-    // compute local alignment
-    int score = localAlignment(align, scoringScheme, lowerDiag, upperDiag);
+// --------------------------------------------------------------------------
+// struct VerifiedHit
+// --------------------------------------------------------------------------
 
-    // return true if minimal score is reached
-    if (score > minScore)
-        return true;
-    else
-        return false;
+// A SWIFT hit of a forward contig against another contig, its alignment band and verification result.
+struct VerifiedHit
+{
+    enum Status
+    {
+        NOT_ALIGNED,
+        ALIGNED,
+        NOT_VERIFIED    // skipped because the contigs were already in the same set of the shared union-find
+    };
+
+    int contig;
+    int lowerDiag;
+    int upperDiag;
+    Status status;
+
+    VerifiedHit() :
+        contig(0), lowerDiag(0), upperDiag(0), status(NOT_VERIFIED)
+    {}
+
+    VerifiedHit(int c, int l, int u, Status s) :
+        contig(c), lowerDiag(l), upperDiag(u), status(s)
+    {}
+};
+
+// --------------------------------------------------------------------------
+// Function swiftHitBand()
+// --------------------------------------------------------------------------
+
+// Computes the band of diagonals for verifying the current hit of the SWIFT finder.
+template<typename TFinder, typename TPattern>
+inline void
+swiftHitBand(int & lowerDiag,
+        int & upperDiag,
+        TFinder & swiftFinder,
+        TPattern & swiftPattern,
+        int diagExtension)
+{
+    int b = swiftPattern.curSeqNo;
+
+    // compute upper and lower diagonal of band.
+    upperDiag = (*swiftFinder.curHit).hstkPos - (*swiftFinder.curHit).ndlPos;
+    lowerDiag = upperDiag - swiftPattern.bucketParams[b].delta - swiftPattern.bucketParams[b].overlap;
+    upperDiag += diagExtension;
+    lowerDiag -= diagExtension;
 }
 
-// ==========================================================================
-// Function partitionContigs()
-// ==========================================================================
+// --------------------------------------------------------------------------
+// Function joinAlignedContigs()
+// --------------------------------------------------------------------------
 
-template<typename TSize, typename TSeq>
+// Joins the sets of the two contigs and of their reverse complements.
+// Returns true if contig a is now in a component with more than 100 other contigs.
+inline bool
+joinAlignedContigs(ConcurrentUnionFind & uf,
+        int a,
+        int b,
+        int fwdContigCount)
+{
+    // join sets of the two aligned contigs
+    joinSets(uf, a, b);
+
+    // join sets for reverse complements of the contigs
+    int a1 = a < fwdContigCount ? a + fwdContigCount : a - fwdContigCount;
+    int b1 = b < fwdContigCount ? b + fwdContigCount : b - fwdContigCount;
+    joinSets(uf, a1, b1);
+
+    return setSize(uf, a) > 100;
+}
+
+// --------------------------------------------------------------------------
+// struct ContigIndex
+// --------------------------------------------------------------------------
+
+// Q-gram indices over consecutive ranges of forward contigs. A merge from scratch has one generation over all
+// contigs; an incremental merge adds a generation for the contigs of the new samples.
+template<typename TSeq>
+struct ContigIndex
+{
+    typedef StringSet<TSeq> TStringSet;
+    typedef TSeq TSequence;
+    typedef Index<TStringSet, IndexQGram<SimpleShape, OpenAddressing> > TIndex;
+    typedef Pattern<TIndex, Swift<SwiftLocal> > TPattern;
+    typedef std::vector<std::unique_ptr<TPattern> > TFilter;     // search state of one thread
+
+    std::vector<std::unique_ptr<TIndex> > generations;
+    std::vector<int> begins;    // first contig of each generation and, as last element, the number of contigs
+
+    ContigIndex() :
+        begins(1, 0)
+    {}
+};
+
+// --------------------------------------------------------------------------
+// Function addGeneration()                                       ContigIndex
+// --------------------------------------------------------------------------
+
+// Builds the q-gram index over the forward contigs [begins.back(), endContig) of the store.
+template<typename TSeq>
+void
+addGeneration(ContigIndex<TSeq> & index, ContigStore & store, int endContig, unsigned qgramLength)
+{
+    typedef typename ContigIndex<TSeq>::TIndex TIndex;
+
+    std::unique_ptr<TIndex> generation(new TIndex());
+    typename ContigIndex<TSeq>::TStringSet & seqs = indexText(*generation);
+    reserve(seqs, endContig - index.begins.back(), Exact());
+    for (int i = index.begins.back(); i < endContig; ++i)
+    {
+        TSeq seq;
+        loadContigSeq(seq, store, i);
+        appendValue(seqs, seq);
+    }
+
+    resize(indexShape(*generation), qgramLength);
+    indexRequire(*generation, QGramSADir());
+
+    index.generations.push_back(std::move(generation));
+    index.begins.push_back(endContig);
+}
+
+// --------------------------------------------------------------------------
+// Function numIndexedContigs()                                   ContigIndex
+// --------------------------------------------------------------------------
+
+template<typename TSeq>
+inline int
+numIndexedContigs(ContigIndex<TSeq> const & index)
+{
+    return index.begins.back();
+}
+
+// --------------------------------------------------------------------------
+// Function contigSeq()                                           ContigIndex
+// --------------------------------------------------------------------------
+
+// Returns the sequence of forward contig i from the index text.
+template<typename TSeq>
+TSeq &
+contigSeq(ContigIndex<TSeq> & index, int i)
+{
+    unsigned g = std::upper_bound(index.begins.begin(), index.begins.end(), i) - index.begins.begin() - 1;
+    return indexText(*index.generations[g])[i - index.begins[g]];
+}
+
+// --------------------------------------------------------------------------
+// Function initFilter()                                          ContigIndex
+// --------------------------------------------------------------------------
+
+// Creates a SWIFT pattern for each generation. Patterns keep search state and cannot be shared between threads.
+template<typename TSeq>
+void
+initFilter(typename ContigIndex<TSeq>::TFilter & patterns,
+        ContigIndex<TSeq> & index)
+{
+    typedef typename ContigIndex<TSeq>::TPattern TPattern;
+
+    patterns.clear();
+    for (unsigned g = 0; g < index.generations.size(); ++g)
+        patterns.push_back(std::unique_ptr<TPattern>(new TPattern(*index.generations[g])));
+}
+
+// --------------------------------------------------------------------------
+// Function collectVerifiedHits()
+// --------------------------------------------------------------------------
+
+// Runs the SWIFT filter for one strand of forward contig a against one index generation starting at contig
+// targetBegin and verifies the hits to contigs of other individuals. The index holds forward contigs only, so a
+// hit of the reverse complement of a to contig b is recorded as a hit of a to the reverse complement of b. Hits
+// to contigs that are already in the same set of the shared union-find are not verified. Successful alignments
+// are joined into the shared union-find right away so that the other threads can skip them, too. With
+// --batchAlignments, the hits are collected first and verified in batches across SIMD lanes.
+template<typename TSeq, typename TPattern>
+void
+collectVerifiedHits(String<VerifiedHit> & hits,
+        ConcurrentUnionFind & sharedUf,
+        int a,
+        TSeq & query,
+        bool reverse,
+        int fwdContigCount,
+        int targetBegin,
+        ContigStore & store,
+        TPattern & swiftPattern,
+        Score<int, Simple> & scoringScheme,
+        int diagExtension,
+        MergingOptions & options)
+{
+    typedef Finder<TSeq, Swift<SwiftLocal> > TFinder;
+
+    // initialization of swift finder
+    TFinder swiftFinder(query, 1000, 1);
+
+    String<BandedAlignmentPair<TSeq> > batch;
+    String<unsigned> batchHits;
+
+    hash(swiftPattern.shape, hostIterator(hostIterator(swiftFinder)));
+    while (find(swiftFinder, swiftPattern, options.errorRate, options.minimalLength))
+    {
+        // get index of pattern sequence
+        int b = targetBegin + swiftPattern.curSeqNo;
+
+        // align contigs only of different individuals
+        if (contigSample(store, a) == contigSample(store, b)) continue;
+
+        int lowerDiag, upperDiag;
+        swiftHitBand(lowerDiag, upperDiag, swiftFinder, swiftPattern, diagExtension);
+
+        int c = reverse ? b + fwdContigCount : b;
+        if (findSet(sharedUf, a) == findSet(sharedUf, c))
+        {
+            appendValue(hits, VerifiedHit(c, lowerDiag, upperDiag, VerifiedHit::NOT_VERIFIED));
+            continue;
+        }
+
+        // verify by banded Smith-Waterman alignment
+        TSeq & target = indexText(needle(swiftPattern))[swiftPattern.curSeqNo];
+        if (options.batchAlignments)
+        {
+            appendValue(batchHits, length(hits));
+            appendValue(batch, BandedAlignmentPair<TSeq>(query, target, lowerDiag, upperDiag));
+            appendValue(hits, VerifiedHit(c, lowerDiag, upperDiag, VerifiedHit::NOT_ALIGNED));
+        }
+        else if (pairwiseAlignment(query, target, scoringScheme, lowerDiag, upperDiag, options.minScore))
+        {
+            appendValue(hits, VerifiedHit(c, lowerDiag, upperDiag, VerifiedHit::ALIGNED));
+            joinAlignedContigs(sharedUf, a, c, fwdContigCount);
+        }
+        else
+        {
+            appendValue(hits, VerifiedHit(c, lowerDiag, upperDiag, VerifiedHit::NOT_ALIGNED));
+        }
+    }
+
+    if (empty(batch))
+        return;
+
+    String<bool> aligned;
+    bandedLocalAlignments(aligned, batch, scoringScheme, options.minScore);
+    for (unsigned i = 0; i < length(batch); ++i)
+    {
+        if (!aligned[i]) continue;
+        VerifiedHit & hit = hits[batchHits[i]];
+        hit.status = VerifiedHit::ALIGNED;
+        joinAlignedContigs(sharedUf, a, hit.contig, fwdContigCount);
+    }
+}
+
+// --------------------------------------------------------------------------
+// Function alignContigsWorker()
+// --------------------------------------------------------------------------
+
+// Thread function: verifies the SWIFT hits of both strands of the contigs in [blockBegin, blockEnd) against all
+// index generations with its own patterns.
+template<typename TSeq>
+void
+alignContigsWorker(String<String<VerifiedHit> > & blockHits,
+        ConcurrentUnionFind & sharedUf,
+        std::atomic<int> & nextContig,
+        int blockBegin,
+        int blockEnd,
+        ContigIndex<TSeq> & index,
+        ContigStore & store,
+        MergingOptions & options)
+{
+    typename ContigIndex<TSeq>::TFilter patterns;
+    initFilter(patterns, index);
+    Score<int, Simple> scoringScheme(options.matchScore, options.errorPenalty, options.errorPenalty);
+    int diagExtension = options.minScore/10;
+    int fwdContigCount = index.begins.back();
+
+    for (int a = nextContig++; a < blockEnd; a = nextContig++)
+    {
+        String<VerifiedHit> & hits = blockHits[a - blockBegin];
+        clear(hits);
+
+        TSeq & seq = contigSeq(index, a);
+        for (unsigned g = 0; g < patterns.size(); ++g)
+            collectVerifiedHits(hits, sharedUf, a, seq, false, fwdContigCount, index.begins[g], store,
+                    *patterns[g], scoringScheme, diagExtension, options);
+
+        TSeq revSeq = seq;
+        reverseComplement(revSeq);
+        for (unsigned g = 0; g < patterns.size(); ++g)
+            collectVerifiedHits(hits, sharedUf, a, revSeq, true, fwdContigCount, index.begins[g], store,
+                    *patterns[g], scoringScheme, diagExtension, options);
+    }
+}
+
+// --------------------------------------------------------------------------
+// Function joinVerifiedHits()
+// --------------------------------------------------------------------------
+
+// Applies the verified hits of contig a to the union-find in the order in which the serial loop visits them.
+// Hits that the worker skipped are verified here if the serial loop would have aligned them.
+// Returns true if contig a is already in a component with more than 100 other contigs.
+template<typename TSize, typename TIndex>
 bool
-partitionContigs(UnionFind<int> & uf,
+joinVerifiedHits(ConcurrentUnionFind & uf,
         std::set<Pair<TSize> > & alignedPairs,
-        String<Contig<TSeq> > & contigs,
+        TSize & numComparisons,
+        String<VerifiedHit> const & hits,
+        int a,
+        TIndex & index,
+        Score<int, Simple> & scoringScheme,
+        MergingOptions & options)
+{
+    int fwdContigCount = numIndexedContigs(index);
+    typename TIndex::TSequence revSeq;
+
+    for (unsigned i = 0; i < length(hits); ++i)
+    {
+        int b = hits[i].contig;
+
+        // align contigs only if not same component already
+        if (findSet(uf, a) == findSet(uf, b)) continue;
+
+        ++numComparisons;
+        if (hits[i].status == VerifiedHit::NOT_ALIGNED) continue;
+        if (hits[i].status == VerifiedHit::NOT_VERIFIED)
+        {
+            bool aligned;
+            if (b < fwdContigCount)
+            {
+                aligned = pairwiseAlignment(contigSeq(index, a), contigSeq(index, b), scoringScheme,
+                        hits[i].lowerDiag, hits[i].upperDiag, options.minScore);
+            }
+            else
+            {
+                if (empty(revSeq))
+                {
+                    revSeq = contigSeq(index, a);
+                    reverseComplement(revSeq);
+                }
+                aligned = pairwiseAlignment(revSeq, contigSeq(index, b - fwdContigCount), scoringScheme,
+                        hits[i].lowerDiag, hits[i].upperDiag, options.minScore);
+            }
+            if (!aligned) continue;
+        }
+
+        alignedPairs.insert(Pair<TSize>(a, b));
+
+        // stop aligning this contig if it is already in a component with more than 100 other contigs
+        if (joinAlignedContigs(uf, a, b, fwdContigCount)) return true;
+    }
+
+    return false;
+}
+
+// --------------------------------------------------------------------------
+// Function alignContig()
+// --------------------------------------------------------------------------
+
+// Runs the SWIFT filter for one strand of forward contig a against one index generation starting at contig
+// targetBegin and joins the contigs it aligns to.
+// Returns true if contig a is already in a component with more than 100 other contigs.
+template<typename TSize, typename TSeq, typename TPattern>
+bool
+alignContig(ConcurrentUnionFind & uf,
+        std::set<Pair<TSize> > & alignedPairs,
+        TSize & numComparisons,
+        int a,
+        TSeq & query,
+        bool reverse,
+        int fwdContigCount,
+        int targetBegin,
+        ContigStore & store,
+        TPattern & swiftPattern,
+        Score<int, Simple> & scoringScheme,
+        int diagExtension,
         MergingOptions & options)
 {
-    typedef typename Iterator<String<Contig<TSeq> > >::Type TContigIter;
-    typedef StringSet<TSeq, Dependent<> > TStringSet;
-    typedef Index<TStringSet, IndexQGram<SimpleShape, OpenAddressing> > TIndex;
     typedef Finder<TSeq, Swift<SwiftLocal> > TFinder;
 
-    printStatus("Partitioning contigs");
-    printStatus("- Indexing contigs");
+    // initialization of swift finder
+    TFinder swiftFinder(query, 1000, 1);
+
+    hash(swiftPattern.data_host.data_value->shape, hostIterator(hostIterator(swiftFinder)));
+    while (find(swiftFinder, swiftPattern, options.errorRate, options.minimalLength))
+    {
+        // get index of pattern sequence
+        int b = targetBegin + swiftPattern.curSeqNo;
+
+        // align contigs only of different individuals
+        if (contigSample(store, a) == contigSample(store, b)) continue;
+
+        // align contigs only if not same component already
+        int c = reverse ? b + fwdContigCount : b;
+        if (findSet(uf, a) == findSet(uf, c)) continue;
+
+        // find the contig sequence
+        TSeq & target = indexText(needle(swiftPattern))[swiftPattern.curSeqNo];
+
+        // compute upper and lower diagonal of band.
+        int lowerDiag, upperDiag;
+        swiftHitBand(lowerDiag, upperDiag, swiftFinder, swiftPattern, diagExtension);
+
+        // verify by banded Smith-Waterman alignment
+        ++numComparisons;
+        if (!pairwiseAlignment(query, target, scoringScheme, lowerDiag, upperDiag, options.minScore)) continue;
+        alignedPairs.insert(Pair<TSize>(a, c));
 
+        // stop aligning this contig if it is already in a component with more than 100 other contigs
+        if (joinAlignedContigs(uf, a, c, fwdContigCount)) return true;
+    }
+
+    return false;
+}
+
+// --------------------------------------------------------------------------
+// Function alignContigSerial()                                   ContigIndex
+// --------------------------------------------------------------------------
+
+// Aligns forward contig a, then its reverse complement, against each generation of the index.
+template<typename TSize, typename TSeq>
+void
+alignContigSerial(ConcurrentUnionFind & uf,
+        std::set<Pair<TSize> > & alignedPairs,
+        TSize & numComparisons,
+        int a,
+        ContigIndex<TSeq> & index,
+        typename ContigIndex<TSeq>::TFilter & patterns,
+        ContigStore & store,
+        Score<int, Simple> & scoringScheme,
+        MergingOptions & options)
+{
+    int fwdContigCount = index.begins.back();
+    int diagExtension = options.minScore/10;
+
+    TSeq & seq = contigSeq(index, a);
+    bool full = false;
+    for (unsigned g = 0; g < patterns.size() && !full; ++g)
+        full = alignContig(uf, alignedPairs, numComparisons, a, seq, false, fwdContigCount, index.begins[g],
+                store, *patterns[g], scoringScheme, diagExtension, options);
+    if (full) return;
+
+    TSeq revSeq = seq;
+    reverseComplement(revSeq);
+    for (unsigned g = 0; g < patterns.size() && !full; ++g)
+        full = alignContig(uf, alignedPairs, numComparisons, a, revSeq, true, fwdContigCount, index.begins[g],
+                store, *patterns[g], scoringScheme, diagExtension, options);
+}
+
+// --------------------------------------------------------------------------
+// Function shardRange()
+// --------------------------------------------------------------------------
+
+// Computes the range [beginContig, endContig) of forward contigs that are aligned by this run of merge.
+inline void
+shardRange(int & beginContig, int & endContig, int fwdContigCount, MergingOptions & options)
+{
+    if (options.shardCount == 0)
+    {
+        beginContig = 0;
+        endContig = fwdContigCount;
+        return;
+    }
+
+    beginContig = (int64_t)fwdContigCount * (options.shardIndex - 1) / options.shardCount;
+    endContig = (int64_t)fwdContigCount * options.shardIndex / options.shardCount;
+}
+
+// ==========================================================================
+// Function partitionContigs()
+// ==========================================================================
+
+// Aligns the forward contigs [beginContig, endContig) against all contigs of the index. The index is either a
+// ContigIndex for the SWIFT filter or a MinimizerIndex (minimizer_filter.h).
+template<typename TSize, typename TIndex>
+bool
+partitionContigs(ConcurrentUnionFind & uf,
+        std::set<Pair<TSize> > & alignedPairs,
+        TIndex & index,
+        ContigStore & store,
+        int beginContig,
+        int endContig,
+        MergingOptions & options)
+{
     TSize numComparisons = 0;
-    int fwdContigCount = length(contigs)/2;
-
-    // initialization of SWIFT pattern (q-gram index)
-    TStringSet seqs;
-    StringSet<TSize> indices;
-    TContigIter itEnd = end(contigs);
-    for (TContigIter it = begin(contigs); it != itEnd; ++it)
-        appendValue(seqs, (*it).seq);
-    TIndex qgramIndex(seqs);
-    resize(indexShape(qgramIndex), options.qgramLength);
-    Pattern<TIndex, Swift<SwiftLocal> > swiftPattern(qgramIndex);
-    indexRequire(qgramIndex, QGramSADir());
+    int fwdContigCount = numIndexedContigs(index);
+
+    // initialization of the filter
+    typename TIndex::TFilter filter;
+    initFilter(filter, index);
 
     // define scoring scheme
     Score<int, Simple> scoringScheme(options.matchScore, options.errorPenalty, options.errorPenalty);
-    int diagExtension = options.minScore/10;
 
     // print status bar
     printStatus("- Aligning contigs");
@@ -80,58 +530,62 @@ partitionContigs(UnionFind<int> & uf,
     std::cerr << "|----|----|----|----|----|----|----|----|----|----|" << std::endl;
     std::cerr << "*" << std::flush;
 
-    double fiftieth = fwdContigCount / 50.0;
+    double fiftieth = (endContig - beginContig) / 50.0;
     unsigned progress = 0;
 
-    // Iterate over the forward contigs.
-    for (int a = 0; a < fwdContigCount; ++a)
+    if (options.threads > 1 || options.batchAlignments)
     {
-    	while (progress * fiftieth < a)
+        // Verify the hits of a block of contigs in parallel and join them in serial order afterwards,
+        // so that the components are identical to those of a single-threaded run. The workers share
+        // a second union-find to skip alignments of contigs that are already known to be connected.
+        ConcurrentUnionFind sharedUf;
+        resize(sharedUf, 2 * fwdContigCount);
+        for (TSize i = 0; i < (TSize)2 * fwdContigCount; ++i)
+            if (findSet(uf, i) != (int)i)
+                joinSets(sharedUf, i, findSet(uf, i));
+
+        int blockSize = 256 * options.threads;
+        for (int blockBegin = beginContig; blockBegin < endContig; blockBegin += blockSize)
         {
-            std::cerr << "*" << std::flush;
-            ++progress;
+            int blockEnd = std::min(blockBegin + blockSize, endContig);
+
+            String<String<VerifiedHit> > blockHits;
+            resize(blockHits, blockEnd - blockBegin);
+
+            std::atomic<int> nextContig(blockBegin);
+            std::vector<std::thread> workers;
+            for (unsigned t = 0; t < options.threads; ++t)
+                workers.push_back(std::thread([&]() {
+                    alignContigsWorker(blockHits, sharedUf, nextContig, blockBegin, blockEnd, index, store, options);
+                }));
+            for (unsigned t = 0; t < workers.size(); ++t)
+                workers[t].join();
+
+            for (int a = blockBegin; a < blockEnd; ++a)
+            {
+                while (progress * fiftieth < a - beginContig)
+                {
+                    std::cerr << "*" << std::flush;
+                    ++progress;
+                }
+
+                joinVerifiedHits(uf, alignedPairs, numComparisons, blockHits[a - blockBegin], a, index,
+                        scoringScheme, options);
+            }
         }
-
-        // initialization of swift finder
-        TFinder swiftFinder(contigs[a].seq, 1000, 1);
-
-        hash(swiftPattern.data_host.data_value->shape, hostIterator(hostIterator(swiftFinder)));
-        while (find(swiftFinder, swiftPattern, options.errorRate, options.minimalLength))
+    }
+    else
+    {
+        // Iterate over the forward contigs.
+        for (int a = beginContig; a < endContig; ++a)
         {
-            // get index of pattern sequence
-            int b = swiftPattern.curSeqNo;
-
-            // align contigs only of different individuals
-            if (contigs[a].id.pn == contigs[b].id.pn) continue;
-
-            // align contigs only if not same component already
-            if (findSet(uf, a) == findSet(uf, b)) continue;
-
-            // find the contig sequences
-            TSeq contigA = haystack(swiftFinder);
-            TSeq contigB = indexText(needle(swiftPattern))[b];
-
-            // compute upper and lower diagonal of band.
-            int upperDiag = (*swiftFinder.curHit).hstkPos - (*swiftFinder.curHit).ndlPos;
-            int lowerDiag = upperDiag - swiftPattern.bucketParams[b].delta - swiftPattern.bucketParams[b].overlap;
-            upperDiag += diagExtension;
-            lowerDiag -= diagExtension;
-
-            // verify by banded Smith-Waterman alignment
-            ++numComparisons;
-            if (!pairwiseAlignment(contigA, contigB, scoringScheme, lowerDiag, upperDiag, options.minScore)) continue;
-            alignedPairs.insert(Pair<TSize>(a, b));
-
-            // join sets of the two aligned contigs
-            joinSets(uf, findSet(uf, a), findSet(uf, b));
-
-            // join sets for reverse complements of the contigs
-            int a1 = a < fwdContigCount ? a + fwdContigCount : a - fwdContigCount;
-            int b1 = b < fwdContigCount ? b + fwdContigCount : b - fwdContigCount;
-            joinSets(uf, findSet(uf, a1), findSet(uf, b1));
+        	while (progress * fiftieth < a - beginContig)
+            {
+                std::cerr << "*" << std::flush;
+                ++progress;
+            }
 
-            // stop aligning this contig if it is already in a component with more than 100 other contigs
-            if (uf._values[findSet(uf, a)] < -100) break;
+            alignContigSerial(uf, alignedPairs, numComparisons, a, index, filter, store, scoringScheme, options);
         }
     }
     while (progress < 50)
@@ -159,7 +613,7 @@ partitionContigs(UnionFind<int> & uf,
 template<typename TSize, typename TSeq>
 void
 unionFindToComponents(std::map<TSize, ContigComponent<TSeq> > & components,
-        UnionFind<int> & uf,
+        ConcurrentUnionFind & uf,
         std::set<Pair<TSize> > & alignedPairs,
       unsigned fwdContigCount)
 {
@@ -191,11 +645,11 @@ unionFindToComponents(std::map<TSize, ContigComponent<TSeq> > & components,
 template<typename TSize, typename TSeq>
 void
 addSingletons(std::map<TSize, ContigComponent<TSeq> > & components,
-        String<Contig<TSeq> > & contigs,
-        UnionFind<int> & uf)
+        ContigStore & store,
+        ConcurrentUnionFind & uf)
 {
     unsigned numSingletons = 0;
-    for (int i = 0; i < (int)length(contigs)/2; ++i)
+    for (int i = 0; i < (int)numFwdContigs(store); ++i)
     {
         if (components.count(i) == 0 && i == findSet(uf, i))
         {
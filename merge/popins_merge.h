@@ -8,8 +8,13 @@
 #include "../popins_utils.h"
 #include "../command_line_parsing.h"
 
+#include "contig_store.h"
 #include "partition.h"
+#include "minimizer_filter.h"
+#include "aligned_pairs.h"
 #include "merge_seqs.h"
+#include "merge_state.h"
+#include "checkpoint.h"
 
 
 using namespace seqan;
@@ -56,45 +61,42 @@ averageEntropy(TSeq & seq)
 
 template<typename TSeq>
 bool
-readContigFile(String<Contig<TSeq> > & contigs,
+readContigFile(ContigStoreWriter & writer,
         CharString & filename,
         CharString & sampleId,
-      MergingOptions & options)
+        MergingOptions & options)
 {
     // Open the FASTA file.
     SeqFileIn stream(toCString(filename));
 
-    unsigned numContigsBefore = length(contigs);
+    unsigned sample = addSample(writer, sampleId);
 
-    // Read the records from FASTA file.
-    unsigned basepairs = 0, numFiltered = 0;
+    // Read the records from FASTA file and append them to the contig store.
+    unsigned basepairs = 0, numContigs = 0, numFiltered = 0;
     while (!atEnd(stream))
     {
         CharString contigName;
         TSeq seq;
         readRecord(contigName, seq, stream);
-        ContigId contigId(sampleId, contigName, true);
 
         // Entropy calculation
         double entropy = averageEntropy(seq);
 
         if (entropy >= options.minEntropy)
         {
-           // Append contig and contigId.
-           appendValue(contigs, Contig<TSeq>(seq, contigId));
-           basepairs += length(seq);
+            basepairs += length(seq);
+            ++numContigs;
         }
-        else if (options.skippedFile != "")
+        else
         {
-           // Output contig as skipped.
-            options.skippedStream << ">" << contigId << " entropy: " << entropy << std::endl;
-            options.skippedStream << seq << std::endl;
             ++numFiltered;
         }
+
+        appendContig(writer, sample, contigName, seq, entropy, entropy >= options.minEntropy);
     }
 
     std::ostringstream msg;
-    msg << "Loaded " << filename << ": " << basepairs << " bp in " << (length(contigs) - numContigsBefore) << " contigs";
+    msg << "Loaded " << filename << ": " << basepairs << " bp in " << numContigs << " contigs";
     if (numFiltered > 0)
         msg << " (additional " << numFiltered << " contigs failed the entropy filter)";
     printStatus(msg);
@@ -103,46 +105,55 @@ readContigFile(String<Contig<TSeq> > & contigs,
 }
 
 // --------------------------------------------------------------------------
-// Function readInputFiles()
+// Function contigStoreManifest()
 // --------------------------------------------------------------------------
 
-template<typename TSeq>
-bool
-readInputFiles(String<Contig<TSeq> > & contigs, MergingOptions & options)
+// Describes the input of the contig store: the entropy threshold and every contig file with its size and
+// modification time.
+inline std::string
+contigStoreManifest(String<Pair<CharString> > & contigFiles, MergingOptions & options)
 {
-   // List all files <prefix>/*/contigs.fa
-   CharString filename = "contigs.fa";
-   String<Pair<CharString> > contigFiles = listFiles(options.prefix, filename);
+    std::ostringstream manifest;
+    manifest << std::setprecision(17) << "minEntropy\t" << options.minEntropy << "\n";
 
-   // Read the contig files.
-   for (unsigned i = 0; i < length(contigFiles); ++i)
-      if (readContigFile(contigs, contigFiles[i].i2, contigFiles[i].i1, options) != 0)
-         return 1;
+    for (unsigned i = 0; i < length(contigFiles); ++i)
+        manifest << contigFileDescription(contigFiles[i]) << "\n";
 
-    return 0;
+    return manifest.str();
 }
 
 // --------------------------------------------------------------------------
-// Function addReverseComplementContigs()
+// Function readInputFiles()
 // --------------------------------------------------------------------------
 
+// Opens the contig store, (re)building it from the contig files unless it is up to date.
 template<typename TSeq>
-void
-addReverseComplementContigs(String<Contig<TSeq> > & contigs)
+bool
+readInputFiles(ContigStore & store, String<Pair<CharString> > & contigFiles, MergingOptions & options)
 {
-    unsigned fwdContigCount = length(contigs);
+    std::string manifest = contigStoreManifest(contigFiles, options);
 
-    for (unsigned i = 0; i < fwdContigCount; ++i)
+    if (exists(options.contigStoreFile) && openContigStore(store, options.contigStoreFile) == 0 && isCurrent(store, manifest))
     {
-        TSeq revSeq = contigs[i].seq;
-        reverseComplement(revSeq);
-
-        SEQAN_ASSERT(contigs[i].id.orientation);
-        ContigId revId = contigs[i].id;
-        revId.orientation = false;
-
-        appendValue(contigs, Contig<TSeq>(revSeq, revId));
+        std::ostringstream msg;
+        msg << "Using contig store " << options.contigStoreFile << ": " << numFwdContigs(store) << " contigs from "
+            << store.header->numSamples << " samples";
+        printStatus(msg);
+        return 0;
     }
+    closeContigStore(store);
+
+    // Read the contig files into a new contig store.
+    ContigStoreWriter writer;
+    if (createContigStore(writer, options.contigStoreFile, manifest) != 0)
+        return 1;
+    for (unsigned i = 0; i < length(contigFiles); ++i)
+        if (readContigFile<TSeq>(writer, contigFiles[i].i2, contigFiles[i].i1, options) != 0)
+            return 1;
+    if (finishContigStore(writer) != 0)
+        return 1;
+
+    return openContigStore(store, options.contigStoreFile);
 }
 
 // ==========================================================================
@@ -161,16 +172,19 @@ int popins_merge(int argc, char const ** argv)
         return res;
 
     // Containers for contigs, contig ids, and components.
-    String<Contig<TSequence> > contigs;
+    ContigStore store;
     std::map<TSize, ContigComponent<TSequence> > components;
     std::set<int> skipped;
 
-    // Open the output files.
-    options.outputStream.open(toCString(options.outputFile), std::ios_base::out);
-    if (!options.outputStream.is_open())
+    // Open the output files. A shard writes only its aligned pairs.
+    if (options.shardCount == 0)
     {
-        std::cerr << "ERROR: Could not open output file " << options.outputFile << std::endl;
-        return 7;
+        options.outputStream.open(toCString(options.outputFile), std::ios_base::out);
+        if (!options.outputStream.is_open())
+        {
+            std::cerr << "ERROR: Could not open output file " << options.outputFile << std::endl;
+            return 7;
+        }
     }
     if (options.skippedFile != "")
     {
@@ -182,23 +196,180 @@ int popins_merge(int argc, char const ** argv)
         }
     }
 
-    // Read and filter the contigs and add reverse complements.
-    if (readInputFiles(contigs, options) != 0)
+    // Create the state directory if it does not exist.
+    if (options.stateDir != "" && mkdir(toCString(options.stateDir), 0755) == 0)
+    {
+        std::ostringstream msg;
+        msg << "State directory created at " << options.stateDir;
+        printStatus(msg);
+    }
+
+    // List all files <prefix>/*/contigs.fa
+    CharString filename = "contigs.fa";
+    String<Pair<CharString> > contigFiles = listFiles(options.prefix, filename);
+
+    // Continue from the state of a previous merge, which puts the contig files of its samples first.   --> merge_state.h
+    MergeState state;
+    bool incremental = false;
+    if (options.stateDir != "")
+    {
+        if (readMergeState(state, options) != 0)
+            return 7;
+        incremental = applyMergeState(contigFiles, state, options);
+    }
+
+    // Read and filter the contigs into the memory-mapped contig store.   --> contig_store.h
+    if (readInputFiles<TSequence>(store, contigFiles, options) != 0)
        return 7;
-    addReverseComplementContigs(contigs);
+    if (options.skippedFile != "")
+        writeFilteredContigs<TSequence>(options.skippedStream, store);
 
-    // PARTITIONING into components      --> partition.h
-    UnionFind<int> uf;
-    resize(uf, 2 * length(contigs));
+    if (options.stateDir != "")
+    {
+        if (incremental && !checkStateContigs(store, state))
+            incremental = false;
+
+        std::ostringstream msg;
+        if (incremental)
+            msg << "Continuing merge of " << state.numContigs << " contigs from " << options.stateDir;
+        else
+            msg << "No usable merge state in " << options.stateDir << ", merging all contigs";
+        printStatus(msg);
+    }
+
+    // Resume an interrupted merge from its last checkpoint.   --> checkpoint.h
+    std::string checkpoint;
+    CheckpointPhase resumePhase = CHECKPOINT_NONE;
+    if (options.shardCount == 0)
+    {
+        checkpoint = checkpointDescription(contigFiles, store, options);
+        if (options.resume)
+            resumePhase = readCheckpointPhase(checkpoint, options);
+    }
+
+    // PARTITIONING into components      --> partition.h, aligned_pairs.h
+    ConcurrentUnionFind uf;
+    resize(uf, 2 * numFwdContigs(store));
     std::set<Pair<TSize> > alignedPairs;
-    if (partitionContigs(uf, alignedPairs, contigs, options) != 0)
+    ContigIndex<TSequence> index;
+    if (resumePhase != CHECKPOINT_NONE)
+    {
+        // The pairs are needed for the components and for the merge state.
+        if ((resumePhase == CHECKPOINT_PARTITIONED || options.stateDir != "") &&
+                readPairsCheckpoint(uf, alignedPairs, store, options) != 0)
+            return 7;
+
+        // The interrupted run has saved the index generation over the new contigs before partitioning.
+        if (options.stateDir != "" && options.filter == "swift")
+        {
+            if (incremental)
+                index.begins.insert(index.begins.end(), state.generationEnds.begin(), state.generationEnds.end());
+            if (index.begins.back() < (int)numFwdContigs(store))
+                index.begins.push_back(numFwdContigs(store));
+        }
+    }
+    else if (options.combineCount != 0)
+    {
+        if (combineShards(uf, alignedPairs, store, options) != 0)
+            return 7;
+    }
+    else
+    {
+        printStatus("Partitioning contigs");
+
+        // An incremental merge aligns only the new contigs against all contigs.
+        int beginContig, endContig;
+        shardRange(beginContig, endContig, numFwdContigs(store), options);
+        if (incremental)
+        {
+            if (readStatePairs(uf, alignedPairs, store, state, options) != 0)
+                return 7;
+            beginContig = state.numContigs;
+        }
+
+        if (options.filter == "minimizer")
+        {
+            // Candidate pairs from shared minimizers instead of SWIFT hits   --> minimizer_filter.h
+            MinimizerIndex<TSequence> minimizerIndex;
+            printStatus("- Sketching contigs");
+            buildMinimizerIndex(minimizerIndex, store, options);
+            if (partitionContigs(uf, alignedPairs, minimizerIndex, store, beginContig, endContig, options) != 0)
+                return 7;
+        }
+        else
+        {
+            // The SWIFT index of an incremental merge consists of the index generations of earlier merges and
+            // a new generation over the new contigs.
+            if (incremental && loadGenerations(index, state, options) != 0)
+                return 7;
+
+            if (index.begins.back() < (int)numFwdContigs(store))
+            {
+                printStatus("- Indexing contigs");
+                addGeneration(index, store, numFwdContigs(store), options.qgramLength);
+                if (options.stateDir != "" && saveGeneration(index, index.generations.size() - 1, options) != 0)
+                    return 7;
+            }
+
+            if (partitionContigs(uf, alignedPairs, index, store, beginContig, endContig, options) != 0)
+                return 7;
+        }
+    }
+
+    if (options.shardCount != 0)
+    {
+        CharString pairsFile = shardPairsFile(options, options.shardIndex, options.shardCount);
+        if (writeAlignedPairs(pairsFile, alignedPairs, store) != 0)
+            return 7;
+
+        std::ostringstream msg;
+        msg << "Aligned pairs of shard " << options.shardIndex << "/" << options.shardCount << " written to " << pairsFile;
+        printStatus(msg);
+        return 0;
+    }
+
+    if (resumePhase == CHECKPOINT_NONE && writePairsCheckpoint(alignedPairs, store, checkpoint, options) != 0)
         return 7;
 
-    unionFindToComponents(components, uf, alignedPairs, length(contigs)/2);
-    addSingletons(components, contigs, uf);
+    if (resumePhase == CHECKPOINT_COMPONENTS)
+    {
+        if (readComponentsCheckpoint(components, store, options) != 0)
+            return 7;
+    }
+    else
+    {
+        unionFindToComponents(components, uf, alignedPairs, numFwdContigs(store));
+        addSingletons(components, store, uf);
+        if (writeComponentsCheckpoint(components, checkpoint, options) != 0)
+            return 7;
+    }
 
     // SUPERCONTIG CONSTRUCTION           --> merge_seqs.h
-    constructSupercontigs(components, contigs, options);
+    SupercontigCache cache;
+    if (incremental && readSupercontigCache(cache, options) != 0)
+        return 7;
+    constructSupercontigs(components, store, cache, options);
+
+    // Keep the state for the next merge.   --> merge_state.h
+    if (options.stateDir != "")
+    {
+        CharString pairsFile = getFileName(options.stateDir, "aligned.pairs");
+        if (writeAlignedPairs(pairsFile, alignedPairs, store) != 0)
+            return 7;
+        if (writeSupercontigCache(cache, options) != 0)
+            return 7;
+
+        state.parameters = mergeParameters(options);
+        state.contigFiles.clear();
+        for (unsigned i = 0; i < length(contigFiles); ++i)
+            state.contigFiles.push_back(contigFileDescription(contigFiles[i]));
+        state.numContigs = numFwdContigs(store);
+        state.generationEnds.assign(index.begins.begin() + 1, index.begins.end());
+        if (writeMergeState(state, options) != 0)
+            return 7;
+    }
+
+    removeCheckpoints(options);
 
     return 0;
 }
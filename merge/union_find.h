@@ -0,0 +1,148 @@
+#ifndef POPINS_MERGE_UNION_FIND_H_
+#define POPINS_MERGE_UNION_FIND_H_
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <utility>
+
+// ============================================================================
+// struct ConcurrentUnionFind
+// ============================================================================
+
+// Union-find over the integers [0, n) that can be used by many threads at once.
+// Each element is a single 64-bit word: a root stores ROOT_FLAG | size, any
+// other element stores the index of its parent. Finds use path halving, unions
+// link the smaller root below the larger one (ties: the lower index stays root)
+// with a single compare-and-swap on the child's word.
+
+struct ConcurrentUnionFind
+{
+    static const uint64_t ROOT_FLAG = uint64_t(1) << 63;
+    static const uint64_t SIZE_MASK = ROOT_FLAG - 1;
+
+    std::unique_ptr<std::atomic<uint64_t>[]> _words;
+    int _length;
+
+    ConcurrentUnionFind() :
+        _length(0)
+    {}
+};
+
+// --------------------------------------------------------------------------
+// Function resize()                                      ConcurrentUnionFind
+// --------------------------------------------------------------------------
+
+// Resets the union-find to n singleton sets. Not thread-safe.
+inline void
+resize(ConcurrentUnionFind & uf, int n)
+{
+    uf._words.reset(new std::atomic<uint64_t>[n]);
+    uf._length = n;
+    for (int i = 0; i < n; ++i)
+        uf._words[i].store(ConcurrentUnionFind::ROOT_FLAG | 1, std::memory_order_relaxed);
+}
+
+// --------------------------------------------------------------------------
+// Function findSet()                                     ConcurrentUnionFind
+// --------------------------------------------------------------------------
+
+// Returns the representative of the set containing x.
+inline int
+findSet(ConcurrentUnionFind & uf, int x)
+{
+    while (true)
+    {
+        uint64_t w = uf._words[x].load(std::memory_order_acquire);
+        if (w & ConcurrentUnionFind::ROOT_FLAG)
+            return x;
+
+        int p = (int)w;
+        uint64_t pw = uf._words[p].load(std::memory_order_acquire);
+        if (pw & ConcurrentUnionFind::ROOT_FLAG)
+            return p;
+
+        // Path halving: let x point to its grandparent. Failure only means another thread did it first.
+        int gp = (int)pw;
+        uf._words[x].compare_exchange_weak(w, (uint64_t)gp, std::memory_order_release, std::memory_order_relaxed);
+        x = gp;
+    }
+}
+
+// --------------------------------------------------------------------------
+// Function setSize()                                     ConcurrentUnionFind
+// --------------------------------------------------------------------------
+
+// Returns the number of elements in the set containing x. While other threads
+// are joining sets the result may lag behind by the sizes of unfinished unions.
+inline uint64_t
+setSize(ConcurrentUnionFind & uf, int x)
+{
+    while (true)
+    {
+        int r = findSet(uf, x);
+        uint64_t w = uf._words[r].load(std::memory_order_acquire);
+        if (w & ConcurrentUnionFind::ROOT_FLAG)
+            return w & ConcurrentUnionFind::SIZE_MASK;
+    }
+}
+
+// --------------------------------------------------------------------------
+// Function _addSetSize()                                 ConcurrentUnionFind
+// --------------------------------------------------------------------------
+
+inline void
+_addSetSize(ConcurrentUnionFind & uf, int x, uint64_t size)
+{
+    while (true)
+    {
+        int r = findSet(uf, x);
+        uint64_t w = uf._words[r].load(std::memory_order_acquire);
+        if (!(w & ConcurrentUnionFind::ROOT_FLAG))
+            continue;
+        if (uf._words[r].compare_exchange_weak(w, w + size, std::memory_order_acq_rel, std::memory_order_relaxed))
+            return;
+    }
+}
+
+// --------------------------------------------------------------------------
+// Function joinSets()                                    ConcurrentUnionFind
+// --------------------------------------------------------------------------
+
+// Joins the sets containing a and b and returns the representative of the joined set.
+inline int
+joinSets(ConcurrentUnionFind & uf, int a, int b)
+{
+    while (true)
+    {
+        a = findSet(uf, a);
+        b = findSet(uf, b);
+        if (a == b)
+            return a;
+
+        uint64_t wa = uf._words[a].load(std::memory_order_acquire);
+        uint64_t wb = uf._words[b].load(std::memory_order_acquire);
+        if (!(wa & ConcurrentUnionFind::ROOT_FLAG) || !(wb & ConcurrentUnionFind::ROOT_FLAG))
+            continue;
+
+        // Make b the root of the smaller set. The order on (size, index) is total, which rules out
+        // two threads linking a below b and b below a at the same time.
+        uint64_t sa = wa & ConcurrentUnionFind::SIZE_MASK;
+        uint64_t sb = wb & ConcurrentUnionFind::SIZE_MASK;
+        if (sa < sb || (sa == sb && a > b))
+        {
+            std::swap(a, b);
+            std::swap(wb, wa);
+            std::swap(sa, sb);
+        }
+
+        // Link b below a; this fails if b is no longer a root or its set has grown in the meantime.
+        if (!uf._words[b].compare_exchange_strong(wb, (uint64_t)a, std::memory_order_acq_rel, std::memory_order_relaxed))
+            continue;
+
+        _addSetSize(uf, a, sb);
+        return a;
+    }
+}
+
+#endif  // #ifndef POPINS_MERGE_UNION_FIND_H_
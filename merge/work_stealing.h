@@ -0,0 +1,77 @@
+#ifndef POPINS_MERGE_WORK_STEALING_H_
+#define POPINS_MERGE_WORK_STEALING_H_
+
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <cstddef>
+
+// ============================================================================
+// struct WorkStealingQueues
+// ============================================================================
+
+// One task deque per thread. A thread takes its own tasks from the front (in
+// ascending order) and, when its deque is empty, steals from the back of the
+// other threads' deques. Tasks are the integers [0, numTasks).
+
+struct WorkStealingQueues
+{
+    std::unique_ptr<std::deque<size_t>[]> _deques;
+    std::unique_ptr<std::mutex[]> _mutexes;
+    unsigned _numThreads;
+
+    WorkStealingQueues() :
+        _numThreads(0)
+    {}
+};
+
+// --------------------------------------------------------------------------
+// Function initTasks()                                    WorkStealingQueues
+// --------------------------------------------------------------------------
+
+// Deals the tasks round-robin to the threads so that low task numbers are processed first. Not thread-safe.
+inline void
+initTasks(WorkStealingQueues & queues, size_t numTasks, unsigned numThreads)
+{
+    queues._deques.reset(new std::deque<size_t>[numThreads]);
+    queues._mutexes.reset(new std::mutex[numThreads]);
+    queues._numThreads = numThreads;
+
+    for (size_t task = 0; task < numTasks; ++task)
+        queues._deques[task % numThreads].push_back(task);
+}
+
+// --------------------------------------------------------------------------
+// Function popTask()                                      WorkStealingQueues
+// --------------------------------------------------------------------------
+
+// Returns false if no task is left in any of the deques.
+inline bool
+popTask(size_t & task, WorkStealingQueues & queues, unsigned thread)
+{
+    {
+        std::lock_guard<std::mutex> lock(queues._mutexes[thread]);
+        if (!queues._deques[thread].empty())
+        {
+            task = queues._deques[thread].front();
+            queues._deques[thread].pop_front();
+            return true;
+        }
+    }
+
+    for (unsigned i = 1; i < queues._numThreads; ++i)
+    {
+        unsigned victim = (thread + i) % queues._numThreads;
+        std::lock_guard<std::mutex> lock(queues._mutexes[victim]);
+        if (!queues._deques[victim].empty())
+        {
+            task = queues._deques[victim].back();
+            queues._deques[victim].pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#endif  // #ifndef POPINS_MERGE_WORK_STEALING_H_
@@ -343,6 +343,38 @@ parseInterval(Triple<CharString, unsigned, unsigned> & out, CharString & in)
     return 0;
 }
 
+// ==========================================================================
+
+// Parses a memory size with an optional suffix K, M or G, as for samtools sort.
+bool
+parseMemory(unsigned long & bytes, CharString const & in)
+{
+    std::string str = toCString(in);
+    char * end = NULL;
+    double value = strtod(str.c_str(), &end);
+    if (end == str.c_str() || value < 0)
+    {
+        std::cerr << "ERROR: Invalid memory size \'" << in << "\'." << std::endl;
+        return 1;
+    }
+
+    std::string suffix = end;
+    if (suffix == "K" || suffix == "k")
+        value *= 1024;
+    else if (suffix == "M" || suffix == "m")
+        value *= 1024 * 1024;
+    else if (suffix == "G" || suffix == "g")
+        value *= 1024 * 1024 * 1024;
+    else if (suffix != "")
+    {
+        std::cerr << "ERROR: Invalid memory size \'" << in << "\'." << std::endl;
+        return 1;
+    }
+
+    bytes = (unsigned long)value;
+    return 0;
+}
+
 bool
 readChromosomes(std::set<CharString> & chromosomes, CharString & referenceFile)
 {